@@ -1,11 +1,16 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <zephyr/sys/util.h>
+
 #include "zephyr/usb/class/hid.h"
+#include "vinkey_hid.h"
 
 static bool blueAlt = false;
 
-uint8_t input_to_hid(uint16_t code, int32_t value)
+// Codes are (bank << 16) | (row << 8) | col, the AX-110 matrix is bank 0.
+// Keys on extra expanders get their own cases with the bank set.
+uint8_t input_to_hid(uint32_t code, int32_t value)
 {
     int hid_code = 0;
     switch (code)
@@ -179,7 +184,7 @@ uint8_t input_to_hid(uint16_t code, int32_t value)
     return hid_code;
 }
 
-bool is_modifier(uint16_t code)
+bool is_modifier(uint32_t code)
 {
     switch (code)
     {
@@ -194,3 +199,71 @@ bool is_modifier(uint16_t code)
     default: return false;
     }
 }
+
+uint16_t input_to_consumer(uint32_t code)
+{
+    if (!blueAlt)
+    {
+        return 0;
+    }
+    switch (code)
+    {
+    case 0x401: return HID_CONSUMER_MUTE; //Z
+    case 0x406: return HID_CONSUMER_VOLUME_DOWN; //X
+    case 0x407: return HID_CONSUMER_VOLUME_UP; //C
+    case 0x307: return HID_CONSUMER_PLAY_PAUSE; //B
+    case 0x506: return HID_CONSUMER_BRIGHTNESS_DOWN; //N
+    case 0x306: return HID_CONSUMER_BRIGHTNESS_UP; //M
+    default: return 0;
+    }
+}
+
+uint8_t input_to_system(uint32_t code)
+{
+    if (!blueAlt)
+    {
+        return 0;
+    }
+    switch (code)
+    {
+    case 0x106: return HID_SYSTEM_SLEEP; //DELETE
+    case 0x105: return HID_SYSTEM_WAKE_UP; //BACKSPACE
+    default: return 0;
+    }
+}
+
+bool input_is_transport_toggle(uint32_t code)
+{
+    return blueAlt && code == 0x100; //SPACE
+}
+
+#ifdef CONFIG_VINKEY_MACRO
+/* Blue ALT chords that start macro playback, slot number is the index */
+static const uint32_t macro_keys[] = {
+    0x501, //Q
+    0x502, //E
+    0x302, //R
+    0x503, //T
+    0x303, //Y
+    0x505, //U
+    0x305, //I
+    0x504, //O
+    0x304, //P
+};
+
+int input_to_macro(uint32_t code)
+{
+    if (!blueAlt)
+    {
+        return -1;
+    }
+    for (int i = 0; i < ARRAY_SIZE(macro_keys) && i < CONFIG_VINKEY_MACRO_COUNT; i++)
+    {
+        if (macro_keys[i] == code)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+#endif
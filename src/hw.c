@@ -1,77 +1,117 @@
-#include "main.h"
-
-const struct gpio_dt_spec caps_lock_led = GPIO_DT_SPEC_GET(DT_ALIAS(caps_lock_led), gpios);
-const struct gpio_dt_spec pwr_on_led = GPIO_DT_SPEC_GET(DT_ALIAS(pwr_on_led), gpios);
-const struct gpio_dt_spec ble_connected_led = GPIO_DT_SPEC_GET(DT_ALIAS(ble_connected_led), gpios);
-const struct gpio_dt_spec usb_connected_led = GPIO_DT_SPEC_GET(DT_ALIAS(usb_connected_led), gpios);
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/sys/reboot.h>
 
-LOG_MODULE_REGISTER(hw, LOG_LEVEL_INF);
-
-static void busy_wait_cycles(uint32_t cycles)
-{
-    // Simple busy-wait loop
-    // Each iteration takes approximately 4 cycles (load, decrement, compare, branch)
-    for (volatile uint32_t i = 0; i < cycles / 4; i++)
-    {
-        __asm__ volatile ("nop");
-    }
-}
+#include "main.h"
 
-static void busy_wait_ms(uint32_t ms)
+static void halt_blink(uint32_t on_ms, uint32_t off_ms)
 {
-    // At 32MHz: 32,000 cycles per millisecond
-    uint32_t cycles = ms * 32000;
-    busy_wait_cycles(cycles);
+    vinkey_led_halt_set(VINKEY_LED_USB, true);
+    k_busy_wait(on_ms * USEC_PER_MSEC);
+    vinkey_led_halt_set(VINKEY_LED_USB, false);
+    k_busy_wait(off_ms * USEC_PER_MSEC);
 }
 
-_Noreturn void failure()
+/*
+ * Interrupts are locked for good, the LED engine timer will never fire again.
+ * Plays the same SOS by spinning, k_busy_wait() follows the real core clock.
+ * The LEDs go through the LED API so pwm-leds boards work here too.
+ */
+static _Noreturn void halt_sos()
 {
-    gpio_pin_set_dt(&pwr_on_led, false);
-    gpio_pin_set_dt(&usb_connected_led, false);
-    gpio_pin_set_dt(&ble_connected_led, false);
+    // Nothing drains the deferred log buffer from here on, flush it now
+    LOG_PANIC();
+    vinkey_led_halt_set(VINKEY_LED_PWR, false);
+    vinkey_led_halt_set(VINKEY_LED_USB, false);
+    vinkey_led_halt_set(VINKEY_LED_BLE, false);
 
     while (true)
     {
         //RED SOS pattern
         for (int i = 0; i < 3; i++)
         {
-            gpio_pin_set_dt(&usb_connected_led, true);
-            busy_wait_ms(100);
-            gpio_pin_set_dt(&usb_connected_led, false);
-            busy_wait_ms(100);
+            halt_blink(100, i == 2 ? 300 : 100);
         }
-        busy_wait_ms(200);
         for (int i = 0; i < 3; i++)
         {
-            gpio_pin_set_dt(&usb_connected_led, true);
-            busy_wait_ms(200);
-            gpio_pin_set_dt(&usb_connected_led, false);
-            busy_wait_ms(200);
+            halt_blink(200, i == 2 ? 400 : 200);
         }
-        busy_wait_ms(200);
     }
 }
 
-_Noreturn void key_scan_failure()
+#ifdef CONFIG_TIMING_FUNCTIONS
+static int timing_setup(void)
+{
+    timing_init();
+    timing_start();
+    return 0;
+}
+
+SYS_INIT(timing_setup, APPLICATION, 0);
+#endif
+
+static K_SEM_DEFINE(fault_sem, 0, 1);
+static atomic_t fault_raised;
+static enum vinkey_indicator fault_indicator;
+
+/*
+ * Halts the firmware on behalf of the failing thread, which may be the system
+ * workqueue or the BT RX thread. Being the highest cooperative thread, it never
+ * yields once woken, so no other thread runs on a half broken state while the
+ * LED timer keeps playing the pattern until the reset.
+ */
+static void fault_task(void *p1, void *p2, void *p3)
 {
+    k_sem_take(&fault_sem, K_FOREVER);
+
+    vinkey_led_indicate(fault_indicator, true);
+    if (IS_ENABLED(CONFIG_VINKEY_SUPERVISOR))
+    {
+        // Watchdog is no longer fed, the pattern plays until it resets us
+        vinkey_supervisor_fatal();
+    }
+#ifdef CONFIG_VINKEY_FAULT_REBOOT
+    k_busy_wait(CONFIG_VINKEY_FAULT_REBOOT_MS * USEC_PER_MSEC);
+    sys_reboot(SYS_REBOOT_COLD);
+#endif
     while (true)
     {
-        gpio_pin_set_dt(&pwr_on_led, false);
-        gpio_pin_set_dt(&usb_connected_led, true);
-        gpio_pin_set_dt(&ble_connected_led, false);
-
-        busy_wait_ms(250);
-        gpio_pin_set_dt(&pwr_on_led, false);
-        gpio_pin_set_dt(&usb_connected_led, true);
-        gpio_pin_set_dt(&ble_connected_led, true);
-        busy_wait_ms(500);
-        gpio_pin_set_dt(&pwr_on_led, false);
-        gpio_pin_set_dt(&usb_connected_led, false);
-        gpio_pin_set_dt(&ble_connected_led, true);
-        busy_wait_ms(250);
+        k_busy_wait(USEC_PER_SEC);
     }
 }
 
+K_THREAD_DEFINE(fault_tid, 512, fault_task, NULL, NULL, NULL, -1, 0, 0);
+
+static _Noreturn void fault_stop(enum vinkey_indicator indicator)
+{
+    if (k_is_in_isr() || k_is_pre_kernel())
+    {
+        halt_sos();
+    }
+    // The first fault is the one shown, later ones are usually its fallout
+    if (!atomic_test_and_set_bit(&fault_raised, 0))
+    {
+        // The fault thread never yields, so the log thread would not run again
+        LOG_PANIC();
+        fault_indicator = indicator;
+        k_sem_give(&fault_sem);
+    }
+    // Blocks only until the fault thread takes over the CPU for good
+    while (true)
+    {
+        k_sleep(K_FOREVER);
+    }
+}
+
+_Noreturn void failure()
+{
+    fault_stop(VINKEY_IND_FAULT);
+}
+
+_Noreturn void key_scan_failure()
+{
+    fault_stop(VINKEY_IND_SCAN_FAULT);
+}
+
 
 #ifdef NRF52840_XXAA
 /**
@@ -164,24 +204,6 @@ static void ensure_voltage(unsigned long voltage)
 #endif
 
 
-static int prepare_led(const struct gpio_dt_spec* led, bool active)
-{
-    if (!gpio_is_ready_dt(led))
-    {
-        LOG_ERR("LED device %s is not ready", led->port->name);
-        return -EIO;
-    }
-
-    int ret = gpio_pin_configure_dt(led, active ? GPIO_OUTPUT_ACTIVE : GPIO_OUTPUT_INACTIVE);
-    if (ret != 0)
-    {
-        LOG_ERR("Failed to configure the %s pin, %d", led->port->name, ret);
-        return -EIO;
-    }
-    return 0;
-}
-
-
 void init_hardware()
 {
 #ifdef NRF52840_XXAA
@@ -191,23 +213,22 @@ void init_hardware()
     ensure_voltage(UICR_VREGHVOUT_VREGHVOUT_3V0);
 #endif
 
-
-    prepare_led(&pwr_on_led, true);
-    prepare_led(&caps_lock_led, false);
-    prepare_led(&ble_connected_led, false);
-    prepare_led(&usb_connected_led, false);
-
+    // LED pins are set up by the LED driver, only the state is posted here
+    update_connect_status();
 }
 
 void update_connect_status()
 {
-    gpio_pin_set_dt(&usb_connected_led, usb_kb_ready);
-    gpio_pin_set_dt(&ble_connected_led, ble_kb_ready);
-    gpio_pin_set_dt(&pwr_on_led, !(ble_kb_ready || usb_kb_ready));
+    bool usb = IS_ENABLED(CONFIG_VINKEY_USB) && usb_kb_ready;
+    bool ble = IS_ENABLED(CONFIG_VINKEY_BLE) && ble_kb_ready;
+
+    vinkey_led_indicate(VINKEY_IND_USB, usb);
+    vinkey_led_indicate(VINKEY_IND_BLE, ble);
+    vinkey_led_indicate(VINKEY_IND_POWER, !(ble || usb));
 }
 
 _Noreturn void arch_system_halt(unsigned int reason)
 {
     ARG_UNUSED(reason);
-    failure();
+    halt_sos();
 }
@@ -6,110 +6,534 @@
 
 #include "main.h"
 
-LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(main, CONFIG_VINKEY_LOG_LEVEL);
 
 #include <zephyr/dt-bindings/input/input-event-codes.h>
+#include <zephyr/input/input_kbd_matrix.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
 
-#define KEYS_PER_REPORT (6)
+static struct vinkey_report report = {.id = VINKEY_REPORT_ID_KEYBOARD};
+static struct vinkey_report consumer_report = {.id = VINKEY_REPORT_ID_CONSUMER};
+static struct vinkey_report system_report = {.id = VINKEY_REPORT_ID_SYSTEM};
 
-struct kb_report {
-	uint8_t modifier;
-	uint8_t reserved;
-	uint8_t keys[KEYS_PER_REPORT];
-} __packed;
+/* Matrix positions holding the current consumer and system usages */
+static int32_t consumer_key = -1;
+static int32_t system_key = -1;
 
-struct kb_event {
-	uint16_t code;
-	int32_t value;
-};
 
-K_MSGQ_DEFINE(usb_msgq, sizeof(struct kb_report), 10, 4);
-K_MSGQ_DEFINE(ble_msgq, sizeof(struct kb_report), 10, 4);
+/* Matrix positions the reports hold down, released in one go on recovery */
+static ATOMIC_DEFINE(pressed_keys, VINKEY_MATRIX_KEYS);
+/* k_uptime_ticks() at the last release, only needs to cover the chatter window */
+static uint32_t released_at[VINKEY_MATRIX_KEYS];
+static atomic_t input_held;
+
+/* Every bank reports from its own scan thread, the reports are shared */
+static K_MUTEX_DEFINE(report_lock);
+
+void kb_report_press(struct kb_report *r, uint8_t hid_code)
+{
+	for (int i = 0; i < KEYS_PER_REPORT; i++) {
+		if (r->keys[i] == 0) {
+			r->keys[i] = hid_code;
+			break;
+		}
+	}
+}
+
+void kb_report_release(struct kb_report *r, uint8_t hid_code)
+{
+	for (int i = 0; i < KEYS_PER_REPORT; i++) {
+		if (r->keys[i] == hid_code) {
+			r->keys[i] = 0;
+			/* Shift remaining keys left */
+			for (int j = i; j < (KEYS_PER_REPORT-1); j++) {
+				r->keys[j] = r->keys[j+1];
+			}
+			r->keys[KEYS_PER_REPORT - 1] = 0;
+			break;
+		}
+	}
+}
 
-static struct kb_report report;
+void vinkey_submit_report(const struct vinkey_report *r, k_timeout_t timeout)
+{
+	vinkey_transport_submit(r, timeout);
+}
 
-static const uint8_t hid_report_desc[] = HID_KEYBOARD_REPORT_DESC();
+void kb_submit_report(const struct kb_report *r, k_timeout_t timeout)
+{
+	struct vinkey_report wrapped = {
+		.id = VINKEY_REPORT_ID_KEYBOARD,
+		.kb = *r,
+	};
 
-const struct device* hid_dev = DEVICE_DT_GET_ONE(zephyr_hid_device);
-const struct device* kscan_dev = DEVICE_DT_GET(DT_ALIAS(kscan));
+	vinkey_submit_report(&wrapped, timeout);
+}
 
-static void update_report(uint16_t code, int32_t value)
+/*
+ * Applies a matrix event and returns the report it changed, or NULL.
+ * Consumer and system usages are released by the same matrix position that
+ * pressed them, even if blue ALT was let go in between.
+ */
+static const struct vinkey_report *update_report(uint32_t code, int32_t value)
 {
+	if (value) {
+		if (IS_ENABLED(CONFIG_VINKEY_MACRO)) {
+			int slot = input_to_macro(code);
+
+			if (slot >= 0) {
+				vinkey_macro_play(slot);
+				return NULL;
+			}
+		}
+
+		if (input_is_transport_toggle(code)) {
+			vinkey_transport_toggle();
+			return NULL;
+		}
+
+		uint16_t usage = input_to_consumer(code);
+
+		if (usage != 0) {
+			consumer_key = code;
+			consumer_report.consumer.usage = usage;
+			return &consumer_report;
+		}
+
+		uint8_t control = input_to_system(code);
+
+		if (control != 0) {
+			system_key = code;
+			system_report.system.control = control;
+			return &system_report;
+		}
+	} else if (code == consumer_key) {
+		consumer_key = -1;
+		consumer_report.consumer.usage = 0;
+		return &consumer_report;
+	} else if (code == system_key) {
+		system_key = -1;
+		system_report.system.control = 0;
+		return &system_report;
+	}
+
 	uint8_t hid_code = input_to_hid(code, value);
 	if (hid_code == 0) {
-		return;
+		return NULL;
+	}
+	if (IS_ENABLED(CONFIG_VINKEY_BLE)) {
+		vinkey_ble_handle_key(hid_code, (bool)value);
 	}
-	vinkey_ble_handle_key(hid_code, (bool)value);
 	if (is_modifier(code)) {
 		if (value) {
-			report.modifier |= hid_code;
+			report.kb.modifier |= hid_code;
 		} else {
-			report.modifier &= ~hid_code;
+			report.kb.modifier &= ~hid_code;
 		}
 	} else {
 		if (value) {
-			/* Add to report */
-			for (int i = 0; i < KEYS_PER_REPORT; i++) {
-				if (report.keys[i] == 0) {
-					report.keys[i] = hid_code;
-					break;
-				}
-			}
+			kb_report_press(&report.kb, hid_code);
 		} else {
-			/* Remove from report */
-			for (int i = 0; i < KEYS_PER_REPORT; i++) {
-				if (report.keys[i] == hid_code) {
-					report.keys[i] = 0;
-					/* Shift remaining keys left */
-					for (int j = i; j < (KEYS_PER_REPORT-1); j++) {
-						report.keys[j] = report.keys[j+1];
-					}
-					report.keys[KEYS_PER_REPORT - 1] = 0;
-					break;
-				}
-			}
+			kb_report_release(&report.kb, hid_code);
 		}
 	}
+	return &report;
 }
-static uint32_t kb_duration;
 
-static int matrix_row = -1;
-static int matrix_col = -1;
+/* Called from the macro thread and on reroutes, not only under key handling */
+void kb_resend_report(void)
+{
+	k_mutex_lock(&report_lock, K_FOREVER);
+
+	struct vinkey_report snapshot = report;
+
+	k_mutex_unlock(&report_lock);
+	vinkey_submit_report(&snapshot, K_NO_WAIT);
+}
+
+void kb_resend_reports(void)
+{
+	k_mutex_lock(&report_lock, K_FOREVER);
+
+	struct vinkey_report snapshots[] = {report, consumer_report, system_report};
+
+	k_mutex_unlock(&report_lock);
+	BUILD_ASSERT(ARRAY_SIZE(snapshots) == VINKEY_STATE_REPORTS);
+	for (int i = 0; i < ARRAY_SIZE(snapshots); i++) {
+		vinkey_submit_report(&snapshots[i], K_NO_WAIT);
+	}
+}
+
+/* Position of the last event per bank, only touched by that bank's thread */
+static struct {
+	int row;
+	int col;
+} matrix_pos[VINKEY_BANK_COUNT] = {
+	[0 ... VINKEY_BANK_COUNT - 1] = {.row = -1, .col = -1},
+};
+
+/* One matrix transition, as taken from the scan thread */
+struct key_event {
+	vinkey_stamp_t stamp;
+	uint8_t bank;
+	int8_t row;
+	int8_t col;
+	uint8_t pressed;
+};
+
+/*
+ * Chatter is a press that follows the key's own release closer than
+ * CONFIG_VINKEY_DIAG_CHATTER_MS. Returns the release to press gap in us for
+ * one, -1 for anything else; shared by the diagnostics and key statistics.
+ */
+static int32_t chatter_gap_us(int bit, bool pressed)
+{
+	uint32_t now = k_uptime_ticks();
+
+	if (!pressed) {
+		released_at[bit] = now;
+		return -1;
+	}
+	if (released_at[bit] == 0) {
+		return -1;
+	}
+
+	uint32_t gap_us = k_ticks_to_us_floor32(now - released_at[bit]);
+
+	return gap_us < CONFIG_VINKEY_DIAG_CHATTER_MS * USEC_PER_MSEC ? gap_us : -1;
+}
+
+static void handle_key(const struct key_event *ev)
+{
+	vinkey_power_key_activity();
+	if (IS_ENABLED(CONFIG_VINKEY_SUPERVISOR)) {
+		vinkey_supervisor_key_event(ev->bank);
+	}
+	if (ev->row < 0 || ev->col < 0) {
+		return;
+	}
+
+	uint32_t code = VINKEY_KEY(ev->bank, ev->row, ev->col);
+	int bit = vinkey_key_index(code);
+	int32_t value = ev->pressed;
+
+	if (bit < 0) {
+		return;
+	}
+	if (IS_ENABLED(CONFIG_VINKEY_DIAG) || IS_ENABLED(CONFIG_VINKEY_KEY_STATS)) {
+		int32_t gap_us = chatter_gap_us(bit, value);
+
+		if (IS_ENABLED(CONFIG_VINKEY_DIAG)) {
+			vinkey_diag_key(bit, value, gap_us);
+		}
+		if (IS_ENABLED(CONFIG_VINKEY_KEY_STATS)) {
+			vinkey_key_stats_event(bit, value, gap_us);
+		}
+	}
+	if (atomic_get(&input_held)) {
+		return;
+	}
+
+	/* Keys released by a recovery are pressed again, not released twice */
+	if (!value && !atomic_test_bit(pressed_keys, bit)) {
+		return;
+	}
+	atomic_set_bit_to(pressed_keys, bit, value);
+
+	const struct vinkey_report *changed = update_report(code, value);
+
+	/* Macro playback owns the keyboard report, live state follows it */
+	if (changed == &report &&
+	    IS_ENABLED(CONFIG_VINKEY_MACRO) && vinkey_macro_active()) {
+		return;
+	}
+	if (changed != NULL) {
+		vinkey_submit_report(changed, K_NO_WAIT);
+	}
+}
+
+/* Called with report_lock held, a key still down must be pressed again */
+static void release_all_keys(void)
+{
+	for (int bit = 0; bit < VINKEY_MATRIX_KEYS; bit++) {
+		if (atomic_test_and_clear_bit(pressed_keys, bit)) {
+			update_report(vinkey_key_code(bit), 0);
+		}
+	}
+	vinkey_submit_report(&report, K_NO_WAIT);
+	vinkey_submit_report(&consumer_report, K_NO_WAIT);
+	vinkey_submit_report(&system_report, K_NO_WAIT);
+}
+
+/* Time the scan threads spend in input_cb(), the delay added to their next scan */
+static struct {
+	uint32_t events;
+	uint32_t ns_max;
+	uint64_t ns_total;
+#ifdef CONFIG_VINKEY_INPUT_ASYNC
+	/* Events dropped because the queue was full, and the count last logged */
+	atomic_t overflows;
+	uint32_t overflows_logged;
+	uint32_t queue_peak;
+	uint32_t batches;
+	uint32_t batch_max;
+	uint32_t wait_max_us;
+	uint64_t wait_total_us;
+#endif
+} input_stats;
+
+#ifdef CONFIG_VINKEY_SCAN_JITTER
+/*
+ * Scan to scan period per bank, stamped when a scan drives its first column.
+ * The kscan thread only scans back to back while keys are down and waits for
+ * a row interrupt otherwise, so a gap over twice the poll period starts a new
+ * run instead of counting as a period.
+ */
+struct scan_period {
+	vinkey_stamp_t last;
+	bool running;
+	uint32_t periods;
+	uint32_t restarts;
+	uint32_t min_ns;
+	uint32_t max_ns;
+	uint64_t total_ns;
+};
+
+static struct scan_period scan_periods[VINKEY_BANK_COUNT];
+
+void input_kbd_matrix_drive_column_hook(const struct device *dev, int col)
+{
+	int bank = vinkey_bank_of(dev);
+
+	if (col != 0 || bank < 0) {
+		return;
+	}
+
+	struct scan_period *p = &scan_periods[bank];
+	uint32_t ns = p->running ? vinkey_stamp_ns(p->last) : UINT32_MAX;
+
+	p->last = vinkey_stamp();
+	p->running = true;
+	if (ns / NSEC_PER_USEC > 2 * vinkey_banks[bank].poll_us) {
+		p->restarts++;
+		return;
+	}
+	p->min_ns = p->periods ? MIN(p->min_ns, ns) : ns;
+	p->max_ns = MAX(p->max_ns, ns);
+	p->total_ns += ns;
+	p->periods++;
+}
+#endif
+
+#ifdef CONFIG_VINKEY_INPUT_ASYNC
+/*
+ * Key events wait in key_msgq for the key thread, the scan threads never
+ * block on report building, logging or the transport queues, not even when
+ * the queue is full: the event is dropped and counted then. The key thread
+ * cannot tell which events it missed, so it releases every key after a drop
+ * rather than leave one stuck down.
+ */
+K_MSGQ_DEFINE(key_msgq, sizeof(struct key_event), CONFIG_VINKEY_INPUT_QUEUE_DEPTH,
+	      __alignof__(struct key_event));
+static K_SEM_DEFINE(key_events_pending, 0, 1);
+
+/* Called with report_lock held */
+static uint32_t drain_key_events(void)
+{
+	struct key_event ev;
+	uint32_t count = 0;
+
+	while (k_msgq_get(&key_msgq, &ev, K_NO_WAIT) == 0) {
+		uint32_t us = vinkey_stamp_us(ev.stamp);
+
+		input_stats.wait_total_us += us;
+		input_stats.wait_max_us = MAX(input_stats.wait_max_us, us);
+		handle_key(&ev);
+		count++;
+	}
+	return count;
+}
+
+static _Noreturn void key_task(void *p1, void *p2, void *p3)
+{
+	while (true) {
+		k_sem_take(&key_events_pending, K_FOREVER);
+
+		k_mutex_lock(&report_lock, K_FOREVER);
+
+		uint32_t count = drain_key_events();
+
+		if (count > 0) {
+			input_stats.batches++;
+			input_stats.batch_max = MAX(input_stats.batch_max, count);
+		}
+
+		/* Counted by the scan thread, handled and logged here */
+		uint32_t overflows = atomic_get(&input_stats.overflows);
+		bool dropped = overflows != input_stats.overflows_logged;
+
+		if (dropped) {
+			release_all_keys();
+		}
+		k_mutex_unlock(&report_lock);
+
+		if (dropped) {
+			LOG_WRN("%u key events dropped, the key queue was full, all keys released",
+				overflows - input_stats.overflows_logged);
+			input_stats.overflows_logged = overflows;
+		}
+	}
+}
+
+/* Above the transports, so a batch is turned into reports before they send */
+K_THREAD_DEFINE(key_task_tid, 1024, key_task, NULL, NULL, NULL, 6, 0, 0);
+
+static void queue_key(const struct key_event *ev)
+{
+	if (k_msgq_put(&key_msgq, ev, K_NO_WAIT) == 0) {
+		input_stats.queue_peak = MAX(input_stats.queue_peak,
+					     k_msgq_num_used_get(&key_msgq));
+		k_sem_give(&key_events_pending);
+		return;
+	}
+
+	/* Full: the key thread is starved, the scan goes on without this event */
+	atomic_inc(&input_stats.overflows);
+	k_sem_give(&key_events_pending);
+}
+#endif
 
 static void input_cb(struct input_event *evt, void *user_data)
 {
 	ARG_UNUSED(user_data);
 
+	int bank = vinkey_bank_of(evt->dev);
+
+	if (bank < 0) {
+		return;
+	}
 	if (evt->code == INPUT_ABS_X) {
-		matrix_col = evt->value;
+		matrix_pos[bank].col = evt->value;
 	} else if (evt->code == INPUT_ABS_Y) {
-		matrix_row = evt->value;
+		matrix_pos[bank].row = evt->value;
 	} else if (evt->code == INPUT_BTN_TOUCH) {
-		if (matrix_row >= 0 && matrix_col >= 0) {
-			uint16_t code = (matrix_row << 8) | matrix_col;
-
-			update_report(code, evt->value);
-
-			k_msgq_put(&usb_msgq, &report, K_NO_WAIT);
-			k_msgq_put(&ble_msgq, &report, K_NO_WAIT);
+		vinkey_stamp_t start = vinkey_stamp();
+		struct key_event ev = {
+			.stamp = start,
+			.bank = bank,
+			.row = matrix_pos[bank].row,
+			.col = matrix_pos[bank].col,
+			.pressed = evt->value != 0,
+		};
+
+#ifdef CONFIG_VINKEY_INPUT_ASYNC
+		queue_key(&ev);
+#else
+		k_mutex_lock(&report_lock, K_FOREVER);
+		handle_key(&ev);
+		k_mutex_unlock(&report_lock);
+#endif
+
+		/* Everything the scan thread does for a key, logging included */
+		uint32_t ns = vinkey_stamp_ns(start);
+
+		/* Banks only race each other on these, it is a statistic */
+		input_stats.events++;
+		input_stats.ns_total += ns;
+		input_stats.ns_max = MAX(input_stats.ns_max, ns);
+		if (IS_ENABLED(CONFIG_VINKEY_DIAG)) {
+			vinkey_diag_key_time(ns);
 		}
 	}
 }
 
 INPUT_CALLBACK_DEFINE(NULL, input_cb, NULL);
 
+#ifdef CONFIG_SHELL
+static int cmd_input(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t events = MAX(input_stats.events, 1);
+
+	shell_print(sh, "%s, %u key events, scan thread %u ns per event (max %u ns)",
+		    IS_ENABLED(CONFIG_VINKEY_INPUT_ASYNC) ? "asynchronous" : "synchronous",
+		    input_stats.events, (uint32_t)(input_stats.ns_total / events),
+		    input_stats.ns_max);
+#ifdef CONFIG_VINKEY_INPUT_ASYNC
+	shell_print(sh, "queue %u/%u (peak %u), %u events dropped on a full queue",
+		    k_msgq_num_used_get(&key_msgq), CONFIG_VINKEY_INPUT_QUEUE_DEPTH,
+		    input_stats.queue_peak, (uint32_t)atomic_get(&input_stats.overflows));
+	shell_print(sh, "%u batches of %u events on average (max %u), "
+		    "queued %u us on average (max %u us)",
+		    input_stats.batches,
+		    input_stats.batches ? input_stats.events / input_stats.batches : 0,
+		    input_stats.batch_max, (uint32_t)(input_stats.wait_total_us / events),
+		    input_stats.wait_max_us);
+#endif
+#ifdef CONFIG_VINKEY_SCAN_JITTER
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		struct scan_period *p = &scan_periods[bank];
+		uint32_t periods = MAX(p->periods, 1);
+
+		shell_print(sh, "bank %d: %u scan periods of %u us, %u..%u ns, %u ns on average "
+			    "(jitter %u ns), %u restarts", bank, p->periods,
+			    vinkey_banks[bank].poll_us, p->min_ns, p->max_ns,
+			    (uint32_t)(p->total_ns / periods), p->max_ns - p->min_ns, p->restarts);
+	}
+#endif
+	return 0;
+}
+
+SHELL_CMD_REGISTER(input, NULL, "Key event handling and queue statistics", cmd_input);
+#endif
+
+void kb_input_hold(bool hold)
+{
+	atomic_set(&input_held, hold);
+	if (!hold) {
+		return;
+	}
+
+	k_mutex_lock(&report_lock, K_FOREVER);
+	release_all_keys();
+	k_mutex_unlock(&report_lock);
+}
+
+#ifdef CONFIG_VINKEY_USB
+static bool usb_boot_protocol;
+static uint8_t usb_leds;
+static uint32_t kb_duration;
+
+static const uint8_t hid_report_desc[] = VINKEY_HID_USB_REPORT_MAP();
+
+const struct device* hid_dev = DEVICE_DT_GET(DT_NODELABEL(hid_dev_0));
+
 static void kb_iface_ready(const struct device *dev, const bool ready)
 {
 	LOG_INF("HID device %s interface is %s",
 		dev->name, ready ? "ready" : "not ready");
 	usb_kb_ready = ready;
-	update_connect_status();
+	vinkey_transport_state_changed();
 }
 
 static int kb_get_report(const struct device *dev,
 			 const uint8_t type, const uint8_t id, const uint16_t len,
 			 uint8_t *const buf)
 {
+	if (IS_ENABLED(CONFIG_VINKEY_BATTERY) && type == HID_REPORT_TYPE_INPUT &&
+	    id == VINKEY_REPORT_ID_BATTERY && len >= 2) {
+		/* Hosts poll the battery level instead of waiting for a change */
+		int level = vinkey_battery_level();
+
+		if (level < 0) {
+			/* Not sampled yet, a stall tells the host it is unknown */
+			return level;
+		}
+		buf[0] = id;
+		buf[1] = level;
+		return 2;
+	}
+
 	LOG_WRN("Get Report not implemented, Type %u ID %u", type, id);
 
 	return 0;
@@ -119,12 +543,26 @@ int kb_set_report(const struct device *dev,
 			 const uint8_t type, const uint8_t id, const uint16_t len,
 			 const uint8_t *const buf)
 {
+	const uint8_t *leds = buf;
+	uint16_t leds_len = len;
+
 	if (type != HID_REPORT_TYPE_OUTPUT) {
 		LOG_WRN("Unsupported report type");
 		return -ENOTSUP;
 	}
 
-	gpio_pin_set_dt(&caps_lock_led, buf[0] & (int)BIT(1));
+	/* Report protocol output reports carry the report ID in front */
+	if (id != 0U && leds_len > 1 && leds[0] == id) {
+		leds++;
+		leds_len--;
+	}
+	if ((id != 0U && id != VINKEY_REPORT_ID_KEYBOARD) || leds_len == 0) {
+		LOG_WRN("Unsupported output report ID %u", id);
+		return -ENOTSUP;
+	}
+
+	usb_leds = leds[0];
+	vinkey_transport_leds_changed(vinkey_transport_find("usb"));
 	return 0;
 }
 
@@ -132,13 +570,13 @@ int kb_set_report(const struct device *dev,
 static void kb_set_idle(const struct device *dev,
 			const uint8_t id, const uint32_t duration)
 {
-	LOG_INF("Set Idle %u to %u", id, duration);
+	LOG_DBG("Set Idle %u to %u", id, duration);
 	kb_duration = duration;
 }
 
 static uint32_t kb_get_idle(const struct device *dev, const uint8_t id)
 {
-	LOG_INF("Get Idle %u to %u", id, kb_duration);
+	LOG_DBG("Get Idle %u to %u", id, kb_duration);
 	return kb_duration;
 }
 
@@ -146,13 +584,15 @@ static void kb_set_protocol(const struct device *dev, const uint8_t proto)
 {
 	LOG_INF("Protocol changed to %s",
 		proto == 0U ? "Boot Protocol" : "Report Protocol");
+	usb_boot_protocol = proto == 0U;
 }
 
 void kb_output_report(const struct device *dev, const uint16_t len,
 			     const uint8_t *const buf)
 {
 	LOG_HEXDUMP_DBG(buf, len, "o.r.");
-	kb_set_report(dev, HID_REPORT_TYPE_OUTPUT, 0U, len, buf);
+	kb_set_report(dev, HID_REPORT_TYPE_OUTPUT,
+		      (usb_boot_protocol || len == 0U) ? 0U : buf[0], len, buf);
 }
 
 struct hid_device_ops kb_ops = {
@@ -165,46 +605,32 @@ struct hid_device_ops kb_ops = {
 	.output_report = kb_output_report,
 };
 
-typedef int (*send_report_fn)(const uint8_t *report);
-
-static _Noreturn void kb_usb_send_task(void *p1, void *p2, void *p3)
+int vinkey_usb_send_report(const struct vinkey_report *r)
 {
-	static struct kb_report queued_report;
-
-	while (true) {
-		k_msgq_get(&usb_msgq, &queued_report, K_FOREVER);
-		if (usb_kb_ready) {
-			hid_device_submit_report(hid_dev, sizeof(struct kb_report), (uint8_t *)&queued_report);
-		}
+	if (!usb_boot_protocol) {
+		return hid_device_submit_report(hid_dev, 1 + vinkey_report_len(r->id),
+						(const uint8_t *)r);
+	}
+	if (r->id == VINKEY_REPORT_ID_KEYBOARD) {
+		/* Boot protocol hosts only understand the bare keyboard report */
+		return hid_device_submit_report(hid_dev, sizeof(struct kb_report),
+						(const uint8_t *)&r->kb);
 	}
+	return 0;
 }
 
-static _Noreturn void kb_ble_send_task(void *p1, void *p2, void *p3)
+uint8_t vinkey_usb_leds(void)
 {
-	static struct kb_report queued_report;
-
-	while (true) {
-		k_msgq_get(&ble_msgq, &queued_report, K_FOREVER);
-		vinkey_ble_send_report((uint8_t *)&queued_report, sizeof(struct kb_report));
-	}
+	return usb_leds;
 }
 
-K_THREAD_DEFINE(usb_task_tid, 1024, kb_usb_send_task, NULL, NULL, NULL, 7, 0, 0);
-K_THREAD_DEFINE(ble_task_tid, 1024, kb_ble_send_task, NULL, NULL, NULL, 7, 0, 0);
-
-int main(void)
+static void kb_usb_init(void)
 {
-	init_hardware();
 	if (!device_is_ready(hid_dev)) {
 		LOG_ERR("HID Device is not ready");
 		failure();
 	}
 
-	if (!device_is_ready(kscan_dev)) {
-		LOG_ERR("Kscan Device is not ready");
-		key_scan_failure();
-	}
-
 	int ret = hid_device_register(hid_dev,
 	                              hid_report_desc, sizeof(hid_report_desc),
 	                              &kb_ops);
@@ -225,8 +651,38 @@ int main(void)
 		}
 	}
 
-	vinkey_ble_init();
+	/* Second HID interface, registered before the USB classes are set up */
+	if (IS_ENABLED(CONFIG_VINKEY_DIAG)) {
+		vinkey_diag_init();
+	}
 	vinkey_usb_init();
+}
+#endif /* CONFIG_VINKEY_USB */
+
+int main(void)
+{
+	vinkey_boot_mark(VINKEY_BOOT_MAIN);
+	init_hardware();
+
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		if (!device_is_ready(vinkey_banks[bank].dev) &&
+		    !IS_ENABLED(CONFIG_VINKEY_SUPERVISOR)) {
+			LOG_ERR("Kscan Device %d is not ready", bank);
+			key_scan_failure();
+		}
+	}
+
+#ifdef CONFIG_VINKEY_USB
+	/* USB enumerates while the BLE stack and settings come up in the background */
+	kb_usb_init();
+#endif
+	if (IS_ENABLED(CONFIG_VINKEY_BLE)) {
+		vinkey_ble_init();
+	} else if (IS_ENABLED(CONFIG_SETTINGS)) {
+		/* Loaded by the BLE start up otherwise */
+		settings_load();
+		vinkey_boot_mark(VINKEY_BOOT_SETTINGS_LOADED);
+	}
 	LOG_INF("HID keyboard is initialized");
 
 	return 0;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/input/input.h>
@@ -8,11 +9,101 @@
 #include <zephyr/usb/class/usbd_hid.h>
 
 #include <zephyr/logging/log.h>
+#include <zephyr/timing/timing.h>
 
-extern const struct gpio_dt_spec caps_lock_led;
-extern const struct gpio_dt_spec pwr_on_led;
-extern const struct gpio_dt_spec ble_connected_led;
-extern const struct gpio_dt_spec usb_connected_led;
+#include "vinkey_hid.h"
+#include "vinkey_matrix.h"
+#include "vinkey_transport.h"
+
+/*
+ * Stamps for short durations: key handling, ISRs, I2C transactions. The
+ * timing API counts a TIMER or the DWT cycle counter depending on the SoC,
+ * k_cycle_get_32() is the 32768 Hz RTC on nRF, 30.5 us per tick. Without
+ * timing functions (native_sim) the system clock is fine grained anyway.
+ */
+#ifdef CONFIG_TIMING_FUNCTIONS
+typedef timing_t vinkey_stamp_t;
+
+static inline vinkey_stamp_t vinkey_stamp(void)
+{
+	return timing_counter_get();
+}
+
+static inline uint32_t vinkey_stamp_ns(vinkey_stamp_t start)
+{
+	vinkey_stamp_t now = timing_counter_get();
+
+	return (uint32_t)MIN(timing_cycles_to_ns(timing_cycles_get(&start, &now)), UINT32_MAX);
+}
+#else
+typedef uint64_t vinkey_stamp_t;
+
+static inline vinkey_stamp_t vinkey_stamp(void)
+{
+	return k_cycle_get_64();
+}
+
+static inline uint32_t vinkey_stamp_ns(vinkey_stamp_t start)
+{
+	return (uint32_t)MIN(k_cyc_to_ns_floor64(k_cycle_get_64() - start), UINT32_MAX);
+}
+#endif
+
+static inline uint32_t vinkey_stamp_us(vinkey_stamp_t start)
+{
+	return vinkey_stamp_ns(start) / NSEC_PER_USEC;
+}
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+/* Runtime statistics cycles, whichever clock the kernel keeps them with */
+static inline uint64_t vinkey_runtime_cycles_to_ns(uint64_t cycles)
+{
+#ifdef CONFIG_THREAD_RUNTIME_STATS_USE_TIMING_FUNCTIONS
+	return timing_cycles_to_ns(cycles);
+#else
+	return k_cyc_to_ns_floor64(cycles);
+#endif
+}
+
+/* CPU time a thread has run */
+static inline uint64_t vinkey_thread_cpu_ns(k_tid_t tid)
+{
+	k_thread_runtime_stats_t rt;
+
+	if (tid == NULL || k_thread_runtime_stats_get(tid, &rt) != 0) {
+		return 0;
+	}
+	return vinkey_runtime_cycles_to_ns(rt.execution_cycles);
+}
+#endif
+
+enum vinkey_led {
+	VINKEY_LED_PWR,
+	VINKEY_LED_USB,
+	VINKEY_LED_BLE,
+	VINKEY_LED_CAPS,
+	VINKEY_LED_COUNT,
+};
+
+/* In increasing priority, a higher indicator overrides a lower one per LED */
+enum vinkey_indicator {
+	VINKEY_IND_POWER,
+	VINKEY_IND_USB,
+	VINKEY_IND_BLE,
+	VINKEY_IND_CAPS_LOCK,
+	VINKEY_IND_PAIRING,
+	VINKEY_IND_LOW_BATTERY,
+	VINKEY_IND_SUSPENDED,
+	VINKEY_IND_SCAN_FAULT,
+	VINKEY_IND_FAULT,
+	VINKEY_IND_COUNT,
+};
+
+void vinkey_led_indicate(enum vinkey_indicator indicator, bool on);
+void vinkey_led_set_brightness(uint8_t percent);
+uint8_t vinkey_led_get_brightness(void);
+/* Drives an LED directly, bypassing the engine, for the halt path only */
+void vinkey_led_halt_set(enum vinkey_led led, bool on);
 
 _Noreturn void failure();
 _Noreturn void key_scan_failure();
@@ -20,8 +111,12 @@ void init_hardware();
 
 typedef void (*vinkey_ble_output_report_cb_t)(const uint8_t *report, uint16_t len);
 void vinkey_ble_init();
-void vinkey_ble_send_report(const uint8_t *report, uint16_t len);
+int vinkey_ble_send_report(const struct vinkey_report *report);
+uint8_t vinkey_ble_leds(void);
+bool vinkey_ble_suspended(void);
+bool vinkey_ble_ready(void);
 void vinkey_ble_handle_key(uint8_t hid_code, bool pressed);
+void vinkey_synth_passkey(void);
 
 extern volatile bool ble_kb_ready;
 extern volatile bool usb_kb_ready;
@@ -32,7 +127,135 @@ int kb_set_report(const struct device *dev,
              uint8_t type, uint8_t id, uint16_t len,
              const uint8_t * buf);
 
-uint8_t input_to_hid(uint16_t code, int32_t value);
-bool is_modifier(uint16_t code);
+void kb_report_press(struct kb_report *r, uint8_t hid_code);
+void kb_report_release(struct kb_report *r, uint8_t hid_code);
+void kb_submit_report(const struct kb_report *r, k_timeout_t timeout);
+void vinkey_submit_report(const struct vinkey_report *r, k_timeout_t timeout);
+void kb_resend_report(void);
+/* Keyboard, consumer and system reports as they are held right now */
+void kb_resend_reports(void);
+/* Reports kb_resend_reports() queues */
+#define VINKEY_STATE_REPORTS (3)
+void kb_input_hold(bool hold);
+
+uint8_t input_to_hid(uint32_t code, int32_t value);
+bool is_modifier(uint32_t code);
+uint16_t input_to_consumer(uint32_t code);
+uint8_t input_to_system(uint32_t code);
+bool input_is_transport_toggle(uint32_t code);
+int input_to_macro(uint32_t code);
+
+void vinkey_macro_play(int slot);
+bool vinkey_macro_active(void);
+int vinkey_macro_save(int slot, const uint8_t *data, size_t len);
+
+enum vinkey_boot_milestone {
+	VINKEY_BOOT_MAIN,
+	VINKEY_BOOT_USB_ENABLED,
+	VINKEY_BOOT_USB_CONFIGURED,
+	VINKEY_BOOT_BT_READY,
+	VINKEY_BOOT_SETTINGS_LOADED,
+	VINKEY_BOOT_ADVERTISING,
+	VINKEY_BOOT_FIRST_REPORT,
+	VINKEY_BOOT_COUNT,
+};
+
+void vinkey_boot_mark(enum vinkey_boot_milestone milestone);
+uint32_t vinkey_boot_time_us(enum vinkey_boot_milestone milestone);
+
+#define VINKEY_I2C_BUCKETS      (8)
+#define VINKEY_I2C_BUCKET_SHIFT (5)
+
+struct vinkey_i2c_stats {
+	uint32_t transfers;
+	uint32_t bytes;
+	/* Any error, the TWIM driver does not tell a NACK from a bus error */
+	uint32_t failures;
+	uint32_t recoveries;
+	uint32_t max_us;
+	/* Over the last second, in 0.1 % */
+	uint16_t busy_permille;
+	uint16_t wire_permille;
+	/* Bucket n counts transactions below 1 << (shift + n) us, the last one the rest */
+	uint16_t buckets[VINKEY_I2C_BUCKETS];
+};
+
+void vinkey_i2c_stats_get(struct vinkey_i2c_stats *stats);
+
+struct vinkey_key_stats {
+	uint32_t presses;
+	uint32_t chatter;
+	/* Sum of the release to press gaps of the chatter, divide by chatter for the average */
+	uint32_t gap_us;
+};
+
+/* gap_us is the chatter gap of a press, negative when it was none */
+void vinkey_key_stats_event(int key, bool pressed, int32_t gap_us);
+void vinkey_key_stats_get(int key, struct vinkey_key_stats *out);
+
+void vinkey_diag_init(void);
+void vinkey_diag_key(int key, bool pressed, int32_t gap_us);
+void vinkey_diag_latency(uint32_t us);
+void vinkey_diag_key_time(uint32_t ns);
+
+bool vinkey_scan_dma_active(void);
+void vinkey_scan_dma_pause(bool pause);
+
+void vinkey_supervisor_key_event(int bank);
+void vinkey_supervisor_fatal(void);
+
+enum vinkey_bus_fault {
+	VINKEY_BUS_NAK,
+	VINKEY_BUS_GARBAGE,
+	/* The count is how long the next transfer hangs, in ms */
+	VINKEY_BUS_STALL,
+};
+
+struct emul;
+void vinkey_sx1509b_emul_inject(const struct emul *target, enum vinkey_bus_fault fault, int count);
+
+void vinkey_power_update(void);
+void vinkey_power_key_activity(void);
+bool vinkey_power_low_duty(void);
+void vinkey_power_set_battery_low(bool low);
+
+enum vinkey_energy_part {
+	VINKEY_ENERGY_SCAN,
+	VINKEY_ENERGY_CPU,
+	VINKEY_ENERGY_RADIO,
+	/* One per indicator LED, in enum vinkey_led order */
+	VINKEY_ENERGY_LED,
+	VINKEY_ENERGY_PARTS = VINKEY_ENERGY_LED + VINKEY_LED_COUNT,
+};
+
+struct vinkey_energy {
+	/* Estimated since boot, nC (uA * ms) */
+	uint64_t charge_nc;
+	/* Present draw, for the CPU the average since boot */
+	uint32_t ua;
+};
+
+void vinkey_energy_scan(bool suspended);
+void vinkey_energy_led(enum vinkey_led led, uint8_t level);
+/* Connection and advertising events per 1000 s */
+void vinkey_energy_radio_events(uint32_t conn_mhz, uint32_t adv_mhz);
+/* TX and RX time of a report on top of the connection events */
+void vinkey_energy_radio_airtime(uint32_t us);
+/* Every host suspended or one of them back, records the average draw in between */
+void vinkey_energy_suspend(bool suspended);
+void vinkey_energy_get(enum vinkey_energy_part part, struct vinkey_energy *out);
+
+/* Reference counted, the application core runs at 128 MHz while any is held */
+void vinkey_clock_boost(bool boost);
+void vinkey_clock_latency(uint32_t us);
+
+/* Filtered battery level in percent, -ENODATA before the first sample */
+int vinkey_battery_level(void);
+/* A host came back, it gets the level again */
+void vinkey_battery_resend(void);
 
 void vinkey_usb_init();
+int vinkey_usb_send_report(const struct vinkey_report *r);
+uint8_t vinkey_usb_leds(void);
+bool vinkey_usb_suspended(void);
+int vinkey_usb_wakeup(void);
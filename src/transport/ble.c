@@ -0,0 +1,10 @@
+#include "main.h"
+
+static const struct vinkey_transport_api ble_transport_api = {
+	.ready = vinkey_ble_ready,
+	.send = vinkey_ble_send_report,
+	.leds = vinkey_ble_leds,
+	.suspended = vinkey_ble_suspended,
+};
+
+VINKEY_TRANSPORT_DEFINE(ble_transport, "ble", &ble_transport_api, 7);
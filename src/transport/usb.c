@@ -0,0 +1,33 @@
+#include "main.h"
+
+static bool usb_transport_ready(void)
+{
+	return usb_kb_ready;
+}
+
+static int usb_transport_send(const struct vinkey_report *report)
+{
+	if (vinkey_usb_suspended()) {
+		/* Only a press is worth waking the host, releases are dropped */
+		if (vinkey_report_is_empty(report)) {
+			return -EAGAIN;
+		}
+
+		int err = vinkey_usb_wakeup();
+
+		if (err) {
+			return err;
+		}
+	}
+	return vinkey_usb_send_report(report);
+}
+
+static const struct vinkey_transport_api usb_transport_api = {
+	.ready = usb_transport_ready,
+	.send = usb_transport_send,
+	.leds = vinkey_usb_leds,
+	.suspended = vinkey_usb_suspended,
+};
+
+/* hid_device_submit_report() blocks until the host polls, one report per frame */
+VINKEY_TRANSPORT_DEFINE(usb_transport, "usb", &usb_transport_api, 7);
@@ -0,0 +1,241 @@
+/*
+ * Battery monitor. The supply is sampled through the ADC channel of the
+ * zephyr,user node once a period, four times less often in the low duty scan
+ * tier, and smoothed so that the level only moves on a real change. A new
+ * level is notified over BAS and sent to a USB host as a Battery Strength
+ * report; nothing is sent while it stays the same.
+ *
+ * The first sample is taken at init, so a host asking for the level gets a
+ * real one; the USB report is only taken as sent once it was queued, and
+ * sent again whenever the host resumes.
+ *
+ * Below CONFIG_VINKEY_BATTERY_LOW_PERCENT the power LED shows the low battery
+ * pattern and the power tiers scan in windows whenever the keyboard is idle.
+ * "battery" in the shell shows what sampling costs: the conversion time, most
+ * of which the thread sleeps through, and with CONFIG_THREAD_RUNTIME_STATS
+ * the CPU time of the sampling thread. The SAADC interrupt is not in there.
+ */
+
+#include <zephyr/bluetooth/services/bas.h>
+#include <zephyr/drivers/adc.h>
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_battery, CONFIG_VINKEY_LOG_LEVEL);
+
+/* The low state is left this many percent above the threshold */
+#define LOW_HYSTERESIS (5)
+/* Nothing queued to the USB host yet */
+#define LEVEL_NONE     (0xFF)
+
+static const struct adc_dt_spec adc = ADC_DT_SPEC_GET(DT_PATH(zephyr_user));
+
+static int16_t raw;
+static struct adc_sequence sequence = {
+	.buffer = &raw,
+	.buffer_size = sizeof(raw),
+	/* Offset calibration with the first sample only */
+	.calibrate = true,
+};
+
+static bool sampled;
+static int32_t filtered_mv;
+static uint8_t level;
+static uint8_t usb_level = LEVEL_NONE;
+static bool low;
+
+static struct {
+	uint32_t samples;
+	uint32_t errors;
+	/* Conversion, from the request to the result */
+	uint64_t total_us;
+	uint32_t max_us;
+	uint64_t cpu_ns;
+} stats;
+
+static void sample_handler(struct k_work *work);
+static void resend_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(sample_work, sample_handler);
+static K_WORK_DEFINE(resend_work, resend_handler);
+
+static uint8_t mv_to_percent(int32_t mv)
+{
+	if (mv >= CONFIG_VINKEY_BATTERY_FULL_MV) {
+		return 100;
+	}
+	if (mv <= CONFIG_VINKEY_BATTERY_EMPTY_MV) {
+		return 0;
+	}
+	return (mv - CONFIG_VINKEY_BATTERY_EMPTY_MV) * 100 /
+	       (CONFIG_VINKEY_BATTERY_FULL_MV - CONFIG_VINKEY_BATTERY_EMPTY_MV);
+}
+
+static void report_usb(void)
+{
+	const struct vinkey_transport *usb = vinkey_transport_find("usb");
+
+	if (usb == NULL) {
+		return;
+	}
+	if (!usb->api->ready()) {
+		/* Sent again once a host is back */
+		usb_level = LEVEL_NONE;
+		return;
+	}
+	if (usb_level != level) {
+		struct vinkey_report report = {
+			.id = VINKEY_REPORT_ID_BATTERY,
+			.battery.level = level,
+		};
+
+		/* Tried again with the next sample otherwise */
+		if (vinkey_transport_submit_to(usb, &report, K_NO_WAIT) == 0) {
+			usb_level = level;
+		}
+	}
+}
+
+/* On the system workqueue like the sampling, usb_level has one writer */
+static void resend_handler(struct k_work *work)
+{
+	if (sampled) {
+		usb_level = LEVEL_NONE;
+		report_usb();
+	}
+}
+
+void vinkey_battery_resend(void)
+{
+	k_work_submit(&resend_work);
+}
+
+static void update_level(uint8_t percent, bool first)
+{
+	if (percent != level || first) {
+		level = percent;
+		LOG_DBG("Battery %u%% (%d mV)", level, filtered_mv);
+		if (IS_ENABLED(CONFIG_BT_BAS)) {
+			bt_bas_set_battery_level(level);
+		}
+	}
+	report_usb();
+
+	bool now_low = level < CONFIG_VINKEY_BATTERY_LOW_PERCENT +
+			       (low ? LOW_HYSTERESIS : 0);
+
+	if (now_low != low) {
+		low = now_low;
+		LOG_WRN("Battery %s (%u%%)", low ? "low" : "recovered", level);
+		vinkey_led_indicate(VINKEY_IND_LOW_BATTERY, low);
+		vinkey_power_set_battery_low(low);
+	}
+}
+
+static int sample(void)
+{
+	vinkey_stamp_t start = vinkey_stamp();
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+	uint64_t cpu_ns = vinkey_thread_cpu_ns(k_current_get());
+#endif
+	int err = adc_read_dt(&adc, &sequence);
+	uint32_t us = vinkey_stamp_us(start);
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+	stats.cpu_ns += vinkey_thread_cpu_ns(k_current_get()) - cpu_ns;
+#endif
+	stats.samples++;
+	stats.total_us += us;
+	stats.max_us = MAX(stats.max_us, us);
+
+	if (err) {
+		stats.errors++;
+		LOG_WRN("Battery sample failed (err %d)", err);
+		return err;
+	}
+
+	int32_t mv = raw;
+
+	sequence.calibrate = false;
+	adc_raw_to_millivolts_dt(&adc, &mv);
+	mv *= CONFIG_VINKEY_BATTERY_SCALE;
+	/* Exponential average over about four samples */
+	filtered_mv = sampled ? filtered_mv + (mv - filtered_mv) / 4 : mv;
+	return 0;
+}
+
+static void sample_handler(struct k_work *work)
+{
+	/* BAS, the USB host and the indicators only hear of it from here */
+	static bool published;
+
+	if (sample() == 0) {
+		sampled = true;
+		update_level(mv_to_percent(filtered_mv), !published);
+		published = true;
+	}
+
+	k_work_reschedule(&sample_work,
+			  K_SECONDS(CONFIG_VINKEY_BATTERY_PERIOD_S *
+				    (vinkey_power_low_duty() ? 4 : 1)));
+}
+
+int vinkey_battery_level(void)
+{
+	return sampled ? level : -ENODATA;
+}
+
+static int battery_init(void)
+{
+	int err;
+
+	if (!adc_is_ready_dt(&adc)) {
+		LOG_ERR("Battery ADC is not ready");
+		return -ENODEV;
+	}
+	err = adc_channel_setup_dt(&adc);
+	if (err == 0) {
+		err = adc_sequence_init_dt(&adc, &sequence);
+	}
+	if (err) {
+		LOG_ERR("Battery ADC setup failed (err %d)", err);
+		return err;
+	}
+	if (sample() == 0) {
+		level = mv_to_percent(filtered_mv);
+		sampled = true;
+	}
+	/* Published once the transports had a chance to come up */
+	k_work_reschedule(&sample_work, K_SECONDS(1));
+	return 0;
+}
+
+SYS_INIT(battery_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#ifdef CONFIG_SHELL
+static int cmd_battery(const struct shell *sh, size_t argc, char **argv)
+{
+	uint64_t uptime_us = MAX(k_uptime_get() * 1000, 1);
+
+	if (!sampled) {
+		shell_print(sh, "not sampled yet");
+	} else {
+		shell_print(sh, "%u%% (%d mV filtered)%s", level, filtered_mv,
+			    low ? ", low" : "");
+	}
+	shell_print(sh, "%u samples, %u failed, conversion %u us average, %u us max",
+		    stats.samples, stats.errors,
+		    stats.samples ? (uint32_t)(stats.total_us / stats.samples) : 0,
+		    stats.max_us);
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+	shell_print(sh, "CPU %u us per sample, %u ppm of the time",
+		    stats.samples ? (uint32_t)(stats.cpu_ns / 1000 / stats.samples) : 0,
+		    (uint32_t)(stats.cpu_ns / 1000 * 1000000 / uptime_us));
+#endif
+	return 0;
+}
+
+SHELL_CMD_REGISTER(battery, NULL, "Battery level and sampling cost", cmd_battery);
+#endif
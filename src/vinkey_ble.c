@@ -1,5 +1,6 @@
 #include <zephyr/types.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/bluetooth/bluetooth.h>
@@ -10,16 +11,22 @@
 #include <zephyr/usb/class/hid.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
 
 
 #include "main.h"
 
 #include "zephyr/usb/class/usbd_hid.h"
 
-LOG_MODULE_REGISTER(vinkey_ble, LOG_LEVEL_INF);
+LOG_MODULE_REGISTER(vinkey_ble, CONFIG_VINKEY_LOG_LEVEL);
 
+#define HIDS_REMOTE_WAKE BIT(0)
 #define HIDS_NORMALLY_CONNECTABLE BIT(1)
 
+/* Long peripheral latency lets the radio sleep through host suspend */
+#define SUSPEND_CONN_PARAM BT_LE_CONN_PARAM(24, 40, 29, 600)
+#define ACTIVE_CONN_PARAM BT_LE_CONN_PARAM(6, 12, 0, 400)
+
 struct hids_info {
 	uint16_t version;
 	uint8_t code;
@@ -34,7 +41,7 @@ struct hids_report {
 static struct hids_info info = {
 	.version = 0x0111,
 	.code = 0x00,
-	.flags = HIDS_NORMALLY_CONNECTABLE,
+	.flags = HIDS_REMOTE_WAKE | HIDS_NORMALLY_CONNECTABLE,
 };
 
 enum {
@@ -43,17 +50,131 @@ enum {
 	HIDS_FEATURE = 0x03,
 };
 
+enum {
+	HIDS_PROTOCOL_BOOT = 0x00,
+	HIDS_PROTOCOL_REPORT = 0x01,
+};
+
+enum {
+	HIDS_CONTROL_SUSPEND = 0x00,
+	HIDS_CONTROL_EXIT_SUSPEND = 0x01,
+};
+
+/* Input reports that can be notified, index into notify_attrs */
+enum {
+	NOTIFY_KEYBOARD,
+	NOTIFY_CONSUMER,
+	NOTIFY_SYSTEM,
+	NOTIFY_BOOT_KEYBOARD,
+	NOTIFY_COUNT,
+};
+
+/* Per connection HIDS state, every bonded host gets its own TX path */
+struct hids_peer {
+	struct bt_conn *conn;
+	uint8_t protocol_mode;
+	bool suspended;
+	/*
+	 * BIT(NOTIFY_*) set when notifications are enabled. Written from the BT
+	 * RX thread only, on CCC writes and when bonded CCCs are restored.
+	 */
+	atomic_t subscribed;
+	/* Notifications queued in the stack and not yet sent */
+	struct k_sem tx_credits;
+	uint8_t tx_phy;
+	bool encrypted;
+	/* Holds a clock boost while a pairing runs, set from the BT RX thread and the work queue */
+	atomic_t boosted;
+	int64_t boosted_at;
+	/* Connection interval in 1.25 ms units and peripheral latency */
+	uint16_t interval;
+	uint16_t latency;
+	/* Link setup timeline, ms after the connection came up, 0 while pending */
+	int64_t connected_at;
+	uint32_t encrypted_ms;
+	uint32_t first_report_ms;
+};
+
+static struct hids_peer peers[CONFIG_BT_MAX_CONN];
+/* Guards peer->conn between the BT RX thread and the transport send threads */
+static struct k_spinlock peer_lock;
+
+/*
+ * The one host that gets the reports. It keeps the keyboard until it
+ * disconnects or unsubscribes, another bonded host reconnecting in the
+ * background does not take over. "ble use" switches by hand.
+ */
+static atomic_ptr_t active_peer = ATOMIC_PTR_INIT(NULL);
+
+/* Connection currently asking for a passkey */
+static struct bt_conn *auth_conn;
+
+static uint8_t ble_leds;
+
+/* Estimated radio on time of the notifications sent */
+static struct {
+	uint32_t reports;
+	uint64_t radio_us;
+} airtime;
+
+static struct hids_peer *find_peer(const struct bt_conn *conn)
+{
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn == conn) {
+			return &peers[i];
+		}
+	}
+	return NULL;
+}
+
+/* A reference to the peer's connection, NULL when it has none */
+static struct bt_conn *peer_conn_get(struct hids_peer *peer)
+{
+	k_spinlock_key_t key = k_spin_lock(&peer_lock);
+	struct bt_conn *conn = peer->conn != NULL ? bt_conn_ref(peer->conn) : NULL;
+
+	k_spin_unlock(&peer_lock, key);
+	return conn;
+}
+
+static bool peer_conn_is(struct hids_peer *peer, const struct bt_conn *conn)
+{
+	k_spinlock_key_t key = k_spin_lock(&peer_lock);
+	bool same = peer->conn == conn;
+
+	k_spin_unlock(&peer_lock, key);
+	return same;
+}
+
+static void peer_conn_set(struct hids_peer *peer, struct bt_conn *conn)
+{
+	k_spinlock_key_t key = k_spin_lock(&peer_lock);
+
+	peer->conn = conn;
+	k_spin_unlock(&peer_lock, key);
+}
+
 static struct hids_report input_report_ref = {
-	.id = 0x00,
+	.id = VINKEY_REPORT_ID_KEYBOARD,
 	.type = HIDS_INPUT,
 };
 
 static struct hids_report output_report_ref = {
-	.id = 0x00,
+	.id = VINKEY_REPORT_ID_KEYBOARD,
 	.type = HIDS_OUTPUT,
 };
 
-static const uint8_t report_map[] = HID_KEYBOARD_REPORT_DESC();
+static struct hids_report consumer_report_ref = {
+	.id = VINKEY_REPORT_ID_CONSUMER,
+	.type = HIDS_INPUT,
+};
+
+static struct hids_report system_report_ref = {
+	.id = VINKEY_REPORT_ID_SYSTEM,
+	.type = HIDS_INPUT,
+};
+
+static const uint8_t report_map[] = VINKEY_HID_REPORT_MAP();
 
 static ssize_t read_info(struct bt_conn *conn,
 			  const struct bt_gatt_attr *attr, void *buf,
@@ -81,9 +202,13 @@ static ssize_t read_report_ref(struct bt_conn *conn,
 
 static void input_ccc_changed(const struct bt_gatt_attr *attr, uint16_t value)
 {
-	LOG_INF("HIDS input CCC changed: %u", value);
+	/* Aggregated over all peers, input_ccc_write() tracks each one */
+	LOG_DBG("HIDS input CCC changed: %u", value);
 }
 
+static ssize_t input_ccc_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			       uint16_t value);
+
 static ssize_t read_input_report(struct bt_conn *conn,
 				 const struct bt_gatt_attr *attr, void *buf,
 				 uint16_t len, uint16_t offset)
@@ -96,13 +221,123 @@ static ssize_t write_output_report(struct bt_conn *conn,
 				  const void *buf, uint16_t len, uint16_t offset,
 				  uint8_t flags)
 {
-	LOG_INF("HIDS output report write: len %u", len);
+	LOG_DBG("HIDS output report write: len %u", len);
+
+	if (len > 0) {
+		ble_leds = ((const uint8_t *)buf)[0];
+		vinkey_transport_leds_changed(vinkey_transport_find("ble"));
+	}
+
+	return len;
+}
+
+static ssize_t read_protocol_mode(struct bt_conn *conn,
+				  const struct bt_gatt_attr *attr, void *buf,
+				  uint16_t len, uint16_t offset)
+{
+	struct hids_peer *peer = find_peer(conn);
+	uint8_t mode = peer ? peer->protocol_mode : HIDS_PROTOCOL_REPORT;
+
+	return bt_gatt_attr_read(conn, attr, buf, len, offset, &mode, sizeof(mode));
+}
+
+static ssize_t write_protocol_mode(struct bt_conn *conn,
+				   const struct bt_gatt_attr *attr,
+				   const void *buf, uint16_t len, uint16_t offset,
+				   uint8_t flags)
+{
+	struct hids_peer *peer = find_peer(conn);
+
+	/* Checked before buf is touched, a peer may write zero bytes */
+	if (offset != 0 || len != 1) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
 
-	kb_set_report(NULL, HID_REPORT_TYPE_OUTPUT, 0, len, buf);
+	uint8_t mode = ((const uint8_t *)buf)[0];
+	if (mode != HIDS_PROTOCOL_BOOT && mode != HIDS_PROTOCOL_REPORT) {
+		/* Reserved values are ignored */
+		return len;
+	}
 
+	LOG_INF("HIDS protocol mode: %s", mode == HIDS_PROTOCOL_BOOT ? "boot" : "report");
+	if (peer) {
+		peer->protocol_mode = mode;
+	}
 	return len;
 }
 
+static void set_host_suspended(struct hids_peer *peer, bool suspended)
+{
+	if (peer == NULL || peer->suspended == suspended) {
+		return;
+	}
+
+	peer->suspended = suspended;
+	int err = bt_conn_le_param_update(peer->conn, suspended ? SUSPEND_CONN_PARAM
+							      : ACTIVE_CONN_PARAM);
+
+	if (err) {
+		LOG_WRN("Connection parameter update failed (err %d)", err);
+	}
+	vinkey_power_update();
+}
+
+static ssize_t write_ctrl_point(struct bt_conn *conn,
+				const struct bt_gatt_attr *attr,
+				const void *buf, uint16_t len, uint16_t offset,
+				uint8_t flags)
+{
+	if (offset != 0 || len != 1) {
+		return BT_GATT_ERR(BT_ATT_ERR_INVALID_ATTRIBUTE_LEN);
+	}
+
+	uint8_t command = ((const uint8_t *)buf)[0];
+
+	if (command != HIDS_CONTROL_SUSPEND && command != HIDS_CONTROL_EXIT_SUSPEND) {
+		/* Reserved values are ignored, the control point has no error response */
+		LOG_DBG("HIDS control point: reserved command 0x%02x ignored", command);
+		return len;
+	}
+	LOG_INF("HIDS control point: 0x%02x (%s)", command,
+		command == HIDS_CONTROL_SUSPEND ? "suspend" : "exit suspend");
+	set_host_suspended(find_peer(conn), command == HIDS_CONTROL_SUSPEND);
+	return len;
+}
+
+/* Attribute indices of kbd_svc, in the order of the service definition */
+enum {
+	KBD_ATTR_SVC,
+	KBD_ATTR_INFO_CHRC,
+	KBD_ATTR_INFO,
+	KBD_ATTR_MAP_CHRC,
+	KBD_ATTR_MAP,
+	KBD_ATTR_INPUT_CHRC,
+	KBD_ATTR_INPUT,
+	KBD_ATTR_INPUT_CCC,
+	KBD_ATTR_INPUT_REF,
+	KBD_ATTR_OUTPUT_CHRC,
+	KBD_ATTR_OUTPUT,
+	KBD_ATTR_OUTPUT_REF,
+	KBD_ATTR_CONSUMER_CHRC,
+	KBD_ATTR_CONSUMER,
+	KBD_ATTR_CONSUMER_CCC,
+	KBD_ATTR_CONSUMER_REF,
+	KBD_ATTR_SYSTEM_CHRC,
+	KBD_ATTR_SYSTEM,
+	KBD_ATTR_SYSTEM_CCC,
+	KBD_ATTR_SYSTEM_REF,
+	KBD_ATTR_PROTOCOL_CHRC,
+	KBD_ATTR_PROTOCOL,
+	KBD_ATTR_BOOT_INPUT_CHRC,
+	KBD_ATTR_BOOT_INPUT,
+	KBD_ATTR_BOOT_INPUT_CCC,
+	KBD_ATTR_BOOT_OUTPUT_CHRC,
+	KBD_ATTR_BOOT_OUTPUT,
+	KBD_ATTR_CTRL_POINT_CHRC,
+	KBD_ATTR_CTRL_POINT,
+	KBD_ATTR_COUNT,
+};
+
 BT_GATT_SERVICE_DEFINE(kbd_svc,
 	BT_GATT_PRIMARY_SERVICE(BT_UUID_HIDS),
 	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_INFO, BT_GATT_CHRC_READ,
@@ -113,8 +348,8 @@ BT_GATT_SERVICE_DEFINE(kbd_svc,
 			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
 			       BT_GATT_PERM_READ_ENCRYPT,
 			       read_input_report, NULL, NULL),
-	BT_GATT_CCC(input_ccc_changed,
-		    BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_CCC_WITH_WRITE_CB(input_ccc_changed, input_ccc_write,
+				  BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
 	BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ,
 			   read_report_ref, NULL, &input_report_ref),
 	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
@@ -125,8 +360,119 @@ BT_GATT_SERVICE_DEFINE(kbd_svc,
 			       read_input_report, write_output_report, NULL),
 	BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ,
 			   read_report_ref, NULL, &output_report_ref),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_READ_ENCRYPT,
+			       read_input_report, NULL, NULL),
+	BT_GATT_CCC_WITH_WRITE_CB(input_ccc_changed, input_ccc_write,
+				  BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ,
+			   read_report_ref, NULL, &consumer_report_ref),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_REPORT,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_READ_ENCRYPT,
+			       read_input_report, NULL, NULL),
+	BT_GATT_CCC_WITH_WRITE_CB(input_ccc_changed, input_ccc_write,
+				  BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_DESCRIPTOR(BT_UUID_HIDS_REPORT_REF, BT_GATT_PERM_READ,
+			   read_report_ref, NULL, &system_report_ref),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_PROTOCOL_MODE,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+			       BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT,
+			       read_protocol_mode, write_protocol_mode, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_IN_REPORT,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_NOTIFY,
+			       BT_GATT_PERM_READ_ENCRYPT,
+			       read_input_report, NULL, NULL),
+	BT_GATT_CCC_WITH_WRITE_CB(input_ccc_changed, input_ccc_write,
+				  BT_GATT_PERM_READ_ENCRYPT | BT_GATT_PERM_WRITE_ENCRYPT),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_BOOT_KB_OUT_REPORT,
+			       BT_GATT_CHRC_READ | BT_GATT_CHRC_WRITE |
+			       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+			       BT_GATT_PERM_READ_ENCRYPT |
+			       BT_GATT_PERM_WRITE_ENCRYPT,
+			       read_input_report, write_output_report, NULL),
+	BT_GATT_CHARACTERISTIC(BT_UUID_HIDS_CTRL_POINT,
+			       BT_GATT_CHRC_WRITE_WITHOUT_RESP,
+			       BT_GATT_PERM_WRITE_ENCRYPT,
+			       NULL, write_ctrl_point, NULL),
 );
 
+BUILD_ASSERT(ARRAY_SIZE(attr_kbd_svc) == KBD_ATTR_COUNT,
+	     "KBD_ATTR_* indices are out of sync with kbd_svc");
+
+static const struct bt_gatt_attr *const notify_attrs[NOTIFY_COUNT] = {
+	[NOTIFY_KEYBOARD] = &attr_kbd_svc[KBD_ATTR_INPUT],
+	[NOTIFY_CONSUMER] = &attr_kbd_svc[KBD_ATTR_CONSUMER],
+	[NOTIFY_SYSTEM] = &attr_kbd_svc[KBD_ATTR_SYSTEM],
+	[NOTIFY_BOOT_KEYBOARD] = &attr_kbd_svc[KBD_ATTR_BOOT_INPUT],
+};
+
+/* Keeps the active host if it can still take reports, else the first one that can */
+static void select_active_peer(void)
+{
+	struct hids_peer *active = atomic_ptr_get(&active_peer);
+
+	if (active != NULL && active->conn != NULL && atomic_get(&active->subscribed) != 0) {
+		return;
+	}
+
+	struct hids_peer *next = NULL;
+
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn != NULL && atomic_get(&peers[i].subscribed) != 0) {
+			next = &peers[i];
+			break;
+		}
+	}
+	atomic_ptr_set(&active_peer, next);
+	if (next != active) {
+		LOG_INF("Reports go to BLE peer %d", next ? (int)(next - peers) : -1);
+	}
+}
+
+static void subscriptions_changed(void)
+{
+	select_active_peer();
+	vinkey_transport_state_changed();
+}
+
+/* Called per peer before the value is stored, unlike input_ccc_changed() */
+static ssize_t input_ccc_write(struct bt_conn *conn, const struct bt_gatt_attr *attr,
+			       uint16_t value)
+{
+	struct hids_peer *peer = find_peer(conn);
+
+	for (int slot = 0; slot < NOTIFY_COUNT && peer != NULL; slot++) {
+		/* The CCC follows the value attribute it configures */
+		if (attr != notify_attrs[slot] + 1) {
+			continue;
+		}
+		if (value & BT_GATT_CCC_NOTIFY) {
+			atomic_or(&peer->subscribed, BIT(slot));
+		} else {
+			atomic_and(&peer->subscribed, ~BIT(slot));
+		}
+		subscriptions_changed();
+		break;
+	}
+	return sizeof(value);
+}
+
+/* Bonded CCC values are restored without a write once the link is encrypted */
+static void reload_subscriptions(struct hids_peer *peer)
+{
+	atomic_val_t subscribed = 0;
+
+	for (int i = 0; i < NOTIFY_COUNT; i++) {
+		if (bt_gatt_is_subscribed(peer->conn, notify_attrs[i], BT_GATT_CCC_NOTIFY)) {
+			subscribed |= BIT(i);
+		}
+	}
+	atomic_set(&peer->subscribed, subscribed);
+	subscriptions_changed();
+}
+
 static const struct bt_data ad[] = {
 	BT_DATA_BYTES(BT_DATA_GAP_APPEARANCE,
 
@@ -140,11 +486,120 @@ static const struct bt_data sd[] = {
 	BT_DATA(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME, (sizeof(CONFIG_BT_DEVICE_NAME) - 1)),
 };
 
-static struct bt_conn *current_conn;
-
 volatile bool ble_kb_ready = false;
 
 
+/*
+ * Asks for everything that shortens the link setup and the radio time per
+ * report right away, instead of waiting for the central to get to it.
+ */
+static void link_setup(struct bt_conn *conn)
+{
+	int err;
+
+	/* Bonded hosts re-encrypt before their first encrypted read, not after it */
+	if (bt_le_bond_exists(BT_ID_DEFAULT, bt_conn_get_dst(conn))) {
+		err = bt_conn_set_security(conn, BT_SECURITY_L2);
+		if (err) {
+			LOG_WRN("Early security request failed (err %d)", err);
+		}
+	}
+
+	err = bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M);
+	if (err) {
+		LOG_DBG("2M PHY request failed (err %d)", err);
+	}
+	err = bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX);
+	if (err) {
+		LOG_DBG("Data length request failed (err %d)", err);
+	}
+}
+
+/* Connectable advertising stops when a central connects */
+static bool advertising;
+
+/*
+ * Radio event rates for the energy estimate. A peripheral with latency may
+ * skip that many connection events while it has nothing to send, the
+ * reports it sends are charged by their airtime.
+ */
+static void radio_update(void)
+{
+	if (!IS_ENABLED(CONFIG_VINKEY_ENERGY)) {
+		return;
+	}
+
+	/* Events per 1000 s, at 1.25 ms and 0.625 ms units */
+	uint32_t conn_mhz = 0;
+	uint32_t adv_mhz = 0;
+
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn != NULL && peers[i].interval != 0) {
+			conn_mhz += 800000U / (peers[i].interval * (peers[i].latency + 1U));
+		}
+	}
+	if (advertising) {
+		adv_mhz = 1600000U / ((BT_GAP_ADV_FAST_INT_MIN_1 + BT_GAP_ADV_FAST_INT_MAX_1) / 2);
+	}
+	vinkey_energy_radio_events(conn_mhz, adv_mhz);
+}
+
+/* Longest a pairing holds the boost, the SMP timeout */
+#define PAIRING_BOOST_MS (30000)
+
+static void boost_expired(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(boost_work, boost_expired);
+
+/*
+ * Pairing crypto runs at full clock, from the start of a pairing until it
+ * completes, fails or times out. Bonded hosts only re-encrypt, which the
+ * controller does, they do not get a boost.
+ */
+static void peer_boost(struct hids_peer *peer, bool boost)
+{
+	if (!IS_ENABLED(CONFIG_VINKEY_CLOCK_SCALING) ||
+	    !atomic_cas(&peer->boosted, !boost, boost)) {
+		return;
+	}
+	if (boost) {
+		peer->boosted_at = k_uptime_get();
+		k_work_reschedule(&boost_work, K_MSEC(PAIRING_BOOST_MS));
+	}
+	vinkey_clock_boost(boost);
+}
+
+/* A host that went quiet in the middle of a pairing does not keep the clock up */
+static void boost_expired(struct k_work *work)
+{
+	int64_t now = k_uptime_get();
+
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (!atomic_get(&peers[i].boosted)) {
+			continue;
+		}
+
+		int64_t left = peers[i].boosted_at + PAIRING_BOOST_MS - now;
+
+		if (left <= 0) {
+			LOG_WRN("Pairing still running after %d ms, clock boost dropped",
+				PAIRING_BOOST_MS);
+			peer_boost(&peers[i], false);
+		} else {
+			k_work_reschedule(&boost_work, K_MSEC(left));
+		}
+	}
+}
+
+static void pairing_boost(struct bt_conn *conn, bool boost)
+{
+	struct hids_peer *peer = find_peer(conn);
+
+	if (peer != NULL) {
+		peer_boost(peer, boost);
+	}
+}
+
 static void connected(struct bt_conn *conn, uint8_t err)
 {
 	char addr[BT_ADDR_LE_STR_LEN];
@@ -157,9 +612,49 @@ static void connected(struct bt_conn *conn, uint8_t err)
 	}
 
 	LOG_INF("Connected %s", addr);
-	current_conn = bt_conn_ref(conn);
+	advertising = false;
+
+	struct hids_peer *peer = find_peer(NULL);
+
+	if (peer == NULL) {
+		LOG_ERR("No HIDS slot for %s", addr);
+		return;
+	}
+
+	/* HIDS: every new connection starts in report protocol mode */
+	peer->protocol_mode = HIDS_PROTOCOL_REPORT;
+	peer->suspended = false;
+	atomic_set(&peer->subscribed, 0);
+	k_sem_init(&peer->tx_credits, CONFIG_VINKEY_BLE_TX_CREDITS, CONFIG_VINKEY_BLE_TX_CREDITS);
+	peer->tx_phy = BT_GAP_LE_PHY_1M;
+	peer->encrypted = false;
+	peer->connected_at = k_uptime_get();
+	peer->encrypted_ms = 0;
+	peer->first_report_ms = 0;
+	/* Published last, the send threads see a fully set up peer */
+	peer_conn_set(peer, bt_conn_ref(conn));
+
+	struct bt_conn_info info;
+
+	if (bt_conn_get_info(conn, &info) == 0) {
+		peer->interval = info.le.interval;
+		peer->latency = info.le.latency;
+	}
+	link_setup(conn);
 	ble_kb_ready = true;
-	update_connect_status();
+	vinkey_transport_state_changed();
+
+	if (find_peer(NULL) != NULL) {
+		/* Room for another host, keep advertising */
+		int adv_err = bt_le_adv_start(BT_LE_ADV_CONN_FAST_1, ad, ARRAY_SIZE(ad),
+					      sd, ARRAY_SIZE(sd));
+
+		if (adv_err) {
+			LOG_WRN("Advertising for another host failed (err %d)", adv_err);
+		}
+		advertising = adv_err == 0;
+	}
+	radio_update();
 }
 
 bool advertising_start()
@@ -172,6 +667,9 @@ bool advertising_start()
 	}
 
 	LOG_INF("Advertising successfully started");
+	advertising = true;
+	radio_update();
+	vinkey_boot_mark(VINKEY_BOOT_ADVERTISING);
 	return false;
 }
 
@@ -183,9 +681,22 @@ static void disconnected(struct bt_conn *conn, uint8_t reason)
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	LOG_INF("Disconnected from %s (reason %x)", addr, reason);
-	if (current_conn == conn) {
-		bt_conn_unref(current_conn);
-		current_conn = NULL;
+
+	struct hids_peer *peer = find_peer(conn);
+
+	if (peer != NULL) {
+		peer_boost(peer, false);
+		peer_conn_set(peer, NULL);
+		/* A send thread waiting for a credit gives up on this link now */
+		k_sem_reset(&peer->tx_credits);
+		bt_conn_unref(conn);
+		peer->suspended = false;
+		atomic_set(&peer->subscribed, 0);
+		select_active_peer();
+		radio_update();
+	}
+	if (auth_conn == conn) {
+		auth_conn = NULL;
 	}
 }
 
@@ -198,6 +709,16 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 
 	if (!err) { // NOLINT(*-branch-clone)
 		LOG_INF("Security changed: %s level %u", addr, level);
+		/* Bonded CCC values are restored once the link is encrypted */
+		struct hids_peer *peer = find_peer(conn);
+
+		if (peer != NULL) {
+			if (!peer->encrypted && level >= BT_SECURITY_L2) {
+				peer->encrypted = true;
+				peer->encrypted_ms = k_uptime_get() - peer->connected_at;
+			}
+			reload_subscriptions(peer);
+		}
 	} else {
 		LOG_ERR("Security failed: %s level %u err %d", addr, level, err);
 	}
@@ -206,14 +727,52 @@ static void security_changed(struct bt_conn *conn, bt_security_t level,
 void conn_recycled()
 {
 	ble_kb_ready = false;
-	update_connect_status();
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn != NULL) {
+			ble_kb_ready = true;
+		}
+	}
+	vinkey_transport_state_changed();
 	advertising_start();
 }
 
+static void le_phy_updated(struct bt_conn *conn, struct bt_conn_le_phy_info *param)
+{
+	struct hids_peer *peer = find_peer(conn);
+
+	LOG_INF("PHY updated: TX %u, RX %u", param->tx_phy, param->rx_phy);
+	if (peer != NULL) {
+		peer->tx_phy = param->tx_phy;
+	}
+}
+
+static void le_param_updated(struct bt_conn *conn, uint16_t interval, uint16_t latency,
+			     uint16_t timeout)
+{
+	struct hids_peer *peer = find_peer(conn);
+
+	LOG_INF("Connection parameters updated: interval %u us, latency %u, timeout %u ms",
+		interval * 1250, latency, timeout * 10);
+	if (peer != NULL) {
+		peer->interval = interval;
+		peer->latency = latency;
+		radio_update();
+	}
+}
+
+static void le_data_len_updated(struct bt_conn *conn, struct bt_conn_le_data_len_info *info)
+{
+	LOG_INF("Data length updated: TX %u bytes %u us, RX %u bytes %u us",
+		info->tx_max_len, info->tx_max_time, info->rx_max_len, info->rx_max_time);
+}
+
 BT_CONN_CB_DEFINE(conn_callbacks) = {
 	.connected = connected,
 	.disconnected = disconnected,
 	.security_changed = security_changed,
+	.le_param_updated = le_param_updated,
+	.le_phy_updated = le_phy_updated,
+	.le_data_len_updated = le_data_len_updated,
 	.recycled = conn_recycled,
 };
 
@@ -228,6 +787,7 @@ static void auth_passkey_display(struct bt_conn *conn, unsigned int passkey)
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	LOG_INF("Passkey for %s: %06u", addr, passkey);
+	pairing_boost(conn, true);
 }
 
 static void auth_passkey_entry(struct bt_conn *conn)
@@ -237,9 +797,15 @@ static void auth_passkey_entry(struct bt_conn *conn)
 	bt_addr_le_to_str(bt_conn_get_dst(conn), addr, sizeof(addr));
 
 	LOG_INF("Enter passkey for %s", addr);
+	pairing_boost(conn, true);
+	auth_conn = conn;
 	passkey_entered = 0;
 	passkey_digit_count = 0;
 	passkey_entry_mode = true;
+	vinkey_led_indicate(VINKEY_IND_PAIRING, true);
+	if (IS_ENABLED(CONFIG_VINKEY_SYNTH_INPUT)) {
+		vinkey_synth_passkey();
+	}
 }
 
 static void auth_cancel(struct bt_conn *conn)
@@ -250,6 +816,8 @@ static void auth_cancel(struct bt_conn *conn)
 
 	LOG_INF("Pairing cancelled: %s", addr);
 	passkey_entry_mode = false;
+	vinkey_led_indicate(VINKEY_IND_PAIRING, false);
+	pairing_boost(conn, false);
 }
 
 static struct bt_conn_auth_cb auth_cb_display = {
@@ -258,9 +826,26 @@ static struct bt_conn_auth_cb auth_cb_display = {
 	.cancel = auth_cancel,
 };
 
+static void pairing_complete(struct bt_conn *conn, bool bonded)
+{
+	LOG_INF("Pairing complete%s", bonded ? ", bonded" : "");
+	pairing_boost(conn, false);
+}
+
+static void pairing_failed(struct bt_conn *conn, enum bt_security_err reason)
+{
+	LOG_WRN("Pairing failed (reason %d)", reason);
+	pairing_boost(conn, false);
+}
+
+static struct bt_conn_auth_info_cb auth_info_cb = {
+	.pairing_complete = pairing_complete,
+	.pairing_failed = pairing_failed,
+};
+
 void vinkey_ble_handle_key(uint8_t hid_code, bool pressed)
 {
-	if (!pressed || !passkey_entry_mode || !current_conn) {
+	if (!pressed || !passkey_entry_mode || !auth_conn) {
 		return;
 	}
 
@@ -276,46 +861,269 @@ void vinkey_ble_handle_key(uint8_t hid_code, bool pressed)
 		if (passkey_digit_count < 6) {
 			passkey_entered = passkey_entered * 10 + digit;
 			passkey_digit_count++;
-			LOG_INF("Passkey digit entered: %u (total: %u)", digit, passkey_entered);
+			LOG_DBG("Passkey digit entered: %u (total: %u)", digit, passkey_entered);
 		}
 	} else if (hid_code == HID_KEY_ENTER) {
 		/* Enter */
 		LOG_INF("Passkey submitted: %06u", passkey_entered);
-		bt_conn_auth_passkey_entry(current_conn, passkey_entered);
+		bt_conn_auth_passkey_entry(auth_conn, passkey_entered);
 		passkey_entry_mode = false;
+		vinkey_led_indicate(VINKEY_IND_PAIRING, false);
 	} else if (hid_code == HID_KEY_BACKSPACE) {
 		/* Backspace */
 		if (passkey_digit_count > 0) {
 			passkey_entered /= 10;
 			passkey_digit_count--;
-			LOG_INF("Passkey digit removed (total: %u)", passkey_entered);
+			LOG_DBG("Passkey digit removed (total: %u)", passkey_entered);
 		}
 	}
 }
 
+/* Settings are loaded off the init path, the NVS scan does not hold up USB */
+static void ble_start_work_handler(struct k_work *work)
+{
+	if (IS_ENABLED(CONFIG_SETTINGS)) {
+		settings_load();
+		vinkey_boot_mark(VINKEY_BOOT_SETTINGS_LOADED);
+	}
+
+	bt_conn_auth_cb_register(&auth_cb_display);
+	bt_conn_auth_info_cb_register(&auth_info_cb);
+
+	advertising_start();
+}
+
+static K_WORK_DEFINE(ble_start_work, ble_start_work_handler);
+
+static void bt_ready(int err)
+{
+	if (err) {
+		LOG_ERR("Bluetooth init failed (err %d)", err);
+		failure();
+	}
+
+	LOG_INF("Bluetooth initialized");
+	vinkey_boot_mark(VINKEY_BOOT_BT_READY);
+	k_work_submit(&ble_start_work);
+}
+
 void vinkey_ble_init()
 {
 	int err;
 
-	err = bt_enable(NULL);
+	err = bt_enable(bt_ready);
 	if (err) {
 		LOG_ERR("Bluetooth init failed (err %d)", err);
 		failure();
 	}
+}
 
-	LOG_INF("Bluetooth initialized");
+uint8_t vinkey_ble_leds(void)
+{
+	return ble_leds;
+}
 
-	if (IS_ENABLED(CONFIG_SETTINGS)) {
-		settings_load();
+bool vinkey_ble_suspended(void)
+{
+	bool any = false;
+
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		if (peers[i].conn == NULL) {
+			continue;
+		}
+		if (!peers[i].suspended) {
+			return false;
+		}
+		any = true;
 	}
+	return any;
+}
 
-	bt_conn_auth_cb_register(&auth_cb_display);
+bool vinkey_ble_ready(void)
+{
+	return atomic_ptr_get(&active_peer) != NULL;
+}
 
-	advertising_start();
+/*
+ * Radio on time of one notification and the central's empty packet around
+ * it: preamble, access address, header and CRC each, the MIC and the L2CAP
+ * and ATT headers on the notification, T_IFS in between.
+ */
+static uint32_t report_airtime_us(const struct hids_peer *peer, uint16_t len)
+{
+	bool phy_2m = peer->tx_phy == BT_GAP_LE_PHY_2M;
+	uint32_t overhead = (phy_2m ? 2 : 1) + 4 + 2 + 3;
+	uint32_t notification = overhead + 4 + 3 + len + (peer->encrypted ? 4 : 0);
+
+	return (notification + overhead) * (phy_2m ? 4 : 8) + 150;
 }
 
-void vinkey_ble_send_report(const uint8_t *report, uint16_t len)
+static void report_sent(struct hids_peer *peer, uint16_t len)
 {
-	/* Index 6 is the report characteristic value in kbd_svc */
-	bt_gatt_notify(NULL, &kbd_svc.attrs[6], report, len);
+	uint32_t us = report_airtime_us(peer, len);
+
+	airtime.reports++;
+	airtime.radio_us += us;
+	if (IS_ENABLED(CONFIG_VINKEY_ENERGY)) {
+		vinkey_energy_radio_airtime(us);
+	}
+}
+
+/* Called once the controller has sent the notification, not when it was queued */
+static void notify_sent(struct bt_conn *conn, void *user_data)
+{
+	struct hids_peer *peer = user_data;
+
+	if (peer->conn == conn && peer->encrypted && peer->first_report_ms == 0) {
+		peer->first_report_ms = MAX(k_uptime_get() - peer->connected_at, 1);
+		LOG_INF("Peer %d: encrypted %u ms and first report %u ms after connecting",
+			(int)(peer - peers), peer->encrypted_ms, peer->first_report_ms);
+	}
+	k_sem_give(&peer->tx_credits);
 }
+
+static int notify_slot(const struct hids_peer *peer, uint8_t id)
+{
+	if (peer->protocol_mode == HIDS_PROTOCOL_BOOT) {
+		return id == VINKEY_REPORT_ID_KEYBOARD ? NOTIFY_BOOT_KEYBOARD : -1;
+	}
+
+	switch (id) {
+	case VINKEY_REPORT_ID_KEYBOARD:
+		return NOTIFY_KEYBOARD;
+	case VINKEY_REPORT_ID_CONSUMER:
+		return NOTIFY_CONSUMER;
+	case VINKEY_REPORT_ID_SYSTEM:
+		return NOTIFY_SYSTEM;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Notifies one connection, never NULL: bt_gatt_notify_cb() would notify
+ * every subscribed host with it. The connection is held by a reference
+ * taken up front and checked again after the credit wait, a host that
+ * disconnected meanwhile gets nothing and no freed connection is used.
+ */
+static int notify_peer(struct hids_peer *peer, const struct vinkey_report *report)
+{
+	int slot = notify_slot(peer, report->id);
+
+	if (slot < 0 || !(atomic_get(&peer->subscribed) & BIT(slot))) {
+		/* Nothing the host asked for, not an error */
+		return 0;
+	}
+
+	struct bt_conn *conn = peer_conn_get(peer);
+
+	if (conn == NULL) {
+		return -ENOTCONN;
+	}
+
+	int err = k_sem_take(&peer->tx_credits, K_MSEC(CONFIG_VINKEY_BLE_TX_TIMEOUT_MS));
+	bool gone = !peer_conn_is(peer, conn);
+
+	if (err || gone) {
+		if (gone) {
+			err = -ENOTCONN;
+		} else {
+			LOG_WRN("Notification to peer %d timed out", (int)(peer - peers));
+			err = -ETIMEDOUT;
+		}
+		bt_conn_unref(conn);
+		return err;
+	}
+
+	struct bt_gatt_notify_params params = {
+		.attr = notify_attrs[slot],
+		.data = vinkey_report_data(report),
+		.len = vinkey_report_len(report->id),
+		.func = notify_sent,
+		.user_data = peer,
+	};
+
+	err = bt_gatt_notify_cb(conn, &params);
+	if (err) {
+		k_sem_give(&peer->tx_credits);
+	} else {
+		report_sent(peer, params.len);
+	}
+	bt_conn_unref(conn);
+	return err;
+}
+
+/*
+ * Notifies the active host only, a second bonded host must not see the
+ * keystrokes. The credits keep the controller queue filled for the next
+ * connection event without running out of buffers.
+ */
+int vinkey_ble_send_report(const struct vinkey_report *report)
+{
+	struct hids_peer *peer = atomic_ptr_get(&active_peer);
+
+	if (peer == NULL) {
+		return -ENOTCONN;
+	}
+	return notify_peer(peer, report);
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_ble_link(const struct shell *sh, size_t argc, char **argv)
+{
+	for (int i = 0; i < ARRAY_SIZE(peers); i++) {
+		const struct hids_peer *peer = &peers[i];
+
+		if (peer->conn == NULL) {
+			continue;
+		}
+		shell_print(sh, "peer %d%s: %s PHY, encrypted after %u ms, first report after %u ms",
+			    i, peer == atomic_ptr_get(&active_peer) ? " (active)" : "",
+			    peer->tx_phy == BT_GAP_LE_PHY_2M ? "2M" : "1M",
+			    peer->encrypted_ms, peer->first_report_ms);
+	}
+	if (airtime.reports > 0) {
+		shell_print(sh, "%u reports, %u us radio time per report (estimated)",
+			    airtime.reports, (uint32_t)(airtime.radio_us / airtime.reports));
+	}
+	return 0;
+}
+
+static int cmd_ble_use(const struct shell *sh, size_t argc, char **argv)
+{
+	int i = strtol(argv[1], NULL, 10);
+
+	if (i < 0 || i >= ARRAY_SIZE(peers) || peers[i].conn == NULL ||
+	    atomic_get(&peers[i].subscribed) == 0) {
+		shell_error(sh, "Peer %d is not connected and subscribed", i);
+		return -EINVAL;
+	}
+
+	struct hids_peer *previous = atomic_ptr_set(&active_peer, &peers[i]);
+
+	if (previous != NULL && previous != &peers[i] && previous->conn != NULL) {
+		/* Leave nothing pressed on the host that loses the keyboard */
+		static const uint8_t ids[] = {
+			VINKEY_REPORT_ID_KEYBOARD,
+			VINKEY_REPORT_ID_CONSUMER,
+			VINKEY_REPORT_ID_SYSTEM,
+		};
+
+		for (int j = 0; j < ARRAY_SIZE(ids); j++) {
+			struct vinkey_report released = {.id = ids[j]};
+
+			(void)notify_peer(previous, &released);
+		}
+	}
+	kb_resend_reports();
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(ble_cmds,
+	SHELL_CMD(link, NULL, "Link setup times and radio time per report", cmd_ble_link),
+	SHELL_CMD_ARG(use, NULL, "<peer>, send reports to this host", cmd_ble_use, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(ble, &ble_cmds, "BLE HID link", NULL);
+#endif
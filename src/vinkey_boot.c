@@ -0,0 +1,41 @@
+/*
+ * Boot timeline. Each milestone is stamped once, relative to kernel start,
+ * and logged as it happens so the boot order can be read from the RTT log.
+ * The uptime clock starts with the kernel, so the time spent in MCUboot
+ * (image validation, a swap after an update) and the reset delay before it
+ * are not included. Add them from a logic analyzer capture on the reset pin
+ * when the total time from power on matters.
+ */
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_boot, CONFIG_VINKEY_LOG_LEVEL);
+
+static const char *const milestone_names[VINKEY_BOOT_COUNT] = {
+	[VINKEY_BOOT_MAIN] = "main",
+	[VINKEY_BOOT_USB_ENABLED] = "USB enabled",
+	[VINKEY_BOOT_USB_CONFIGURED] = "USB configured",
+	[VINKEY_BOOT_BT_READY] = "BT ready",
+	[VINKEY_BOOT_SETTINGS_LOADED] = "settings loaded",
+	[VINKEY_BOOT_ADVERTISING] = "BLE advertising",
+	[VINKEY_BOOT_FIRST_REPORT] = "first report delivered",
+};
+
+static uint32_t milestones_us[VINKEY_BOOT_COUNT];
+static atomic_t marked;
+
+void vinkey_boot_mark(enum vinkey_boot_milestone milestone)
+{
+	if (atomic_test_and_set_bit(&marked, milestone)) {
+		return;
+	}
+
+	milestones_us[milestone] = k_ticks_to_us_floor32(k_uptime_ticks());
+	LOG_INF("Boot: %s at %u.%03u ms", milestone_names[milestone],
+		milestones_us[milestone] / 1000U, milestones_us[milestone] % 1000U);
+}
+
+uint32_t vinkey_boot_time_us(enum vinkey_boot_milestone milestone)
+{
+	return atomic_test_bit(&marked, milestone) ? milestones_us[milestone] : 0;
+}
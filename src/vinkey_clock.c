@@ -0,0 +1,166 @@
+/*
+ * Application core clock policy on the nRF5340. The core runs at 64 MHz, key
+ * handling is a few microseconds of work per event and gains nothing from a
+ * faster clock. Bursts of real work (pairing crypto, a firmware upload) take a
+ * boost reference and run at 128 MHz until the last one is dropped.
+ *
+ * Time, CPU load and key to host latency are kept per clock, with an average
+ * current estimated from the CPU load and the datasheet run currents, so the
+ * "clock" shell command shows what the boosts cost and what they buy. The
+ * current is an estimate, nothing here measures it.
+ */
+
+#include <string.h>
+
+#include <nrfx_clock.h>
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_clock, CONFIG_VINKEY_LOG_LEVEL);
+
+/*
+ * Estimates, not measurements: nRF5340 datasheet typicals for the application
+ * core running from flash with cache, and System ON idle, uA
+ */
+#define RUN_64M_UA  (2700)
+#define RUN_128M_UA (5000)
+#define IDLE_UA     (3)
+
+enum clock_mode {
+	CLOCK_64M,
+	CLOCK_128M,
+	CLOCK_MODES,
+};
+
+static const char *const mode_names[CLOCK_MODES] = {"64 MHz", "128 MHz"};
+static const uint32_t run_ua[CLOCK_MODES] = {RUN_64M_UA, RUN_128M_UA};
+
+static struct {
+	uint32_t entries;
+	uint64_t ms;
+	uint64_t busy_cycles;
+	uint64_t idle_cycles;
+	uint64_t latency_us;
+	uint32_t latency_count;
+} modes[CLOCK_MODES];
+
+static struct k_spinlock lock;
+static int boosts;
+static enum clock_mode mode = CLOCK_64M;
+static int64_t mode_since;
+static k_thread_runtime_stats_t mode_start;
+
+/* Adds the time since the last switch to the current mode */
+static void account(void)
+{
+	k_thread_runtime_stats_t now;
+	int64_t now_ms = k_uptime_get();
+
+	k_thread_runtime_stats_all_get(&now);
+	modes[mode].ms += now_ms - mode_since;
+	modes[mode].busy_cycles += now.total_cycles - mode_start.total_cycles;
+	modes[mode].idle_cycles += now.idle_cycles - mode_start.idle_cycles;
+	mode_since = now_ms;
+	mode_start = now;
+}
+
+static void set_mode(enum clock_mode next)
+{
+	account();
+
+	nrfx_err_t err = nrfx_clock_divider_set(NRF_CLOCK_DOMAIN_HFCLK, next == CLOCK_128M ?
+						NRF_CLOCK_HFCLK_DIV_1 : NRF_CLOCK_HFCLK_DIV_2);
+
+	if (err != NRFX_SUCCESS) {
+		LOG_ERR("HFCLK divider not set (err %#x), staying at %s", err, mode_names[mode]);
+		return;
+	}
+	/* k_busy_wait() counts core cycles */
+	SystemCoreClockUpdate();
+	mode = next;
+	modes[mode].entries++;
+}
+
+void vinkey_clock_boost(bool boost)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	if (boost) {
+		if (boosts++ == 0) {
+			set_mode(CLOCK_128M);
+		}
+	} else if (boosts > 0 && --boosts == 0) {
+		set_mode(CLOCK_64M);
+	}
+	k_spin_unlock(&lock, key);
+}
+
+void vinkey_clock_latency(uint32_t us)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	modes[mode].latency_us += us;
+	modes[mode].latency_count++;
+	k_spin_unlock(&lock, key);
+}
+
+static int clock_init(void)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	mode_since = k_uptime_get();
+	k_thread_runtime_stats_all_get(&mode_start);
+	set_mode(CLOCK_64M);
+	k_spin_unlock(&lock, key);
+	return 0;
+}
+
+SYS_INIT(clock_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#ifdef CONFIG_SHELL
+static int cmd_clock_status(const struct shell *sh, size_t argc, char **argv)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	account();
+	k_spin_unlock(&lock, key);
+
+	shell_print(sh, "running at %s, %d boosts held", mode_names[mode], boosts);
+	for (int i = 0; i < CLOCK_MODES; i++) {
+		uint64_t cycles = MAX(modes[i].busy_cycles + modes[i].idle_cycles, 1);
+		uint32_t busy_permille = modes[i].busy_cycles * 1000 / cycles;
+		uint32_t avg_ua = (modes[i].busy_cycles * run_ua[i] +
+				   modes[i].idle_cycles * IDLE_UA) / cycles;
+
+		shell_print(sh, "%-8s %u times, %llu ms, CPU busy %u.%u%%, ~%u uA estimated, "
+			    "%u reports at %u us latency", mode_names[i], modes[i].entries,
+			    modes[i].ms, busy_permille / 10, busy_permille % 10, avg_ua,
+			    modes[i].latency_count,
+			    modes[i].latency_count ?
+			    (uint32_t)(modes[i].latency_us / modes[i].latency_count) : 0);
+	}
+	return 0;
+}
+
+static int cmd_clock_boost(const struct shell *sh, size_t argc, char **argv)
+{
+	static bool held;
+	bool on = strcmp(argv[1], "on") == 0;
+
+	if (on != held) {
+		held = on;
+		vinkey_clock_boost(on);
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(clock_cmds,
+	SHELL_CMD(status, NULL, "Time, CPU load, current and latency per clock", cmd_clock_status),
+	SHELL_CMD_ARG(boost, NULL, "on|off, hold a boost from the shell", cmd_clock_boost, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(clock, &clock_cmds, "Application core clock policy", NULL);
+#endif
@@ -0,0 +1,188 @@
+/*
+ * Firmware updates over BLE. MCUmgr SMP receives the image into the second
+ * MCUboot slot on its own low priority work queue, so key reports keep going
+ * out while an upload runs. Every chunk is accounted to log the transfer rate.
+ * The upload holds a clock boost from its first chunk until it is complete,
+ * stopped, the link drops or no chunk came for UPLOAD_IDLE_S; a resumed
+ * upload takes it again.
+ *
+ * A freshly swapped image runs as a test image: it is confirmed once it has
+ * been up for a while with a host attached. If it faults, the supervisor
+ * watchdog resets it before that and MCUboot swaps the previous image back.
+ */
+
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/dfu/mcuboot.h>
+#include <zephyr/init.h>
+#include <zephyr/mgmt/mcumgr/grp/img_mgmt/img_mgmt.h>
+#include <zephyr/mgmt/mcumgr/mgmt/callbacks.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_dfu, CONFIG_VINKEY_LOG_LEVEL);
+
+/* SMP tools send the next chunk as soon as the last one is acknowledged */
+#define UPLOAD_IDLE_S (5)
+
+static struct {
+	int64_t start_ms;
+	uint32_t elapsed_ms;
+	uint32_t size;
+	uint32_t received;
+	/* Next progress log, in tenths of the image */
+	uint8_t next_tenth;
+	/* Set from the SMP work queue, cleared from there, the BT RX thread and the idle timer */
+	atomic_t active;
+} upload;
+
+static void confirm_handler(struct k_work *work);
+static void idle_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(confirm_work, confirm_handler);
+static K_WORK_DELAYABLE_DEFINE(idle_work, idle_handler);
+
+/* Image hashing and flash writes are CPU bound, run them at full clock */
+static bool set_active(bool active)
+{
+	if (!atomic_cas(&upload.active, !active, active)) {
+		return false;
+	}
+	if (IS_ENABLED(CONFIG_VINKEY_CLOCK_SCALING)) {
+		vinkey_clock_boost(active);
+	}
+	return true;
+}
+
+static void upload_paused(const char *why)
+{
+	if (set_active(false)) {
+		LOG_WRN("Image upload %s at %u of %u bytes", why, upload.received, upload.size);
+	}
+}
+
+static void idle_handler(struct k_work *work)
+{
+	upload_paused("idle");
+}
+
+static void disconnected(struct bt_conn *conn, uint8_t reason)
+{
+	upload_paused("interrupted");
+}
+
+/* The SMP transport goes with the link, an upload over another host's link does too */
+BT_CONN_CB_DEFINE(dfu_conn_callbacks) = {
+	.disconnected = disconnected,
+};
+
+static uint32_t upload_kbps(void)
+{
+	return upload.elapsed_ms ? upload.received / upload.elapsed_ms : 0;
+}
+
+static void upload_chunk(const struct img_mgmt_upload_req *req)
+{
+	if (req->off == 0) {
+		upload.start_ms = k_uptime_get();
+		upload.size = req->size;
+		upload.next_tenth = 1;
+	}
+	set_active(true);
+	k_work_reschedule(&idle_work, K_SECONDS(UPLOAD_IDLE_S));
+	upload.received = req->off + req->img_data.len;
+	upload.elapsed_ms = k_uptime_get() - upload.start_ms;
+
+	if (upload.size > 0 &&
+	    (uint64_t)upload.received * 10 >= (uint64_t)upload.size * upload.next_tenth) {
+		LOG_INF("Image upload %u%%, %u KB/s", upload.next_tenth * 10, upload_kbps());
+		upload.next_tenth++;
+	}
+}
+
+static enum mgmt_cb_return dfu_event(uint32_t event, enum mgmt_cb_return prev_status,
+				     int32_t *rc, uint16_t *group, bool *abort_more,
+				     void *data, size_t data_size)
+{
+	switch (event) {
+	case MGMT_EVT_OP_IMG_MGMT_DFU_CHUNK:
+		upload_chunk(((const struct img_mgmt_upload_check *)data)->req);
+		break;
+	case MGMT_EVT_OP_IMG_MGMT_DFU_PENDING:
+		k_work_cancel_delayable(&idle_work);
+		set_active(false);
+		LOG_INF("Image of %u bytes received in %u ms, %u KB/s", upload.received,
+			upload.elapsed_ms, upload_kbps());
+		break;
+	case MGMT_EVT_OP_IMG_MGMT_DFU_STOPPED:
+		k_work_cancel_delayable(&idle_work);
+		upload_paused("stopped");
+		break;
+	default:
+		break;
+	}
+	return MGMT_CB_OK;
+}
+
+static struct mgmt_callback dfu_callback = {
+	.callback = dfu_event,
+	.event_id = MGMT_EVT_OP_IMG_MGMT_ALL,
+};
+
+static bool host_attached(void)
+{
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (t->api->ready()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void confirm_handler(struct k_work *work)
+{
+	if (!host_attached()) {
+		k_work_reschedule(&confirm_work, K_SECONDS(CONFIG_VINKEY_DFU_CONFIRM_DELAY_S));
+		return;
+	}
+
+	int err = boot_write_img_confirmed();
+
+	if (err) {
+		LOG_ERR("Image confirmation failed (err %d)", err);
+	} else {
+		LOG_INF("Image confirmed");
+	}
+}
+
+static int dfu_init(void)
+{
+	mgmt_callback_register(&dfu_callback);
+	if (!boot_is_img_confirmed()) {
+		LOG_WRN("Running a test image, it reverts unless confirmed");
+		k_work_reschedule(&confirm_work, K_SECONDS(CONFIG_VINKEY_DFU_CONFIRM_DELAY_S));
+	}
+	return 0;
+}
+
+SYS_INIT(dfu_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#ifdef CONFIG_SHELL
+static int cmd_dfu_status(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "running image %s", boot_is_img_confirmed() ? "confirmed" : "under test");
+	if (upload.size > 0) {
+		shell_print(sh, "%s upload: %u of %u bytes in %u ms, %u KB/s",
+			    atomic_get(&upload.active) ? "running" : "last", upload.received,
+			    upload.size, upload.elapsed_ms, upload_kbps());
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(dfu_cmds,
+	SHELL_CMD(status, NULL, "Image state and upload rate", cmd_dfu_status),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(dfu, &dfu_cmds, "Firmware update", NULL);
+#endif
@@ -0,0 +1,306 @@
+/*
+ * Diagnostics over a vendor defined USB HID interface, so a deployed keyboard
+ * can be inspected without a debug probe. A low priority thread streams the
+ * frames described in vinkey_diag_proto.h: live matrix state, per-key chatter
+ * counts, transport queue and drop counters, a key to host latency
+ * histogram, the lifetime per-key statistics, the energy estimate and, when
+ * profiled, the expander I2C bus load. tools/vinkey-diag decodes them from hidraw.
+ *
+ * Chatter is a press of a key that follows its own release closer than
+ * CONFIG_VINKEY_DIAG_CHATTER_MS, faster than a finger can do it.
+ */
+
+#include <string.h>
+
+#include <zephyr/sys/byteorder.h>
+
+#include "main.h"
+#include "vinkey_diag_proto.h"
+
+LOG_MODULE_REGISTER(vinkey_diag, CONFIG_VINKEY_LOG_LEVEL);
+
+#define LATENCY_SHIFT (7)
+#define CHATTER_PER_FRAME (VINKEY_DIAG_PAYLOAD_MAX - 1)
+
+static const struct device *const diag_dev = DEVICE_DT_GET(DT_NODELABEL(hid_dev_1));
+
+/* One vendor defined 64 byte input report, no report ID */
+static const uint8_t diag_report_desc[] = {
+	HID_ITEM(HID_ITEM_TAG_USAGE_PAGE, HID_ITEM_TYPE_GLOBAL, 2), 0x00, 0xFF,
+	HID_USAGE(0x01),
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),
+		HID_USAGE(0x01),
+		HID_LOGICAL_MIN8(0),
+		HID_LOGICAL_MAX16(0xFF, 0x00),
+		HID_REPORT_SIZE(8),
+		HID_REPORT_COUNT(VINKEY_DIAG_FRAME_SIZE),
+		/* HID_INPUT(Data,Var,Abs) */
+		HID_INPUT(0x02),
+	HID_END_COLLECTION,
+};
+
+static volatile bool diag_ready;
+static uint8_t seq;
+
+static ATOMIC_DEFINE(matrix, VINKEY_MATRIX_KEYS);
+static atomic_t key_events;
+static uint8_t chatter[VINKEY_MATRIX_KEYS];
+static uint16_t latency[VINKEY_DIAG_LATENCY_BUCKETS];
+static uint64_t key_ns_total;
+static uint32_t key_ns_count;
+static uint32_t key_ns_max;
+
+void vinkey_diag_key(int key, bool pressed, int32_t gap_us)
+{
+	atomic_inc(&key_events);
+	atomic_set_bit_to(matrix, key, pressed);
+	if (gap_us >= 0 && chatter[key] < UINT8_MAX) {
+		chatter[key]++;
+	}
+}
+
+void vinkey_diag_latency(uint32_t us)
+{
+	int bucket = 0;
+
+	if (us >= BIT(LATENCY_SHIFT)) {
+		bucket = MIN(32 - __builtin_clz(us) - LATENCY_SHIFT,
+			     VINKEY_DIAG_LATENCY_BUCKETS - 1);
+	}
+	if (latency[bucket] < UINT16_MAX) {
+		latency[bucket]++;
+	}
+}
+
+void vinkey_diag_key_time(uint32_t ns)
+{
+	key_ns_total += ns;
+	key_ns_count++;
+	key_ns_max = MAX(key_ns_max, ns);
+}
+
+static int send_frame(uint8_t type, const uint8_t *payload, uint8_t len)
+{
+	uint8_t frame[VINKEY_DIAG_FRAME_SIZE] = {type, seq++, len};
+
+	memcpy(&frame[VINKEY_DIAG_HEADER_SIZE], payload, len);
+	/* Blocks until the host polls, only this thread waits for it */
+	return hid_device_submit_report(diag_dev, sizeof(frame), frame);
+}
+
+static int send_status(void)
+{
+	uint8_t payload[20];
+	uint32_t avg = key_ns_count ? key_ns_total / key_ns_count : 0;
+
+	sys_put_le32(k_uptime_get_32(), &payload[0]);
+	sys_put_le32(atomic_get(&key_events), &payload[4]);
+	sys_put_le32(vinkey_transport_boot_dropped(), &payload[8]);
+	sys_put_le32(avg, &payload[12]);
+	sys_put_le32(key_ns_max, &payload[16]);
+	return send_frame(VINKEY_DIAG_STATUS, payload, sizeof(payload));
+}
+
+#define MATRIX_HEADER_SIZE (1 + 2 * VINKEY_BANK_COUNT)
+
+static int send_matrix(void)
+{
+	uint8_t payload[MATRIX_HEADER_SIZE + DIV_ROUND_UP(VINKEY_MATRIX_KEYS, 8)] = {
+		VINKEY_BANK_COUNT,
+	};
+
+	BUILD_ASSERT(sizeof(payload) <= VINKEY_DIAG_PAYLOAD_MAX);
+	BUILD_ASSERT(VINKEY_BANK_COUNT <= VINKEY_DIAG_MATRIX_BANKS_MAX);
+
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		payload[1 + 2 * bank] = vinkey_banks[bank].rows;
+		payload[2 + 2 * bank] = vinkey_banks[bank].cols;
+	}
+	for (int key = 0; key < VINKEY_MATRIX_KEYS; key++) {
+		if (atomic_test_bit(matrix, key)) {
+			payload[MATRIX_HEADER_SIZE + key / 8] |= BIT(key % 8);
+		}
+	}
+	return send_frame(VINKEY_DIAG_MATRIX, payload, sizeof(payload));
+}
+
+static int send_transports(void)
+{
+	uint8_t index = 0;
+	int err = 0;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		uint8_t payload[1 + VINKEY_DIAG_TRANSPORT_NAME_LEN + 2 + 12] = {index++};
+
+		strncpy((char *)&payload[1], t->name, VINKEY_DIAG_TRANSPORT_NAME_LEN);
+		payload[9] = k_msgq_num_used_get(t->msgq);
+		payload[10] = t->stats->queue_peak;
+		sys_put_le32(t->stats->sent, &payload[11]);
+		sys_put_le32(t->stats->failed, &payload[15]);
+		sys_put_le32(t->stats->dropped, &payload[19]);
+		err = send_frame(VINKEY_DIAG_TRANSPORT, payload, sizeof(payload));
+		if (err) {
+			break;
+		}
+	}
+	return err;
+}
+
+static int send_chatter(void)
+{
+	for (int first = 0; first < VINKEY_MATRIX_KEYS; first += CHATTER_PER_FRAME) {
+		uint8_t count = MIN(CHATTER_PER_FRAME, VINKEY_MATRIX_KEYS - first);
+		uint8_t payload[VINKEY_DIAG_PAYLOAD_MAX] = {first};
+
+		memcpy(&payload[1], &chatter[first], count);
+
+		int err = send_frame(VINKEY_DIAG_CHATTER, payload, 1 + count);
+
+		if (err) {
+			return err;
+		}
+	}
+	return 0;
+}
+
+static int send_latency(void)
+{
+	uint8_t payload[2 + 2 * VINKEY_DIAG_LATENCY_BUCKETS] = {
+		LATENCY_SHIFT,
+		VINKEY_DIAG_LATENCY_BUCKETS,
+	};
+
+	for (int i = 0; i < VINKEY_DIAG_LATENCY_BUCKETS; i++) {
+		sys_put_le16(latency[i], &payload[2 + 2 * i]);
+	}
+	return send_frame(VINKEY_DIAG_LATENCY, payload, sizeof(payload));
+}
+
+static int send_i2c(void)
+{
+	struct vinkey_i2c_stats s;
+	uint8_t payload[24 + 2 + 2 * VINKEY_I2C_BUCKETS];
+
+	vinkey_i2c_stats_get(&s);
+	sys_put_le32(s.transfers, &payload[0]);
+	sys_put_le32(s.bytes, &payload[4]);
+	sys_put_le32(s.failures, &payload[8]);
+	sys_put_le32(s.recoveries, &payload[12]);
+	sys_put_le32(s.max_us, &payload[16]);
+	sys_put_le16(s.busy_permille, &payload[20]);
+	sys_put_le16(s.wire_permille, &payload[22]);
+	payload[24] = VINKEY_I2C_BUCKET_SHIFT;
+	payload[25] = VINKEY_I2C_BUCKETS;
+	for (int i = 0; i < VINKEY_I2C_BUCKETS; i++) {
+		sys_put_le16(s.buckets[i], &payload[26 + 2 * i]);
+	}
+	return send_frame(VINKEY_DIAG_I2C, payload, sizeof(payload));
+}
+
+/* A few keys per period, the counters change slowly */
+static int send_key_stats(void)
+{
+	static int first;
+	uint8_t count = MIN(VINKEY_DIAG_KEY_STATS_MAX, VINKEY_MATRIX_KEYS - first);
+	uint8_t payload[1 + VINKEY_DIAG_KEY_STATS_MAX * VINKEY_DIAG_KEY_STATS_SIZE] = {first};
+
+	for (int i = 0; i < count; i++) {
+		struct vinkey_key_stats ks;
+		uint8_t *p = &payload[1 + i * VINKEY_DIAG_KEY_STATS_SIZE];
+
+		vinkey_key_stats_get(first + i, &ks);
+		sys_put_le32(ks.presses, &p[0]);
+		sys_put_le16(MIN(ks.chatter, UINT16_MAX), &p[4]);
+		sys_put_le16(ks.chatter ? MIN(ks.gap_us / ks.chatter, UINT16_MAX) : 0, &p[6]);
+	}
+
+	int err = send_frame(VINKEY_DIAG_KEY_STATS, payload,
+			     1 + count * VINKEY_DIAG_KEY_STATS_SIZE);
+
+	if (err == 0) {
+		first = first + count < VINKEY_MATRIX_KEYS ? first + count : 0;
+	}
+	return err;
+}
+
+static int send_energy(void)
+{
+	uint8_t payload[1 + VINKEY_ENERGY_PARTS * VINKEY_DIAG_ENERGY_SIZE] = {VINKEY_ENERGY_PARTS};
+
+	BUILD_ASSERT(VINKEY_ENERGY_PARTS <= VINKEY_DIAG_ENERGY_MAX);
+
+	for (int part = 0; part < VINKEY_ENERGY_PARTS; part++) {
+		struct vinkey_energy e;
+		uint8_t *p = &payload[1 + part * VINKEY_DIAG_ENERGY_SIZE];
+
+		vinkey_energy_get(part, &e);
+		sys_put_le32(MIN(e.charge_nc / 1000, UINT32_MAX), &p[0]);
+		sys_put_le32(e.ua, &p[4]);
+	}
+	return send_frame(VINKEY_DIAG_ENERGY, payload, sizeof(payload));
+}
+
+static void diag_task(void *p1, void *p2, void *p3)
+{
+	while (true) {
+		k_sleep(K_MSEC(CONFIG_VINKEY_DIAG_PERIOD_MS));
+
+		/* Never the reason for a remote wakeup */
+		if (!diag_ready || vinkey_usb_suspended()) {
+			continue;
+		}
+
+		int err = send_status();
+
+		err = err ?: send_matrix();
+		err = err ?: send_transports();
+		err = err ?: send_chatter();
+		err = err ?: send_latency();
+		if (IS_ENABLED(CONFIG_VINKEY_I2C_PROFILER)) {
+			err = err ?: send_i2c();
+		}
+		if (IS_ENABLED(CONFIG_VINKEY_KEY_STATS)) {
+			err = err ?: send_key_stats();
+		}
+		if (IS_ENABLED(CONFIG_VINKEY_ENERGY)) {
+			err = err ?: send_energy();
+		}
+		if (err) {
+			LOG_DBG("Diagnostics frame not sent (err %d)", err);
+		}
+	}
+}
+
+K_THREAD_DEFINE(diag_tid, 1024, diag_task, NULL, NULL, NULL, 12, 0, 0);
+
+static void diag_iface_ready(const struct device *dev, const bool ready)
+{
+	diag_ready = ready;
+}
+
+static int diag_get_report(const struct device *dev,
+			   const uint8_t type, const uint8_t id, const uint16_t len,
+			   uint8_t *const buf)
+{
+	return -ENOTSUP;
+}
+
+static const struct hid_device_ops diag_ops = {
+	.iface_ready = diag_iface_ready,
+	.get_report = diag_get_report,
+};
+
+void vinkey_diag_init(void)
+{
+	if (!device_is_ready(diag_dev)) {
+		LOG_ERR("Diagnostics HID device is not ready");
+		return;
+	}
+
+	int err = hid_device_register(diag_dev, diag_report_desc,
+				      sizeof(diag_report_desc), &diag_ops);
+
+	if (err) {
+		LOG_ERR("Failed to register diagnostics HID device, %d", err);
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+ * Diagnostics frame format, shared with the host tool in tools/vinkey-diag.
+ *
+ * Every frame is one 64 byte input report of the vendor HID interface: a
+ * three byte header followed by a type specific payload, padded with zeros.
+ * Multi-byte fields are little endian. Nothing here depends on Zephyr.
+ */
+
+#include <stdint.h>
+
+#define VINKEY_DIAG_FRAME_SIZE  (64)
+#define VINKEY_DIAG_HEADER_SIZE (3)
+#define VINKEY_DIAG_PAYLOAD_MAX (VINKEY_DIAG_FRAME_SIZE - VINKEY_DIAG_HEADER_SIZE)
+
+enum vinkey_diag_type {
+	/*
+	 * u32 uptime ms, u32 key events, u32 reports dropped during boot,
+	 * u32 average and u32 maximum time in ns a matrix scan thread spends on
+	 * a key event, taken with the timing API (a TIMER on nRF), so it is wall
+	 * time and includes preemption by higher priority threads
+	 */
+	VINKEY_DIAG_STATUS = 1,
+	/*
+	 * u8 bank count, u8 rows and u8 cols per bank, bitmap of pressed keys,
+	 * LSB first. Keys of a bank are row * cols + col, bank after bank.
+	 */
+	VINKEY_DIAG_MATRIX = 2,
+	/*
+	 * u8 index, char name[8], u8 queue used, u8 queue peak,
+	 * u32 sent, u32 failed, u32 dropped
+	 */
+	VINKEY_DIAG_TRANSPORT = 3,
+	/* u8 first key, u8 chatter count per key from there on, saturating */
+	VINKEY_DIAG_CHATTER = 4,
+	/*
+	 * u8 shift, u8 bucket count, u16 counts, saturating. Bucket 0 counts
+	 * latencies below 1 << shift us, bucket n the ones below 1 << (shift + n),
+	 * the last bucket everything above.
+	 */
+	VINKEY_DIAG_LATENCY = 5,
+	/*
+	 * Matrix expander I2C profiler: u32 transactions, u32 bytes, u32 failed
+	 * transactions (NACKs and bus errors, the TWIM driver does not tell them
+	 * apart), u32 bus recoveries, u32 longest transaction us, u16 busy and u16 on the
+	 * wire utilization of the last second in 0.1 %, then a duration
+	 * histogram laid out like VINKEY_DIAG_LATENCY. Only sent with the
+	 * profiler built in.
+	 */
+	VINKEY_DIAG_I2C = 6,
+	/*
+	 * Lifetime key statistics: u8 first key, then per key u32 presses,
+	 * u16 chatter events (saturating) and u16 average release to press gap
+	 * of the chatter in us. One frame per period, the next frame continues
+	 * after the last key.
+	 */
+	VINKEY_DIAG_KEY_STATS = 7,
+	/*
+	 * Energy estimate: u8 part count, then per part u32 charge since boot
+	 * in uC and u32 present current in uA. Parts are the matrix scan, CPU,
+	 * radio and then the power, USB, BLE and caps lock LEDs. Only sent with
+	 * energy accounting built in.
+	 */
+	VINKEY_DIAG_ENERGY = 8,
+};
+
+struct vinkey_diag_header {
+	uint8_t type;
+	/* Increments with every frame, gaps mean the host missed frames */
+	uint8_t seq;
+	/* Payload length */
+	uint8_t len;
+} __attribute__((packed));
+
+#define VINKEY_DIAG_MATRIX_BANKS_MAX   (4)
+#define VINKEY_DIAG_TRANSPORT_NAME_LEN (8)
+#define VINKEY_DIAG_LATENCY_BUCKETS    (16)
+#define VINKEY_DIAG_KEY_STATS_SIZE     (8)
+#define VINKEY_DIAG_KEY_STATS_MAX      ((VINKEY_DIAG_PAYLOAD_MAX - 1) / VINKEY_DIAG_KEY_STATS_SIZE)
+#define VINKEY_DIAG_ENERGY_SIZE        (8)
+#define VINKEY_DIAG_ENERGY_MAX         ((VINKEY_DIAG_PAYLOAD_MAX - 1) / VINKEY_DIAG_ENERGY_SIZE)
@@ -0,0 +1,237 @@
+/*
+ * Energy accounting. Every part that draws a known current reports it when
+ * its state changes: the matrix scan when it is suspended or resumed, every
+ * indicator LED at each pattern step, the radio when connections or
+ * advertising change, plus the airtime of every notification. The CPU is taken
+ * from the kernel's busy and idle cycle counters. Integrated over time this
+ * gives an estimate of the charge per part, against a current model of the
+ * board in the CONFIG_VINKEY_ENERGY_*_UA options.
+ *
+ * All times come from the kernel clock, so on native_sim the same numbers
+ * come out of a simulated run, see boards/native_sim.conf and
+ * tests/native_sim/energy_check.sh. The CPU part is the exception: native_sim
+ * runs code in zero simulated time, the busy cycles stay near 0 and the part
+ * comes out at about the idle current.
+ *
+ * The average over every period in which all hosts were suspended is kept
+ * and checked against the USB suspend budget. It is the sum of the modelled
+ * parts only, the D+ pull-up and the regulator are not in the model.
+ */
+
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_energy, CONFIG_VINKEY_LOG_LEVEL);
+
+static const char *const part_names[VINKEY_ENERGY_PARTS] = {
+	[VINKEY_ENERGY_SCAN] = "scan",
+	[VINKEY_ENERGY_CPU] = "cpu",
+	[VINKEY_ENERGY_RADIO] = "radio",
+	[VINKEY_ENERGY_LED + VINKEY_LED_PWR] = "led pwr",
+	[VINKEY_ENERGY_LED + VINKEY_LED_USB] = "led usb",
+	[VINKEY_ENERGY_LED + VINKEY_LED_BLE] = "led ble",
+	[VINKEY_ENERGY_LED + VINKEY_LED_CAPS] = "led caps",
+};
+
+static struct k_spinlock lock;
+/* The matrix is scanned from boot on */
+static uint32_t draw_ua[VINKEY_ENERGY_PARTS] = {
+	[VINKEY_ENERGY_SCAN] = CONFIG_VINKEY_ENERGY_SCAN_UA,
+};
+/* uA * ms, that is nC */
+static uint64_t charge_nc[VINKEY_ENERGY_PARTS];
+static int64_t since_ms[VINKEY_ENERGY_PARTS];
+
+static void integrate(enum vinkey_energy_part part, int64_t now)
+{
+	charge_nc[part] += (uint64_t)draw_ua[part] * (now - since_ms[part]);
+	since_ms[part] = now;
+}
+
+static void set_draw(enum vinkey_energy_part part, uint32_t ua)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	integrate(part, k_uptime_get());
+	draw_ua[part] = ua;
+	k_spin_unlock(&lock, key);
+}
+
+void vinkey_energy_scan(bool suspended)
+{
+	set_draw(VINKEY_ENERGY_SCAN, suspended ? CONFIG_VINKEY_ENERGY_SCAN_IDLE_UA
+					       : CONFIG_VINKEY_ENERGY_SCAN_UA);
+}
+
+void vinkey_energy_led(enum vinkey_led led, uint8_t level)
+{
+	/* PWM dimming draws in proportion to the duty cycle */
+	set_draw(VINKEY_ENERGY_LED + led, CONFIG_VINKEY_ENERGY_LED_UA * level / 100);
+}
+
+void vinkey_energy_radio_events(uint32_t conn_mhz, uint32_t adv_mhz)
+{
+	/* mHz * nC is pA */
+	uint64_t pa = (uint64_t)conn_mhz * CONFIG_VINKEY_ENERGY_CONN_EVENT_NC +
+		      (uint64_t)adv_mhz * CONFIG_VINKEY_ENERGY_ADV_EVENT_NC;
+
+	set_draw(VINKEY_ENERGY_RADIO, pa / 1000000);
+}
+
+void vinkey_energy_radio_airtime(uint32_t us)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	charge_nc[VINKEY_ENERGY_RADIO] += (uint64_t)us * CONFIG_VINKEY_ENERGY_RADIO_UA / 1000;
+	k_spin_unlock(&lock, key);
+}
+
+/* Busy time at the run current, the rest at the idle current */
+static void cpu_update(void)
+{
+	k_thread_runtime_stats_t stats;
+
+	k_thread_runtime_stats_all_get(&stats);
+
+	uint64_t busy_ms = vinkey_runtime_cycles_to_ns(stats.total_cycles) / NSEC_PER_MSEC;
+	uint64_t idle_ms = vinkey_runtime_cycles_to_ns(stats.idle_cycles) / NSEC_PER_MSEC;
+
+	charge_nc[VINKEY_ENERGY_CPU] = busy_ms * CONFIG_VINKEY_ENERGY_CPU_RUN_UA +
+				       idle_ms * CONFIG_VINKEY_ENERGY_CPU_IDLE_UA;
+	/* Average since boot, there is no instant CPU current */
+	draw_ua[VINKEY_ENERGY_CPU] = charge_nc[VINKEY_ENERGY_CPU] / MAX(busy_ms + idle_ms, 1);
+}
+
+void vinkey_energy_get(enum vinkey_energy_part part, struct vinkey_energy *out)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	if (part == VINKEY_ENERGY_CPU) {
+		cpu_update();
+	} else {
+		integrate(part, k_uptime_get());
+	}
+	out->charge_nc = charge_nc[part];
+	out->ua = draw_ua[part];
+	k_spin_unlock(&lock, key);
+}
+
+static struct {
+	int64_t start_ms;
+	uint64_t start_nc;
+	/* Average of the last completed suspend */
+	uint32_t ua;
+	uint32_t s;
+} suspend_record;
+
+static uint64_t total_charge(void)
+{
+	uint64_t nc = 0;
+
+	for (int part = 0; part < VINKEY_ENERGY_PARTS; part++) {
+		struct vinkey_energy e;
+
+		vinkey_energy_get(part, &e);
+		nc += e.charge_nc;
+	}
+	return nc;
+}
+
+void vinkey_energy_suspend(bool suspended)
+{
+	uint64_t nc = total_charge();
+	int64_t now = k_uptime_get();
+
+	if (suspended) {
+		suspend_record.start_ms = now;
+		suspend_record.start_nc = nc;
+		return;
+	}
+
+	int64_t ms = now - suspend_record.start_ms;
+
+	if (suspend_record.start_ms == 0 || ms <= 0) {
+		return;
+	}
+	suspend_record.ua = (nc - suspend_record.start_nc) / ms;
+	suspend_record.s = ms / MSEC_PER_SEC;
+	if (suspend_record.ua > CONFIG_VINKEY_ENERGY_SUSPEND_BUDGET_UA) {
+		LOG_WRN("Suspended %u s at an estimated %u uA, over the %d uA budget",
+			suspend_record.s, suspend_record.ua, CONFIG_VINKEY_ENERGY_SUSPEND_BUDGET_UA);
+	} else {
+		LOG_INF("Suspended %u s at an estimated %u uA", suspend_record.s,
+			suspend_record.ua);
+	}
+}
+
+static void print_parts(void (*print)(void *ctx, const char *name, uint64_t nc, uint32_t ua),
+			void *ctx)
+{
+	uint64_t total_nc = 0;
+	uint32_t total_ua = 0;
+
+	for (int part = 0; part < VINKEY_ENERGY_PARTS; part++) {
+		struct vinkey_energy e;
+
+		vinkey_energy_get(part, &e);
+		print(ctx, part_names[part], e.charge_nc, e.ua);
+		total_nc += e.charge_nc;
+		total_ua += e.ua;
+	}
+	print(ctx, "total", total_nc, total_ua);
+}
+
+/* 1 uAh is 3.6e6 nC, printed as mAh with three decimals */
+#define NC_PER_UAH (3600000ULL)
+
+#if CONFIG_VINKEY_ENERGY_LOG_S > 0
+static void log_part(void *ctx, const char *name, uint64_t nc, uint32_t ua)
+{
+	uint32_t uah = nc / NC_PER_UAH;
+
+	LOG_INF("%-8s %u.%03u mAh, %u uA", name, uah / 1000, uah % 1000, ua);
+}
+
+static void log_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(log_work, log_work_handler);
+
+static void log_work_handler(struct k_work *work)
+{
+	LOG_INF("Energy after %lld s", k_uptime_get() / MSEC_PER_SEC);
+	print_parts(log_part, NULL);
+	k_work_schedule(&log_work, K_SECONDS(CONFIG_VINKEY_ENERGY_LOG_S));
+}
+
+static int energy_log_init(void)
+{
+	k_work_schedule(&log_work, K_SECONDS(CONFIG_VINKEY_ENERGY_LOG_S));
+	return 0;
+}
+
+SYS_INIT(energy_log_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#endif
+
+#ifdef CONFIG_SHELL
+static void shell_part(void *ctx, const char *name, uint64_t nc, uint32_t ua)
+{
+	uint32_t uah = nc / NC_PER_UAH;
+
+	shell_print((const struct shell *)ctx, "%-8s %6u.%03u mAh %7u uA", name, uah / 1000, uah % 1000, ua);
+}
+
+static int cmd_energy(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "estimated over %lld s", k_uptime_get() / MSEC_PER_SEC);
+	print_parts(shell_part, (void *)sh);
+	if (suspend_record.s > 0) {
+		shell_print(sh, "last suspend: %u s at %u uA, budget %d uA", suspend_record.s,
+			    suspend_record.ua, CONFIG_VINKEY_ENERGY_SUSPEND_BUDGET_UA);
+	}
+	return 0;
+}
+
+SHELL_CMD_REGISTER(energy, NULL, "Estimated charge and present current per part", cmd_energy);
+#endif
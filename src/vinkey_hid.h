@@ -0,0 +1,229 @@
+#pragma once
+
+/*
+ * HID report layout shared by the USB and BLE transports. Every report carries
+ * a report ID; USB sends it in-band, HIDS maps it to a Report Reference.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/util_macro.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/usb/class/hid.h>
+
+enum vinkey_report_id {
+	VINKEY_REPORT_ID_KEYBOARD = 1,
+	VINKEY_REPORT_ID_CONSUMER = 2,
+	VINKEY_REPORT_ID_SYSTEM = 3,
+	/* USB only, BLE hosts read the Battery Service */
+	VINKEY_REPORT_ID_BATTERY = 4,
+};
+
+#define HID_USAGE_CONSUMER                (0x0C)
+#define HID_USAGE_CONSUMER_CONTROL        (0x01)
+#define HID_USAGE_GEN_DESKTOP_SYSTEM_CTRL (0x80)
+#define HID_USAGE_GEN_DEVICE_CONTROLS     (0x06)
+#define HID_USAGE_BATTERY_STRENGTH        (0x20)
+
+/* Consumer page usages reachable from the blue ALT layer */
+#define HID_CONSUMER_BRIGHTNESS_UP   (0x006F)
+#define HID_CONSUMER_BRIGHTNESS_DOWN (0x0070)
+#define HID_CONSUMER_PLAY_PAUSE      (0x00CD)
+#define HID_CONSUMER_MUTE            (0x00E2)
+#define HID_CONSUMER_VOLUME_UP       (0x00E9)
+#define HID_CONSUMER_VOLUME_DOWN     (0x00EA)
+
+/* System control array indices, 1 maps to System Power Down (0x81) */
+#define HID_SYSTEM_POWER_DOWN (1)
+#define HID_SYSTEM_SLEEP      (2)
+#define HID_SYSTEM_WAKE_UP    (3)
+
+#define KEYS_PER_REPORT (6)
+
+struct kb_report {
+	uint8_t modifier;
+	uint8_t reserved;
+	uint8_t keys[KEYS_PER_REPORT];
+} __packed;
+
+struct consumer_report {
+	uint16_t usage;
+} __packed;
+
+struct system_report {
+	uint8_t control;
+} __packed;
+
+struct battery_report {
+	/* Percent */
+	uint8_t level;
+} __packed;
+
+struct vinkey_report {
+	uint8_t id;
+	union {
+		struct kb_report kb;
+		struct consumer_report consumer;
+		struct system_report system;
+		struct battery_report battery;
+	};
+} __packed;
+
+/* Payload length of a report, without the report ID */
+static inline uint16_t vinkey_report_len(uint8_t id)
+{
+	switch (id) {
+	case VINKEY_REPORT_ID_KEYBOARD:
+		return sizeof(struct kb_report);
+	case VINKEY_REPORT_ID_CONSUMER:
+		return sizeof(struct consumer_report);
+	case VINKEY_REPORT_ID_SYSTEM:
+		return sizeof(struct system_report);
+	case VINKEY_REPORT_ID_BATTERY:
+		return sizeof(struct battery_report);
+	default:
+		return 0;
+	}
+}
+
+/* Payload of a report, without the report ID */
+static inline const void *vinkey_report_data(const struct vinkey_report *r)
+{
+	switch (r->id) {
+	case VINKEY_REPORT_ID_CONSUMER:
+		return &r->consumer;
+	case VINKEY_REPORT_ID_SYSTEM:
+		return &r->system;
+	case VINKEY_REPORT_ID_BATTERY:
+		return &r->battery;
+	default:
+		return &r->kb;
+	}
+}
+
+/* True when the report has nothing pressed */
+static inline bool vinkey_report_is_empty(const struct vinkey_report *r)
+{
+	switch (r->id) {
+	case VINKEY_REPORT_ID_KEYBOARD:
+		if (r->kb.modifier != 0) {
+			return false;
+		}
+		for (int i = 0; i < KEYS_PER_REPORT; i++) {
+			if (r->kb.keys[i] != 0) {
+				return false;
+			}
+		}
+		return true;
+	case VINKEY_REPORT_ID_CONSUMER:
+		return r->consumer.usage == 0;
+	case VINKEY_REPORT_ID_SYSTEM:
+		return r->system.control == 0;
+	default:
+		return true;
+	}
+}
+
+/* Boot compatible keyboard collection, same layout as HID_KEYBOARD_REPORT_DESC() */
+#define VINKEY_HID_KEYBOARD_DESC					\
+	HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP),				\
+	HID_USAGE(HID_USAGE_GEN_DESKTOP_KEYBOARD),			\
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),			\
+		HID_REPORT_ID(VINKEY_REPORT_ID_KEYBOARD),		\
+		HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP_KEYPAD),		\
+		HID_USAGE_MIN8(0xE0),					\
+		HID_USAGE_MAX8(0xE7),					\
+		HID_LOGICAL_MIN8(0),					\
+		HID_LOGICAL_MAX8(1),					\
+		HID_REPORT_SIZE(1),					\
+		HID_REPORT_COUNT(8),					\
+		/* HID_INPUT(Data,Var,Abs) */				\
+		HID_INPUT(0x02),					\
+		HID_REPORT_SIZE(8),					\
+		HID_REPORT_COUNT(1),					\
+		/* HID_INPUT(Cnst,Var,Abs) */				\
+		HID_INPUT(0x03),					\
+		HID_REPORT_SIZE(1),					\
+		HID_REPORT_COUNT(5),					\
+		HID_USAGE_PAGE(HID_USAGE_GEN_LEDS),			\
+		HID_USAGE_MIN8(1),					\
+		HID_USAGE_MAX8(5),					\
+		/* HID_OUTPUT(Data,Var,Abs) */				\
+		HID_OUTPUT(0x02),					\
+		HID_REPORT_SIZE(3),					\
+		HID_REPORT_COUNT(1),					\
+		/* HID_OUTPUT(Cnst,Var,Abs) */				\
+		HID_OUTPUT(0x03),					\
+		HID_REPORT_SIZE(8),					\
+		HID_REPORT_COUNT(KEYS_PER_REPORT),			\
+		HID_LOGICAL_MIN8(0),					\
+		HID_LOGICAL_MAX8(101),					\
+		HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP_KEYPAD),		\
+		HID_USAGE_MIN8(0),					\
+		HID_USAGE_MAX8(101),					\
+		/* HID_INPUT(Data,Arr,Abs) */				\
+		HID_INPUT(0x00),					\
+	HID_END_COLLECTION
+
+/* One 16 bit consumer usage at a time, 0 means nothing pressed */
+#define VINKEY_HID_CONSUMER_DESC					\
+	HID_USAGE_PAGE(HID_USAGE_CONSUMER),				\
+	HID_USAGE(HID_USAGE_CONSUMER_CONTROL),				\
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),			\
+		HID_REPORT_ID(VINKEY_REPORT_ID_CONSUMER),		\
+		HID_LOGICAL_MIN8(0),					\
+		HID_LOGICAL_MAX16(0xFF, 0x03),				\
+		HID_USAGE_MIN8(0),					\
+		HID_USAGE_MAX16(0xFF, 0x03),				\
+		HID_REPORT_SIZE(16),					\
+		HID_REPORT_COUNT(1),					\
+		/* HID_INPUT(Data,Arr,Abs) */				\
+		HID_INPUT(0x00),					\
+	HID_END_COLLECTION
+
+/* System Power Down, Sleep and Wake Up as a 1..3 array, 0 is out of range */
+#define VINKEY_HID_SYSTEM_DESC						\
+	HID_USAGE_PAGE(HID_USAGE_GEN_DESKTOP),				\
+	HID_USAGE(HID_USAGE_GEN_DESKTOP_SYSTEM_CTRL),			\
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),			\
+		HID_REPORT_ID(VINKEY_REPORT_ID_SYSTEM),			\
+		HID_LOGICAL_MIN8(1),					\
+		HID_LOGICAL_MAX8(3),					\
+		HID_USAGE_MIN8(0x81),					\
+		HID_USAGE_MAX8(0x83),					\
+		HID_REPORT_SIZE(8),					\
+		HID_REPORT_COUNT(1),					\
+		/* HID_INPUT(Data,Arr,Abs,Null) */			\
+		HID_INPUT(0x40),					\
+	HID_END_COLLECTION
+
+/* Battery Strength in percent, picked up by the host's power supply class */
+#define VINKEY_HID_BATTERY_DESC						\
+	HID_USAGE_PAGE(HID_USAGE_GEN_DEVICE_CONTROLS),			\
+	HID_USAGE(HID_USAGE_BATTERY_STRENGTH),				\
+	HID_COLLECTION(HID_COLLECTION_APPLICATION),			\
+		HID_REPORT_ID(VINKEY_REPORT_ID_BATTERY),		\
+		HID_LOGICAL_MIN8(0),					\
+		HID_LOGICAL_MAX8(100),					\
+		HID_USAGE(HID_USAGE_BATTERY_STRENGTH),			\
+		HID_REPORT_SIZE(8),					\
+		HID_REPORT_COUNT(1),					\
+		/* HID_INPUT(Data,Var,Abs) */				\
+		HID_INPUT(0x02),					\
+	HID_END_COLLECTION
+
+#define VINKEY_HID_REPORT_MAP()						\
+{									\
+	VINKEY_HID_KEYBOARD_DESC,					\
+	VINKEY_HID_CONSUMER_DESC,					\
+	VINKEY_HID_SYSTEM_DESC,						\
+}
+
+/* The USB map adds the battery, the BLE map leaves it to BAS */
+#define VINKEY_HID_USB_REPORT_MAP()					\
+{									\
+	VINKEY_HID_KEYBOARD_DESC,					\
+	VINKEY_HID_CONSUMER_DESC,					\
+	VINKEY_HID_SYSTEM_DESC,						\
+	IF_ENABLED(CONFIG_VINKEY_BATTERY, (VINKEY_HID_BATTERY_DESC,))	\
+}
@@ -0,0 +1,198 @@
+/*
+ * I2C profiler. A pass-through controller (vinkey,i2c-profiler) in front of
+ * the real one: every transaction of the devices placed under it is counted
+ * and timed before it goes on to the parent bus. Once a second the busy time
+ * is turned into a bus utilization, both as seen by the callers (driver and
+ * interrupt overhead included) and on the wire, computed from the bytes moved
+ * at the bus clock. The difference is what a faster clock can not win back.
+ *
+ * The nRF TWIM driver returns -EIO for every failure, address or data NACK,
+ * bus error or timeout alike, so failed transactions are counted as one
+ * figure. Bus recoveries requested through the profiler are counted apart,
+ * they tell a hung bus from a device that does not answer.
+ */
+
+#define DT_DRV_COMPAT vinkey_i2c_profiler
+
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_i2c_profiler, CONFIG_VINKEY_LOG_LEVEL);
+
+#define PARENT_NODE DT_INST_PHANDLE(0, i2c_bus)
+#define BUS_HZ      DT_PROP(PARENT_NODE, clock_frequency)
+
+BUILD_ASSERT(DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT) == 1,
+	     "One profiled bus is supported");
+
+static const struct device *const parent = DEVICE_DT_GET(PARENT_NODE);
+
+static struct k_spinlock lock;
+static struct vinkey_i2c_stats totals;
+static uint64_t busy_us;
+static uint64_t wire_bits;
+static struct vinkey_i2c_stats window_stats;
+
+static void window_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(window_work, window_handler);
+
+static void window_handler(struct k_work *work)
+{
+	static uint64_t last_busy_us;
+	static uint64_t last_wire_bits;
+	static int64_t last_ms;
+
+	int64_t now_ms = k_uptime_get();
+	k_spinlock_key_t key = k_spin_lock(&lock);
+	uint64_t busy = busy_us - last_busy_us;
+	uint64_t bits = wire_bits - last_wire_bits;
+
+	last_busy_us = busy_us;
+	last_wire_bits = wire_bits;
+	k_spin_unlock(&lock, key);
+
+	uint64_t window_us = MAX((now_ms - last_ms) * 1000, 1);
+
+	last_ms = now_ms;
+	window_stats.busy_permille = MIN(busy * 1000 / window_us, 1000);
+	window_stats.wire_permille = MIN(bits * 1000000000ULL / BUS_HZ / window_us, 1000);
+	k_work_reschedule(&window_work, K_SECONDS(1));
+}
+
+static void account(const struct i2c_msg *msgs, uint8_t num_msgs, int err, uint32_t us)
+{
+	uint32_t bytes = 0;
+	/* Start or repeated start plus address byte for every direction change */
+	uint32_t frames = 0;
+
+	for (uint8_t i = 0; i < num_msgs; i++) {
+		bytes += msgs[i].len;
+		if (i == 0 || (msgs[i].flags & I2C_MSG_RESTART) ||
+		    ((msgs[i].flags ^ msgs[i - 1].flags) & I2C_MSG_RW_MASK)) {
+			frames++;
+		}
+	}
+
+	int bucket = 0;
+
+	if (us >= BIT(VINKEY_I2C_BUCKET_SHIFT)) {
+		bucket = MIN(32 - __builtin_clz(us) - VINKEY_I2C_BUCKET_SHIFT,
+			     VINKEY_I2C_BUCKETS - 1);
+	}
+
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	totals.transfers++;
+	totals.bytes += bytes;
+	if (err) {
+		totals.failures++;
+	}
+	if (totals.buckets[bucket] < UINT16_MAX) {
+		totals.buckets[bucket]++;
+	}
+	totals.max_us = MAX(totals.max_us, us);
+	busy_us += us;
+	/* Nine clocks per byte with its ACK, a start and a stop bit per frame */
+	wire_bits += (bytes + frames) * 9 + frames * 2;
+	k_spin_unlock(&lock, key);
+}
+
+static int profiler_configure(const struct device *dev, uint32_t dev_config)
+{
+	return i2c_configure(parent, dev_config);
+}
+
+static int profiler_get_config(const struct device *dev, uint32_t *dev_config)
+{
+	return i2c_get_config(parent, dev_config);
+}
+
+static int profiler_transfer(const struct device *dev, struct i2c_msg *msgs,
+			     uint8_t num_msgs, uint16_t addr)
+{
+	vinkey_stamp_t start = vinkey_stamp();
+	int err = i2c_transfer(parent, msgs, num_msgs, addr);
+
+	account(msgs, num_msgs, err, vinkey_stamp_us(start));
+	return err;
+}
+
+static int profiler_recover_bus(const struct device *dev)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	totals.recoveries++;
+	k_spin_unlock(&lock, key);
+	return i2c_recover_bus(parent);
+}
+
+static DEVICE_API(i2c, profiler_api) = {
+	.configure = profiler_configure,
+	.get_config = profiler_get_config,
+	.transfer = profiler_transfer,
+	.recover_bus = profiler_recover_bus,
+};
+
+static int profiler_init(const struct device *dev)
+{
+	if (!device_is_ready(parent)) {
+		return -ENODEV;
+	}
+	k_work_reschedule(&window_work, K_SECONDS(1));
+	return 0;
+}
+
+DEVICE_DT_INST_DEFINE(0, profiler_init, NULL, NULL, NULL, POST_KERNEL,
+		      CONFIG_VINKEY_I2C_PROFILER_INIT_PRIORITY, &profiler_api);
+
+void vinkey_i2c_stats_get(struct vinkey_i2c_stats *stats)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	*stats = totals;
+	k_spin_unlock(&lock, key);
+	stats->busy_permille = window_stats.busy_permille;
+	stats->wire_permille = window_stats.wire_permille;
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_i2c_stats(const struct shell *sh, size_t argc, char **argv)
+{
+	struct vinkey_i2c_stats s;
+
+	vinkey_i2c_stats_get(&s);
+	shell_print(sh, "%s at %u Hz: %u transfers, %u bytes, %u failed, %u bus recoveries",
+		    parent->name, BUS_HZ, s.transfers, s.bytes, s.failures, s.recoveries);
+	shell_print(sh, "utilization last second: %u.%u%% busy, %u.%u%% on the wire",
+		    s.busy_permille / 10, s.busy_permille % 10,
+		    s.wire_permille / 10, s.wire_permille % 10);
+	for (int i = 0; i < VINKEY_I2C_BUCKETS; i++) {
+		if (i < VINKEY_I2C_BUCKETS - 1) {
+			shell_print(sh, "  < %5lu us: %u", BIT(VINKEY_I2C_BUCKET_SHIFT + i), s.buckets[i]);
+		} else {
+			shell_print(sh, "  longer  : %u (max %u us)", s.buckets[i], s.max_us);
+		}
+	}
+	return 0;
+}
+
+static int cmd_i2c_reset(const struct shell *sh, size_t argc, char **argv)
+{
+	k_spinlock_key_t key = k_spin_lock(&lock);
+
+	totals = (struct vinkey_i2c_stats){0};
+	k_spin_unlock(&lock, key);
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(i2c_prof_cmds,
+	SHELL_CMD(stats, NULL, "Transaction counters, durations and utilization", cmd_i2c_stats),
+	SHELL_CMD(reset, NULL, "Clear the counters", cmd_i2c_reset),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(i2cprof, &i2c_prof_cmds, "Matrix expander I2C profiler", NULL);
+#endif
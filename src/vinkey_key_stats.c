@@ -0,0 +1,240 @@
+/*
+ * Per-key wear statistics: presses, chatter events and the average chatter
+ * gap of every matrix position, kept across reboots so worn switches show up
+ * before they fail. main.c tells chatter from a press; its gap runs from the
+ * key's release to the next press, so it grows with both contact bounce and
+ * the debounce time and only compares keys with each other.
+ *
+ * Counting is a few stores per key event. The counters go to settings in
+ * chunks of CHUNK_KEYS keys, only the chunks that changed, at most once per
+ * CONFIG_VINKEY_KEY_STATS_FLUSH_S and only after the keyboard went idle, so
+ * flash writes neither wear the NVS sectors down nor stall typing. A chunk is
+ * copied under the lock and written from the copy.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_key_stats, CONFIG_VINKEY_LOG_LEVEL);
+
+#define CHUNK_KEYS  (16)
+#define CHUNK_COUNT DIV_ROUND_UP(VINKEY_MATRIX_KEYS, CHUNK_KEYS)
+/* Typing pause a flush waits for */
+#define IDLE_MS     (2000)
+
+/* Between the key thread, the system work queue and the shell */
+static struct k_spinlock lock;
+static struct vinkey_key_stats stats[VINKEY_MATRIX_KEYS];
+static ATOMIC_DEFINE(dirty, CHUNK_COUNT);
+static atomic_t flush_pending;
+static int64_t last_event_ms;
+
+static struct {
+	uint32_t flushes;
+	uint32_t chunks;
+	uint32_t bytes;
+} writes;
+
+static void flush_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(flush_work, flush_handler);
+
+void vinkey_key_stats_event(int key, bool pressed, int32_t gap_us)
+{
+	if (!pressed) {
+		return;
+	}
+
+	k_spinlock_key_t k = k_spin_lock(&lock);
+	struct vinkey_key_stats *s = &stats[key];
+
+	s->presses++;
+	if (gap_us >= 0) {
+		s->chatter++;
+		s->gap_us += gap_us;
+	}
+	k_spin_unlock(&lock, k);
+	atomic_set_bit(dirty, key / CHUNK_KEYS);
+	last_event_ms = k_uptime_get();
+	if (atomic_cas(&flush_pending, 0, 1)) {
+		k_work_schedule(&flush_work, K_SECONDS(CONFIG_VINKEY_KEY_STATS_FLUSH_S));
+	}
+}
+
+static int save_chunk(int chunk)
+{
+	char name[sizeof("vinkey/keys/") + 3];
+	struct vinkey_key_stats copy[CHUNK_KEYS];
+	int first = chunk * CHUNK_KEYS;
+	size_t len = MIN(CHUNK_KEYS, VINKEY_MATRIX_KEYS - first) * sizeof(stats[0]);
+	k_spinlock_key_t k = k_spin_lock(&lock);
+
+	memcpy(copy, &stats[first], len);
+	k_spin_unlock(&lock, k);
+	snprintk(name, sizeof(name), "vinkey/keys/%d", chunk);
+
+	int err = settings_save_one(name, copy, len);
+
+	if (err == 0) {
+		writes.chunks++;
+		writes.bytes += len;
+	}
+	return err;
+}
+
+static void flush(void)
+{
+	atomic_set(&flush_pending, 0);
+	writes.flushes++;
+	for (int chunk = 0; chunk < CHUNK_COUNT; chunk++) {
+		if (!atomic_test_and_clear_bit(dirty, chunk)) {
+			continue;
+		}
+
+		int err = save_chunk(chunk);
+
+		if (err) {
+			LOG_WRN("Key statistics chunk %d not saved (err %d)", chunk, err);
+			atomic_set_bit(dirty, chunk);
+		}
+	}
+}
+
+static void flush_handler(struct k_work *work)
+{
+	int64_t idle = k_uptime_get() - last_event_ms;
+
+	if (idle < IDLE_MS) {
+		k_work_schedule(&flush_work, K_MSEC(IDLE_MS - idle));
+		return;
+	}
+	flush();
+	/* Chunks that failed get another try next period */
+	for (int chunk = 0; chunk < CHUNK_COUNT; chunk++) {
+		if (!atomic_test_bit(dirty, chunk)) {
+			continue;
+		}
+		if (atomic_cas(&flush_pending, 0, 1)) {
+			k_work_schedule(&flush_work, K_SECONDS(CONFIG_VINKEY_KEY_STATS_FLUSH_S));
+		}
+		break;
+	}
+}
+
+void vinkey_key_stats_get(int key, struct vinkey_key_stats *out)
+{
+	k_spinlock_key_t k = k_spin_lock(&lock);
+
+	*out = stats[key];
+	k_spin_unlock(&lock, k);
+}
+
+static int key_stats_set(const char *key, size_t len, settings_read_cb read_cb, void *cb_arg)
+{
+	struct vinkey_key_stats loaded[CHUNK_KEYS];
+	const char *next;
+
+	if (key == NULL || settings_name_next(key, &next) == 0 || next != NULL) {
+		return -ENOENT;
+	}
+
+	int chunk = strtol(key, NULL, 10);
+
+	if (chunk < 0 || chunk >= CHUNK_COUNT) {
+		return -ENOENT;
+	}
+
+	int first = chunk * CHUNK_KEYS;
+	/* Fewer keys when the matrix grew or shrank since */
+	int count = MIN(len, sizeof(loaded)) / sizeof(loaded[0]);
+	ssize_t rc = read_cb(cb_arg, loaded, count * sizeof(loaded[0]));
+
+	if (rc < 0) {
+		return rc;
+	}
+	count = MIN(rc / sizeof(loaded[0]), VINKEY_MATRIX_KEYS - first);
+
+	k_spinlock_key_t k = k_spin_lock(&lock);
+
+	/* Keys typed before the settings were loaded are added on top */
+	for (int i = 0; i < count; i++) {
+		stats[first + i].presses += loaded[i].presses;
+		stats[first + i].chatter += loaded[i].chatter;
+		stats[first + i].gap_us += loaded[i].gap_us;
+	}
+	k_spin_unlock(&lock, k);
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vinkey_keys, "vinkey/keys", NULL,
+			       key_stats_set, NULL, NULL);
+
+#ifdef CONFIG_SHELL
+static int cmd_keys_top(const struct shell *sh, size_t argc, char **argv)
+{
+	static struct vinkey_key_stats copy[VINKEY_MATRIX_KEYS];
+	static bool shown[VINKEY_MATRIX_KEYS];
+	int n = argc > 1 ? strtol(argv[1], NULL, 10) : 10;
+	k_spinlock_key_t k = k_spin_lock(&lock);
+
+	memcpy(copy, stats, sizeof(copy));
+	k_spin_unlock(&lock, k);
+	memset(shown, 0, sizeof(shown));
+	for (int i = 0; i < n; i++) {
+		int top = -1;
+
+		for (int key = 0; key < VINKEY_MATRIX_KEYS; key++) {
+			if (!shown[key] && (top < 0 || copy[key].presses > copy[top].presses)) {
+				top = key;
+			}
+		}
+		if (top < 0 || copy[top].presses == 0) {
+			break;
+		}
+		shown[top] = true;
+
+		uint32_t code = vinkey_key_code(top);
+
+		shell_print(sh, "bank %u row %u col %u: %u presses, %u chatter, %u us chatter gap",
+			    VINKEY_KEY_BANK(code), VINKEY_KEY_ROW(code), VINKEY_KEY_COL(code),
+			    copy[top].presses, copy[top].chatter,
+			    copy[top].chatter ? copy[top].gap_us / copy[top].chatter : 0);
+	}
+	shell_print(sh, "%u flushes, %u chunks, %u bytes written", writes.flushes,
+		    writes.chunks, writes.bytes);
+	return 0;
+}
+
+static int cmd_keys_flush(const struct shell *sh, size_t argc, char **argv)
+{
+	k_work_cancel_delayable(&flush_work);
+	flush();
+	return 0;
+}
+
+static int cmd_keys_clear(const struct shell *sh, size_t argc, char **argv)
+{
+	k_spinlock_key_t k = k_spin_lock(&lock);
+
+	memset(stats, 0, sizeof(stats));
+	k_spin_unlock(&lock, k);
+	for (int chunk = 0; chunk < CHUNK_COUNT; chunk++) {
+		atomic_set_bit(dirty, chunk);
+	}
+	return cmd_keys_flush(sh, argc, argv);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(keys_cmds,
+	SHELL_CMD_ARG(top, NULL, "[n] Most pressed keys", cmd_keys_top, 1, 1),
+	SHELL_CMD(flush, NULL, "Save the counters now", cmd_keys_flush),
+	SHELL_CMD(clear, NULL, "Reset the counters, after replacing switches", cmd_keys_clear),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(keys, &keys_cmds, "Per-key wear statistics", NULL);
+#endif
@@ -0,0 +1,215 @@
+/*
+ * LED indicator engine. Callers only raise or clear indicators; every LED
+ * shows the pattern of the highest priority indicator that uses it. Patterns
+ * are played from a kernel timer that fires only at the next step change, so
+ * nothing busy-waits and the CPU sleeps in between. The timer runs in
+ * interrupt context, so fault patterns keep playing even when the thread that
+ * reported the fault never comes back.
+ *
+ * LEDs are driven through the LED API: gpio-leds only switch on and off, a
+ * board that describes its LEDs as pwm-leds gets real dimming.
+ */
+
+#include <stdlib.h>
+
+#include <zephyr/drivers/led.h>
+
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+struct led_step {
+	/* Percent of the global brightness */
+	uint8_t level;
+	uint16_t ms;
+};
+
+struct led_pattern {
+	const struct led_step *steps;
+	uint8_t count;
+};
+
+#define LED_PATTERN(...)							\
+	{									\
+		.steps = (const struct led_step[]){__VA_ARGS__},		\
+		.count = sizeof((struct led_step[]){__VA_ARGS__}) /		\
+			 sizeof(struct led_step),				\
+	}
+
+#define LED_SPEC(alias)								\
+	{									\
+		.dev = DEVICE_DT_GET(DT_PARENT(DT_ALIAS(alias))),		\
+		.index = DT_NODE_CHILD_IDX(DT_ALIAS(alias)),			\
+	}
+
+struct led_spec {
+	const struct device *dev;
+	uint32_t index;
+};
+
+static const struct led_spec leds[VINKEY_LED_COUNT] = {
+	[VINKEY_LED_PWR] = LED_SPEC(pwr_on_led),
+	[VINKEY_LED_USB] = LED_SPEC(usb_connected_led),
+	[VINKEY_LED_BLE] = LED_SPEC(ble_connected_led),
+	[VINKEY_LED_CAPS] = LED_SPEC(caps_lock_led),
+};
+
+static const struct led_pattern off = LED_PATTERN({0, 0});
+static const struct led_pattern steady = LED_PATTERN({100, 0});
+static const struct led_pattern fast_blink = LED_PATTERN({100, 250}, {0, 250});
+static const struct led_pattern heartbeat = LED_PATTERN({100, 100}, {0, 1900});
+/* Same SOS as the halt pattern */
+static const struct led_pattern sos = LED_PATTERN(
+	{100, 100}, {0, 100}, {100, 100}, {0, 100}, {100, 100}, {0, 300},
+	{100, 200}, {0, 200}, {100, 200}, {0, 200}, {100, 200}, {0, 400});
+static const struct led_pattern scan_fault_usb = LED_PATTERN({100, 750}, {0, 250});
+static const struct led_pattern scan_fault_ble = LED_PATTERN({0, 250}, {100, 750});
+
+/* Indicators in increasing priority, each lights one or more LEDs */
+static const struct led_pattern *const indicators[VINKEY_IND_COUNT][VINKEY_LED_COUNT] = {
+	[VINKEY_IND_POWER] = {[VINKEY_LED_PWR] = &steady},
+	[VINKEY_IND_USB] = {[VINKEY_LED_USB] = &steady},
+	[VINKEY_IND_BLE] = {[VINKEY_LED_BLE] = &steady},
+	[VINKEY_IND_CAPS_LOCK] = {[VINKEY_LED_CAPS] = &steady},
+	[VINKEY_IND_PAIRING] = {[VINKEY_LED_BLE] = &fast_blink},
+	[VINKEY_IND_LOW_BATTERY] = {[VINKEY_LED_PWR] = &heartbeat},
+	/* Dark while every host sleeps, USB suspend allows 2.5 mA in total */
+	[VINKEY_IND_SUSPENDED] = {
+		[VINKEY_LED_PWR] = &off,
+		[VINKEY_LED_USB] = &off,
+		[VINKEY_LED_BLE] = &off,
+		[VINKEY_LED_CAPS] = &off,
+	},
+	[VINKEY_IND_SCAN_FAULT] = {
+		[VINKEY_LED_PWR] = &off,
+		[VINKEY_LED_USB] = &scan_fault_usb,
+		[VINKEY_LED_BLE] = &scan_fault_ble,
+	},
+	[VINKEY_IND_FAULT] = {
+		[VINKEY_LED_PWR] = &off,
+		[VINKEY_LED_USB] = &sos,
+		[VINKEY_LED_BLE] = &off,
+	},
+};
+
+struct led_state {
+	const struct led_pattern *pattern;
+	uint8_t step;
+	int64_t deadline;
+};
+
+static struct led_state states[VINKEY_LED_COUNT];
+static atomic_t active_indicators;
+static uint8_t brightness = CONFIG_VINKEY_LED_BRIGHTNESS;
+
+static void led_timer_handler(struct k_timer *timer);
+
+static K_TIMER_DEFINE(led_timer, led_timer_handler, NULL);
+
+static const struct led_pattern *pattern_for(enum vinkey_led led, atomic_val_t active)
+{
+	for (int ind = VINKEY_IND_COUNT - 1; ind >= 0; ind--) {
+		if ((active & BIT(ind)) && indicators[ind][led] != NULL) {
+			return indicators[ind][led];
+		}
+	}
+	return NULL;
+}
+
+static void apply_step(enum vinkey_led led)
+{
+	const struct led_state *state = &states[led];
+	uint8_t level = 0;
+
+	if (state->pattern != NULL) {
+		level = state->pattern->steps[state->step].level * brightness / 100;
+	}
+	(void)led_set_brightness(leds[led].dev, leds[led].index, level);
+	if (IS_ENABLED(CONFIG_VINKEY_ENERGY)) {
+		vinkey_energy_led(led, level);
+	}
+}
+
+static void led_timer_handler(struct k_timer *timer)
+{
+	atomic_val_t active = atomic_get(&active_indicators);
+	int64_t now = k_uptime_get();
+	int64_t next = INT64_MAX;
+
+	for (int led = 0; led < VINKEY_LED_COUNT; led++) {
+		struct led_state *state = &states[led];
+		const struct led_pattern *pattern = pattern_for(led, active);
+
+		if (pattern != state->pattern) {
+			/* Patterns starting together stay in step */
+			state->pattern = pattern;
+			state->step = 0;
+			state->deadline = now + (pattern ? pattern->steps[0].ms : 0);
+		} else if (pattern != NULL && pattern->count > 1 && now >= state->deadline) {
+			state->step = (state->step + 1) % pattern->count;
+			state->deadline += pattern->steps[state->step].ms;
+		}
+		apply_step(led);
+
+		if (state->pattern != NULL && state->pattern->count > 1) {
+			next = MIN(next, state->deadline);
+		}
+	}
+
+	if (next != INT64_MAX) {
+		k_timer_start(&led_timer, K_MSEC(MAX(next - now, 0)), K_NO_WAIT);
+	}
+}
+
+void vinkey_led_indicate(enum vinkey_indicator indicator, bool on)
+{
+	atomic_val_t old = on ? atomic_or(&active_indicators, BIT(indicator))
+			      : atomic_and(&active_indicators, ~BIT(indicator));
+
+	if (((old & BIT(indicator)) != 0) != on) {
+		k_timer_start(&led_timer, K_NO_WAIT, K_NO_WAIT);
+	}
+}
+
+void vinkey_led_set_brightness(uint8_t percent)
+{
+	brightness = MIN(percent, 100);
+	/* Re-applied from the timer so it never races a step change */
+	k_timer_start(&led_timer, K_NO_WAIT, K_NO_WAIT);
+}
+
+uint8_t vinkey_led_get_brightness(void)
+{
+	return brightness;
+}
+
+void vinkey_led_halt_set(enum vinkey_led led, bool on)
+{
+	(void)led_set_brightness(leds[led].dev, leds[led].index, on ? brightness : 0);
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_led_brightness(const struct shell *sh, size_t argc, char **argv)
+{
+	if (argc < 2) {
+		shell_print(sh, "brightness: %u%%", brightness);
+		return 0;
+	}
+	vinkey_led_set_brightness(strtoul(argv[1], NULL, 10));
+	return 0;
+}
+
+static int cmd_led_indicators(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "active: 0x%02lx", (unsigned long)atomic_get(&active_indicators));
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(led_cmds,
+	SHELL_CMD_ARG(brightness, NULL, "[percent]", cmd_led_brightness, 1, 1),
+	SHELL_CMD(indicators, NULL, "Show active indicators", cmd_led_indicators),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(led, &led_cmds, "Indicator LEDs", NULL);
+#endif
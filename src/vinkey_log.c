@@ -0,0 +1,94 @@
+/*
+ * Run time log levels of the application modules. Debug messages are compiled
+ * in (CONFIG_VINKEY_LOG_LEVEL) but filtered before a message is even created,
+ * starting from CONFIG_VINKEY_LOG_RUNTIME_LEVEL. A level set with the
+ * "loglevel" shell command is stored under "vinkey/log/<module>" and restored
+ * on the next boot, so a deployed keyboard can keep one module verbose.
+ */
+
+#include <string.h>
+
+#include <zephyr/init.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+static const char *const level_names[] = {"none", "err", "wrn", "inf", "dbg"};
+
+static bool is_app_module(const char *name)
+{
+	return strcmp(name, "main") == 0 || strstr(name, "vinkey") != NULL;
+}
+
+static int set_level(const char *module, uint8_t level)
+{
+	int id = log_source_id_get(module);
+
+	if (id < 0 || !is_app_module(module) || level > LOG_LEVEL_DBG) {
+		return -ENOENT;
+	}
+	/* NULL applies the level to every backend */
+	log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, id, level);
+	return 0;
+}
+
+static int log_levels_init(void)
+{
+	uint32_t count = log_src_cnt_get(Z_LOG_LOCAL_DOMAIN_ID);
+
+	for (uint32_t id = 0; id < count; id++) {
+		const char *name = log_source_name_get(Z_LOG_LOCAL_DOMAIN_ID, id);
+
+		if (name != NULL && is_app_module(name)) {
+			log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, id,
+				       CONFIG_VINKEY_LOG_RUNTIME_LEVEL);
+		}
+	}
+	return 0;
+}
+
+SYS_INIT(log_levels_init, APPLICATION, 0);
+
+static int log_settings_set(const char *key, size_t len,
+			    settings_read_cb read_cb, void *cb_arg)
+{
+	uint8_t level;
+
+	if (len != sizeof(level) || read_cb(cb_arg, &level, sizeof(level)) != sizeof(level)) {
+		return -EINVAL;
+	}
+	/* Modules that are gone since the level was stored are skipped */
+	set_level(key, level);
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vinkey_log, "vinkey/log", NULL,
+			       log_settings_set, NULL, NULL);
+
+#ifdef CONFIG_SHELL
+static int cmd_loglevel(const struct shell *sh, size_t argc, char **argv)
+{
+	char name[64];
+
+	for (uint8_t level = 0; level < ARRAY_SIZE(level_names); level++) {
+		if (strcmp(argv[2], level_names[level]) != 0) {
+			continue;
+		}
+		if (set_level(argv[1], level) != 0) {
+			shell_error(sh, "Unknown application module %s", argv[1]);
+			return -ENOENT;
+		}
+		snprintk(name, sizeof(name), "vinkey/log/%s", argv[1]);
+		return settings_save_one(name, &level, sizeof(level));
+	}
+	shell_error(sh, "Unknown level %s", argv[2]);
+	return -EINVAL;
+}
+
+SHELL_CMD_ARG_REGISTER(loglevel, NULL,
+		       "Set and keep an application module log level\n"
+		       "loglevel <module> <none|err|wrn|inf|dbg>",
+		       cmd_loglevel, 3, 0);
+#endif
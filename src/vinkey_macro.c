@@ -0,0 +1,289 @@
+/*
+ * Macro and text expansion engine.
+ *
+ * Blue ALT chords start playback of a stored macro. A macro is a byte string:
+ * printable ASCII, '\n' and '\t' are typed as text (US host layout), while
+ * MACRO_OP_KEY is followed by a modifier byte and a HID key code and taps an
+ * arbitrary chord. Macros live in settings under "vinkey/macro/<slot>".
+ *
+ * Playback is a generator producing one report at a time on a low priority
+ * thread. Reports are pushed into the transport queues with K_FOREVER, so the
+ * generator runs exactly as fast as the send tasks drain them: one report per
+ * USB frame and as many as the BLE stack takes per connection event. The input
+ * path only posts the slot number and never waits for playback.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_macro, CONFIG_VINKEY_LOG_LEVEL);
+
+#define MACRO_OP_KEY (0x01)
+
+struct macro_slot {
+	uint8_t len;
+	uint8_t data[CONFIG_VINKEY_MACRO_MAX_LEN];
+};
+
+struct macro_gen {
+	const uint8_t *pos;
+	const uint8_t *end;
+	bool release_pending;
+};
+
+static struct macro_slot macros[CONFIG_VINKEY_MACRO_COUNT];
+
+K_MSGQ_DEFINE(macro_msgq, sizeof(uint8_t), 4, 1);
+
+static atomic_t playing;
+/* Held by the player for a whole macro, a slot is not rewritten while it plays */
+static K_MUTEX_DEFINE(slot_lock);
+
+static bool ascii_to_hid(char c, uint8_t *modifier, uint8_t *hid_code)
+{
+	static const struct {
+		char plain;
+		char shifted;
+		uint8_t hid_code;
+	} symbols[] = {
+		{'-', '_', HID_KEY_MINUS},
+		{'=', '+', HID_KEY_EQUAL},
+		{'[', '{', HID_KEY_LEFTBRACE},
+		{']', '}', HID_KEY_RIGHTBRACE},
+		{'\\', '|', HID_KEY_BACKSLASH},
+		{';', ':', HID_KEY_SEMICOLON},
+		{'\'', '"', HID_KEY_APOSTROPHE},
+		{'`', '~', HID_KEY_GRAVE},
+		{',', '<', HID_KEY_COMMA},
+		{'.', '>', HID_KEY_DOT},
+		{'/', '?', HID_KEY_SLASH},
+		{'1', '!', HID_KEY_1},
+		{'2', '@', HID_KEY_2},
+		{'3', '#', HID_KEY_3},
+		{'4', '$', HID_KEY_4},
+		{'5', '%', HID_KEY_5},
+		{'6', '^', HID_KEY_6},
+		{'7', '&', HID_KEY_7},
+		{'8', '*', HID_KEY_8},
+		{'9', '(', HID_KEY_9},
+		{'0', ')', HID_KEY_0},
+		{' ', ' ', HID_KEY_SPACE},
+		{'\n', '\n', HID_KEY_ENTER},
+		{'\t', '\t', HID_KEY_TAB},
+	};
+
+	*modifier = 0;
+	if (c >= 'a' && c <= 'z') {
+		*hid_code = HID_KEY_A + (c - 'a');
+		return true;
+	}
+	if (c >= 'A' && c <= 'Z') {
+		*modifier = HID_KBD_MODIFIER_LEFT_SHIFT;
+		*hid_code = HID_KEY_A + (c - 'A');
+		return true;
+	}
+	for (int i = 0; i < ARRAY_SIZE(symbols); i++) {
+		if (symbols[i].plain == c) {
+			*hid_code = symbols[i].hid_code;
+			return true;
+		}
+		if (symbols[i].shifted == c) {
+			*modifier = HID_KBD_MODIFIER_LEFT_SHIFT;
+			*hid_code = symbols[i].hid_code;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Produces the next report of the macro, every step is a press report followed
+ * by an all-released report. Returns false when the macro is exhausted.
+ */
+static bool macro_next_report(struct macro_gen *gen, struct kb_report *out)
+{
+	memset(out, 0, sizeof(*out));
+	if (gen->release_pending) {
+		gen->release_pending = false;
+		return true;
+	}
+
+	while (gen->pos < gen->end) {
+		uint8_t modifier;
+		uint8_t hid_code;
+
+		if (*gen->pos == MACRO_OP_KEY) {
+			if (gen->end - gen->pos < 3) {
+				LOG_WRN("Truncated key step");
+				return false;
+			}
+			modifier = gen->pos[1];
+			hid_code = gen->pos[2];
+			gen->pos += 3;
+		} else if (!ascii_to_hid((char)*gen->pos++, &modifier, &hid_code)) {
+			continue;
+		}
+
+		out->modifier = modifier;
+		if (hid_code != 0) {
+			kb_report_press(out, hid_code);
+		}
+		gen->release_pending = true;
+		return true;
+	}
+	return false;
+}
+
+static _Noreturn void macro_task(void *p1, void *p2, void *p3)
+{
+	struct kb_report macro_report;
+	uint8_t slot;
+
+	while (true) {
+		k_msgq_get(&macro_msgq, &slot, K_FOREVER);
+		k_mutex_lock(&slot_lock, K_FOREVER);
+
+		struct macro_gen gen = {
+			.pos = macros[slot].data,
+			.end = macros[slot].data + macros[slot].len,
+		};
+
+		if (gen.pos == gen.end) {
+			LOG_WRN("Macro %u is empty", slot);
+			k_mutex_unlock(&slot_lock);
+			continue;
+		}
+
+		atomic_set(&playing, 1);
+		/* Start from a clean state so live modifiers do not leak in */
+		memset(&macro_report, 0, sizeof(macro_report));
+		kb_submit_report(&macro_report, K_FOREVER);
+		while (macro_next_report(&gen, &macro_report)) {
+			kb_submit_report(&macro_report, K_FOREVER);
+		}
+		atomic_set(&playing, 0);
+		k_mutex_unlock(&slot_lock);
+
+		/* Restore whatever is physically held right now */
+		kb_resend_report();
+	}
+}
+
+K_THREAD_DEFINE(macro_task_tid, 1024, macro_task, NULL, NULL, NULL, 8, 0, 0);
+
+void vinkey_macro_play(int slot)
+{
+	uint8_t s = slot;
+
+	if (slot < 0 || slot >= CONFIG_VINKEY_MACRO_COUNT) {
+		return;
+	}
+	if (k_msgq_put(&macro_msgq, &s, K_NO_WAIT) != 0) {
+		LOG_WRN("Macro queue full, %d dropped", slot);
+	}
+}
+
+bool vinkey_macro_active(void)
+{
+	return atomic_get(&playing) != 0;
+}
+
+int vinkey_macro_save(int slot, const uint8_t *data, size_t len)
+{
+	char name[sizeof("vinkey/macro/") + 2];
+
+	if (slot < 0 || slot >= CONFIG_VINKEY_MACRO_COUNT || len > CONFIG_VINKEY_MACRO_MAX_LEN) {
+		return -EINVAL;
+	}
+
+	/* Rewriting a playing macro would mix old and new steps and could leave a key down */
+	if (k_mutex_lock(&slot_lock, K_NO_WAIT) != 0) {
+		return -EBUSY;
+	}
+	memcpy(macros[slot].data, data, len);
+	macros[slot].len = len;
+	k_mutex_unlock(&slot_lock);
+
+	snprintk(name, sizeof(name), "vinkey/macro/%d", slot);
+	if (len == 0) {
+		return settings_delete(name);
+	}
+	return settings_save_one(name, data, len);
+}
+
+static int macro_settings_set(const char *key, size_t len,
+			      settings_read_cb read_cb, void *cb_arg)
+{
+	const char *next;
+
+	if (key == NULL || settings_name_next(key, &next) == 0 || next != NULL) {
+		return -ENOENT;
+	}
+
+	int slot = strtol(key, NULL, 10);
+
+	if (slot < 0 || slot >= CONFIG_VINKEY_MACRO_COUNT) {
+		return -ENOENT;
+	}
+	if (len > CONFIG_VINKEY_MACRO_MAX_LEN) {
+		return -EINVAL;
+	}
+
+	ssize_t rc = read_cb(cb_arg, macros[slot].data, len);
+
+	if (rc < 0) {
+		return rc;
+	}
+	macros[slot].len = rc;
+	return 0;
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(vinkey_macro, "vinkey/macro", NULL,
+			       macro_settings_set, NULL, NULL);
+
+#ifdef CONFIG_SHELL
+static int cmd_macro_set(const struct shell *sh, size_t argc, char **argv)
+{
+	int slot = strtol(argv[1], NULL, 10);
+	int err = vinkey_macro_save(slot, (const uint8_t *)argv[2], strlen(argv[2]));
+
+	if (err) {
+		shell_error(sh, "Failed to store macro %d (err %d)", slot, err);
+	}
+	return err;
+}
+
+static int cmd_macro_clear(const struct shell *sh, size_t argc, char **argv)
+{
+	return vinkey_macro_save(strtol(argv[1], NULL, 10), NULL, 0);
+}
+
+static int cmd_macro_play(const struct shell *sh, size_t argc, char **argv)
+{
+	vinkey_macro_play(strtol(argv[1], NULL, 10));
+	return 0;
+}
+
+static int cmd_macro_list(const struct shell *sh, size_t argc, char **argv)
+{
+	for (int i = 0; i < CONFIG_VINKEY_MACRO_COUNT; i++) {
+		shell_print(sh, "%d: %u bytes", i, macros[i].len);
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(macro_cmds,
+	SHELL_CMD_ARG(set, NULL, "<slot> <text>", cmd_macro_set, 3, 0),
+	SHELL_CMD_ARG(clear, NULL, "<slot>", cmd_macro_clear, 2, 0),
+	SHELL_CMD_ARG(play, NULL, "<slot>", cmd_macro_play, 2, 0),
+	SHELL_CMD(list, NULL, "List stored macros", cmd_macro_list),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(macro, &macro_cmds, "Keyboard macros", NULL);
+#endif
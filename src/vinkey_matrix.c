@@ -0,0 +1,54 @@
+#include "main.h"
+
+#define BANK_ENTRY(bank, node)							\
+	[bank] = {								\
+		.dev = DEVICE_DT_GET(node),					\
+		.rows = DT_PROP_LEN(node, row_gpios),				\
+		.cols = DT_PROP_LEN(node, col_gpios),				\
+		.poll_us = DT_PROP(node, poll_period_ms) * USEC_PER_MSEC,	\
+	},
+
+const struct vinkey_bank vinkey_banks[VINKEY_BANK_COUNT] = {
+	VINKEY_BANK_FOREACH(BANK_ENTRY)
+};
+
+int vinkey_bank_of(const struct device *dev)
+{
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		if (vinkey_banks[bank].dev == dev) {
+			return bank;
+		}
+	}
+	return -1;
+}
+
+int vinkey_key_index(uint32_t code)
+{
+	uint32_t bank = VINKEY_KEY_BANK(code);
+	uint32_t row = VINKEY_KEY_ROW(code);
+	uint32_t col = VINKEY_KEY_COL(code);
+	int first = 0;
+
+	if (bank >= VINKEY_BANK_COUNT ||
+	    row >= vinkey_banks[bank].rows || col >= vinkey_banks[bank].cols) {
+		return -1;
+	}
+	for (int i = 0; i < bank; i++) {
+		first += vinkey_banks[i].rows * vinkey_banks[i].cols;
+	}
+	return first + row * vinkey_banks[bank].cols + col;
+}
+
+uint32_t vinkey_key_code(int index)
+{
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		int keys = vinkey_banks[bank].rows * vinkey_banks[bank].cols;
+
+		if (index < keys) {
+			return VINKEY_KEY(bank, index / vinkey_banks[bank].cols,
+					  index % vinkey_banks[bank].cols);
+		}
+		index -= keys;
+	}
+	return UINT32_MAX;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * Key matrix made of banks, one gpio-kbd-matrix per SX1509B expander. Bank 0
+ * is the "kscan" alias, further expanders are "kscan1" to "kscan3". Every
+ * bank has its own scan thread. Banks on separate I2C buses are scanned
+ * concurrently; on a shared bus their transfers interleave and the scan
+ * period grows with every bank. Neither case has been measured yet.
+ *
+ * A key code is (bank << 16) | (row << 8) | col, bank 0 codes are the same
+ * as the single expander (row << 8) | col. Key indices number all keys of all
+ * banks consecutively, for bitmaps and per-key counters.
+ */
+
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/util.h>
+
+#define VINKEY_KEY(bank, row, col) (((uint32_t)(bank) << 16) | ((row) << 8) | (col))
+#define VINKEY_KEY_BANK(code)      (((code) >> 16) & 0xFF)
+#define VINKEY_KEY_ROW(code)       (((code) >> 8) & 0xFF)
+#define VINKEY_KEY_COL(code)       ((code) & 0xFF)
+
+/* Calls fn(bank, node) for every bank present in the devicetree */
+#define VINKEY_BANK_FOREACH(fn)							\
+	fn(0, DT_ALIAS(kscan))							\
+	IF_ENABLED(DT_HAS_ALIAS(kscan1), (fn(1, DT_ALIAS(kscan1))))		\
+	IF_ENABLED(DT_HAS_ALIAS(kscan2), (fn(2, DT_ALIAS(kscan2))))		\
+	IF_ENABLED(DT_HAS_ALIAS(kscan3), (fn(3, DT_ALIAS(kscan3))))
+
+#define Z_VINKEY_BANK_ONE(bank, node) +1
+#define Z_VINKEY_BANK_KEYS(bank, node)						\
+	+(DT_PROP_LEN(node, row_gpios) * DT_PROP_LEN(node, col_gpios))
+
+#define VINKEY_BANK_COUNT  (0 VINKEY_BANK_FOREACH(Z_VINKEY_BANK_ONE))
+#define VINKEY_MATRIX_KEYS (0 VINKEY_BANK_FOREACH(Z_VINKEY_BANK_KEYS))
+
+struct vinkey_bank {
+	const struct device *dev;
+	uint8_t rows;
+	uint8_t cols;
+	/* Scan period of the kscan device while keys are down */
+	uint32_t poll_us;
+};
+
+extern const struct vinkey_bank vinkey_banks[VINKEY_BANK_COUNT];
+
+/* Bank scanned by the kscan device, -1 for any other input device */
+int vinkey_bank_of(const struct device *dev);
+/* Consecutive index of a key code, -1 when it is outside every bank */
+int vinkey_key_index(uint32_t code);
+uint32_t vinkey_key_code(int index);
@@ -0,0 +1,138 @@
+/*
+ * Power tiers. While every attached host is suspended the matrix is scanned
+ * in short windows instead of continuously: every kscan bank is PM suspended
+ * between windows, so the expander bus and the scan thread go quiet. A key
+ * press during a window brings full rate scanning back until the keyboard has
+ * been idle for a while.
+ *
+ * On a low battery the same low duty scan is used whenever the keyboard is
+ * idle, with the hosts awake: the first key after a pause may take up to a
+ * scan period longer, the expander no longer runs all the time.
+ */
+
+#include <zephyr/pm/device.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_power, CONFIG_VINKEY_LOG_LEVEL);
+
+static void duty_work_handler(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(duty_work, duty_work_handler);
+
+static bool low_duty;
+static bool battery_low;
+static bool scan_suspended;
+static int64_t last_activity;
+
+static void set_scan_suspended(bool suspend)
+{
+	if (scan_suspended == suspend) {
+		return;
+	}
+
+	if (IS_ENABLED(CONFIG_VINKEY_SCAN_DMA)) {
+		/* Stops the scan timer, kscan bank 0 resumes when the lists stop */
+		vinkey_scan_dma_pause(suspend);
+	}
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		if (IS_ENABLED(CONFIG_VINKEY_SCAN_DMA) && bank == 0 && vinkey_scan_dma_active()) {
+			continue;
+		}
+
+		int err = pm_device_action_run(vinkey_banks[bank].dev,
+					       suspend ? PM_DEVICE_ACTION_SUSPEND
+						       : PM_DEVICE_ACTION_RESUME);
+
+		if (err && err != -EALREADY) {
+			LOG_WRN("Failed to %s matrix bank %d (err %d)",
+				suspend ? "suspend" : "resume", bank, err);
+		}
+	}
+	scan_suspended = suspend;
+	if (IS_ENABLED(CONFIG_VINKEY_ENERGY)) {
+		vinkey_energy_scan(suspend);
+	}
+}
+
+static void duty_work_handler(struct k_work *work)
+{
+	if (!low_duty) {
+		set_scan_suspended(false);
+		return;
+	}
+
+	if (scan_suspended) {
+		/* Open a scan window */
+		set_scan_suspended(false);
+		k_work_reschedule(&duty_work, K_MSEC(CONFIG_VINKEY_POWER_SCAN_WINDOW_MS));
+		return;
+	}
+
+	int64_t idle = k_uptime_get() - last_activity;
+
+	if (idle < CONFIG_VINKEY_POWER_IDLE_TIMEOUT_MS) {
+		/* Typing goes on at full rate */
+		k_work_reschedule(&duty_work,
+				  K_MSEC(CONFIG_VINKEY_POWER_IDLE_TIMEOUT_MS - idle));
+		return;
+	}
+
+	set_scan_suspended(true);
+	k_work_reschedule(&duty_work, K_MSEC(CONFIG_VINKEY_POWER_SCAN_PERIOD_MS));
+}
+
+static bool all_hosts_suspended(void)
+{
+	bool any_ready = false;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (!t->api->ready()) {
+			continue;
+		}
+		any_ready = true;
+		if (t->api->suspended == NULL || !t->api->suspended()) {
+			return false;
+		}
+	}
+	return any_ready;
+}
+
+void vinkey_power_update(void)
+{
+	static bool hosts_suspended;
+	bool suspended = all_hosts_suspended();
+	bool enter = suspended || battery_low;
+
+	vinkey_led_indicate(VINKEY_IND_SUSPENDED, suspended);
+	if (IS_ENABLED(CONFIG_VINKEY_ENERGY) && suspended != hosts_suspended) {
+		vinkey_energy_suspend(suspended);
+	}
+	hosts_suspended = suspended;
+	if (enter == low_duty) {
+		return;
+	}
+
+	low_duty = enter;
+	LOG_INF("%s low duty matrix scan", enter ? "Entering" : "Leaving");
+	if (enter) {
+		last_activity = k_uptime_get();
+	}
+	k_work_reschedule(&duty_work, K_NO_WAIT);
+}
+
+void vinkey_power_key_activity(void)
+{
+	last_activity = k_uptime_get();
+}
+
+bool vinkey_power_low_duty(void)
+{
+	return low_duty;
+}
+
+void vinkey_power_set_battery_low(bool low)
+{
+	battery_low = low;
+	vinkey_power_update();
+}
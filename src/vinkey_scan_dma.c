@@ -0,0 +1,539 @@
+/*
+ * Hardware scanning of matrix bank 0 on nRF5x. The TWIM of the expander bus
+ * walks a pre-built EasyDMA list, one transfer per column: write RegDirA so
+ * only that column drives its (low) output latch, and with the register
+ * pointer auto-incremented to RegDataB, read the rows back after a repeated
+ * start. A TIMER starts the first transfer through (D)PPI every scan period,
+ * every STOPPED event starts the next one until a counter TIMER has seen the
+ * last column begin its read and cuts the chain.
+ *
+ * Shortly before the next period a timer interrupt rewinds the list pointers
+ * and compares the row bytes, a few hundred CPU cycles as counted by the DWT
+ * cycle counter (k_cycle_get_32() ticks with the RTC on nRF5x, far too coarse
+ * for that). The thread reporting key
+ * events wakes only when a changed matrix has been read twice in a row, which
+ * also debounces it.
+ *
+ * The TWIM is borrowed from the I2C driver: the kscan device and the bus are
+ * PM suspended while the lists run and resumed when hardware scanning stops,
+ * on request or when the transfers stall.
+ */
+
+#include <string.h>
+
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/pinctrl.h>
+#include <zephyr/irq.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+
+#include <cmsis_core.h>
+
+#include <hal/nrf_timer.h>
+#include <hal/nrf_twim.h>
+#include <helpers/nrfx_gppi.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_scan_dma, CONFIG_VINKEY_LOG_LEVEL);
+
+#define KSCAN_NODE    DT_ALIAS(kscan)
+#define EXPANDER_NODE DT_GPIO_CTLR_BY_IDX(KSCAN_NODE, row_gpios, 0)
+/* The TWIM itself, also when the I2C profiler sits in between */
+#define BUS_NODE							\
+	COND_CODE_1(DT_NODE_HAS_COMPAT(DT_BUS(EXPANDER_NODE), vinkey_i2c_profiler), \
+		    (DT_PHANDLE(DT_BUS(EXPANDER_NODE), i2c_bus)), (DT_BUS(EXPANDER_NODE)))
+
+#define SCAN_TWIM    ((NRF_TWIM_Type *)DT_REG_ADDR(BUS_NODE))
+#define SCAN_TIMER   NRFX_CONCAT_2(NRF_TIMER, CONFIG_VINKEY_SCAN_DMA_TIMER)
+#define SCAN_IRQN    NRFX_CONCAT_3(TIMER, CONFIG_VINKEY_SCAN_DMA_TIMER, _IRQn)
+#define COUNT_TIMER  NRFX_CONCAT_2(NRF_TIMER, CONFIG_VINKEY_SCAN_DMA_COUNTER)
+
+/* Time left for the interrupt before the next scan starts */
+#define REWIND_MARGIN_US (50)
+
+#define SX1509B_REG_DIR_A  (0x0F)
+#define SX1509B_REG_DATA_A (0x11)
+
+#define ROWS DT_PROP_LEN(KSCAN_NODE, row_gpios)
+#define COLS DT_PROP_LEN(KSCAN_NODE, col_gpios)
+
+/* Columns are on bank A, rows on bank B of the expander */
+#define PIN_OF(node, prop, idx) DT_GPIO_PIN_BY_IDX(node, prop, idx)
+
+static const uint8_t col_pins[] = {
+	DT_FOREACH_PROP_ELEM_SEP(KSCAN_NODE, col_gpios, PIN_OF, (,))
+};
+static const uint8_t row_pins[] = {
+	DT_FOREACH_PROP_ELEM_SEP(KSCAN_NODE, row_gpios, PIN_OF, (,))
+};
+
+#define LESS_THAN_8(node, prop, idx)   (DT_GPIO_PIN_BY_IDX(node, prop, idx) < 8) &&
+#define AT_LEAST_8(node, prop, idx)    (DT_GPIO_PIN_BY_IDX(node, prop, idx) >= 8) &&
+
+BUILD_ASSERT(DT_FOREACH_PROP_ELEM(KSCAN_NODE, col_gpios, LESS_THAN_8) 1,
+	     "Hardware scanning needs the columns on expander bank A");
+BUILD_ASSERT(DT_FOREACH_PROP_ELEM(KSCAN_NODE, row_gpios, AT_LEAST_8) 1,
+	     "Hardware scanning needs the rows on expander bank B");
+BUILD_ASSERT(CONFIG_VINKEY_SCAN_DMA_PERIOD_US > REWIND_MARGIN_US);
+
+PINCTRL_DT_DEV_CONFIG_DECLARE(BUS_NODE);
+
+static const struct i2c_dt_spec expander = I2C_DT_SPEC_GET(EXPANDER_NODE);
+static const struct device *const bus_dev = DEVICE_DT_GET(BUS_NODE);
+
+/* EasyDMA list items, the TWIM steps through them with TXD/RXD.LIST */
+static uint8_t tx_list[COLS][2];
+static uint8_t rx_list[COLS][1];
+
+/* Written by the timer interrupt only */
+static uint8_t last_read[COLS];
+static uint8_t published[COLS];
+/* Owned by the reporting thread */
+static uint8_t reported[COLS];
+
+static uint8_t dir_a;
+static uint8_t ch_start;
+static uint8_t ch_next;
+static uint8_t ch_count;
+static uint8_t ch_cut;
+static nrfx_gppi_channel_group_t chain;
+
+/*
+ * Read without the lock by the shell, the power code and the scan thread, the
+ * lock only orders start, stop and pause, which come from all three of them.
+ */
+static atomic_t active;
+static atomic_t paused;
+static K_MUTEX_DEFINE(mode_lock);
+
+static K_SEM_DEFINE(changed, 0, 1);
+
+static struct {
+	uint32_t scans;
+	uint32_t changes;
+	uint32_t errors;
+	uint32_t stalls;
+	/* CPU cycles */
+	uint64_t isr_cycles;
+	uint32_t isr_cycles_max;
+} stats;
+
+bool vinkey_scan_dma_active(void)
+{
+	return atomic_get(&active);
+}
+
+static void rewind(void)
+{
+	nrf_twim_tx_buffer_set(SCAN_TWIM, &tx_list[0][0], sizeof(tx_list[0]));
+	nrf_twim_rx_buffer_set(SCAN_TWIM, &rx_list[0][0], sizeof(rx_list[0]));
+}
+
+static void rewind_isr(const void *arg)
+{
+	ARG_UNUSED(arg);
+
+	uint32_t start = DWT->CYCCNT;
+
+	nrf_timer_event_clear(SCAN_TIMER, NRF_TIMER_EVENT_COMPARE1);
+	if (nrf_twim_event_check(SCAN_TWIM, NRF_TWIM_EVENT_ERROR)) {
+		/* No STOP after a NACK, end the transfer and drop the scan */
+		nrf_twim_event_clear(SCAN_TWIM, NRF_TWIM_EVENT_ERROR);
+		nrfx_gppi_group_disable(chain);
+		nrf_twim_task_trigger(SCAN_TWIM, NRF_TWIM_TASK_STOP);
+		nrf_timer_task_trigger(COUNT_TIMER, NRF_TIMER_TASK_CLEAR);
+		rewind();
+		stats.errors++;
+		return;
+	}
+
+	nrf_timer_task_trigger(COUNT_TIMER, NRF_TIMER_TASK_CAPTURE2);
+	if (!nrf_twim_event_check(SCAN_TWIM, NRF_TWIM_EVENT_STOPPED) ||
+	    nrf_timer_cc_get(COUNT_TIMER, NRF_TIMER_CC_CHANNEL2) != 0) {
+		/* Still running, the bus is stuck; the reporting thread notices */
+		return;
+	}
+	nrf_twim_event_clear(SCAN_TWIM, NRF_TWIM_EVENT_STOPPED);
+
+	if (memcmp(rx_list, last_read, sizeof(last_read)) != 0) {
+		memcpy(last_read, rx_list, sizeof(last_read));
+	} else if (memcmp(last_read, published, sizeof(published)) != 0) {
+		memcpy(published, last_read, sizeof(published));
+		k_sem_give(&changed);
+	}
+	rewind();
+	stats.scans++;
+
+	uint32_t took = DWT->CYCCNT - start;
+
+	stats.isr_cycles += took;
+	stats.isr_cycles_max = MAX(stats.isr_cycles_max, took);
+}
+
+static int routing_init(void)
+{
+	if (nrfx_gppi_channel_alloc(&ch_start) != NRFX_SUCCESS ||
+	    nrfx_gppi_channel_alloc(&ch_next) != NRFX_SUCCESS ||
+	    nrfx_gppi_channel_alloc(&ch_count) != NRFX_SUCCESS ||
+	    nrfx_gppi_channel_alloc(&ch_cut) != NRFX_SUCCESS ||
+	    nrfx_gppi_group_alloc(&chain) != NRFX_SUCCESS) {
+		return -EBUSY;
+	}
+
+	uint32_t starttx = nrf_twim_task_address_get(SCAN_TWIM, NRF_TWIM_TASK_STARTTX);
+
+	/* Scan period: first column, and let the chain run */
+	nrfx_gppi_channel_endpoints_setup(ch_start,
+		nrf_timer_event_address_get(SCAN_TIMER, NRF_TIMER_EVENT_COMPARE0), starttx);
+	nrfx_gppi_fork_endpoint_setup(ch_start,
+		nrfx_gppi_task_address_get(nrfx_gppi_group_enable_task_get(chain)));
+
+	/* Every finished column starts the next one */
+	nrfx_gppi_channel_endpoints_setup(ch_next,
+		nrf_twim_event_address_get(SCAN_TWIM, NRF_TWIM_EVENT_STOPPED), starttx);
+	nrfx_gppi_channels_include_in_group(BIT(ch_next), chain);
+
+	/*
+	 * Count the columns on LASTRX, an event of its own as DPPI publishes
+	 * STOPPED on one channel only. The chain is cut while the last column
+	 * is still reading, before its STOPPED.
+	 */
+	nrfx_gppi_channel_endpoints_setup(ch_count,
+		nrf_twim_event_address_get(SCAN_TWIM, NRF_TWIM_EVENT_LASTRX),
+		nrf_timer_task_address_get(COUNT_TIMER, NRF_TIMER_TASK_COUNT));
+	nrfx_gppi_channel_endpoints_setup(ch_cut,
+		nrf_timer_event_address_get(COUNT_TIMER, NRF_TIMER_EVENT_COMPARE0),
+		nrfx_gppi_task_address_get(nrfx_gppi_group_disable_task_get(chain)));
+	return 0;
+}
+
+static void timers_init(void)
+{
+	nrf_timer_mode_set(SCAN_TIMER, NRF_TIMER_MODE_TIMER);
+	nrf_timer_bit_width_set(SCAN_TIMER, NRF_TIMER_BIT_WIDTH_32);
+	/* 16 MHz / 2^4, microsecond ticks */
+	nrf_timer_prescaler_set(SCAN_TIMER, 4);
+	nrf_timer_cc_set(SCAN_TIMER, NRF_TIMER_CC_CHANNEL0, CONFIG_VINKEY_SCAN_DMA_PERIOD_US);
+	nrf_timer_cc_set(SCAN_TIMER, NRF_TIMER_CC_CHANNEL1,
+			 CONFIG_VINKEY_SCAN_DMA_PERIOD_US - REWIND_MARGIN_US);
+	nrf_timer_shorts_enable(SCAN_TIMER, NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+	nrf_timer_int_enable(SCAN_TIMER, NRF_TIMER_INT_COMPARE1_MASK);
+
+	nrf_timer_mode_set(COUNT_TIMER, NRF_TIMER_MODE_COUNTER);
+	nrf_timer_bit_width_set(COUNT_TIMER, NRF_TIMER_BIT_WIDTH_16);
+	nrf_timer_cc_set(COUNT_TIMER, NRF_TIMER_CC_CHANNEL0, COLS);
+	nrf_timer_shorts_enable(COUNT_TIMER, NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+
+	/* The cycle counter the interrupt cost is taken from */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	IRQ_CONNECT(SCAN_IRQN, CONFIG_VINKEY_SCAN_DMA_IRQ_PRIORITY, rewind_isr, NULL, 0);
+}
+
+static int lists_init(void)
+{
+	uint8_t col_mask = 0;
+
+	for (int col = 0; col < COLS; col++) {
+		col_mask |= BIT(col_pins[col]);
+	}
+
+	/* Columns idle as inputs, the one being scanned pulls low */
+	int err = i2c_reg_read_byte_dt(&expander, SX1509B_REG_DIR_A, &dir_a);
+
+	err = err ?: i2c_reg_update_byte_dt(&expander, SX1509B_REG_DATA_A, col_mask, 0);
+	if (err) {
+		return err;
+	}
+	for (int col = 0; col < COLS; col++) {
+		tx_list[col][0] = SX1509B_REG_DIR_A;
+		tx_list[col][1] = (dir_a | col_mask) & ~BIT(col_pins[col]);
+	}
+	memset(last_read, 0xFF, sizeof(last_read));
+	memset(published, 0xFF, sizeof(published));
+	memset(reported, 0xFF, sizeof(reported));
+	return 0;
+}
+
+static void twim_start(void)
+{
+	const struct pinctrl_dev_config *pcfg = PINCTRL_DT_DEV_CONFIG_GET(BUS_NODE);
+
+	/* Suspending the driver selected the sleep pin state */
+	(void)pinctrl_apply_state(pcfg, PINCTRL_STATE_DEFAULT);
+
+	nrf_twim_int_disable(SCAN_TWIM, NRF_TWIM_ALL_INTS_MASK);
+	nrf_twim_address_set(SCAN_TWIM, expander.addr);
+	nrf_twim_shorts_set(SCAN_TWIM, NRF_TWIM_SHORT_LASTTX_STARTRX_MASK |
+				       NRF_TWIM_SHORT_LASTRX_STOP_MASK);
+	nrf_twim_tx_list_enable(SCAN_TWIM);
+	nrf_twim_rx_list_enable(SCAN_TWIM);
+	rewind();
+	nrf_twim_event_clear(SCAN_TWIM, NRF_TWIM_EVENT_STOPPED);
+	nrf_twim_event_clear(SCAN_TWIM, NRF_TWIM_EVENT_ERROR);
+	nrf_twim_enable(SCAN_TWIM);
+
+	nrf_timer_task_trigger(COUNT_TIMER, NRF_TIMER_TASK_CLEAR);
+	nrf_timer_task_trigger(COUNT_TIMER, NRF_TIMER_TASK_START);
+	nrfx_gppi_channels_enable(BIT(ch_start) | BIT(ch_count) | BIT(ch_cut));
+	nrfx_gppi_group_disable(chain);
+	irq_enable(SCAN_IRQN);
+	nrf_timer_task_trigger(SCAN_TIMER, NRF_TIMER_TASK_CLEAR);
+	nrf_timer_task_trigger(SCAN_TIMER, NRF_TIMER_TASK_START);
+}
+
+static void twim_stop(void)
+{
+	nrf_timer_task_trigger(SCAN_TIMER, NRF_TIMER_TASK_STOP);
+	nrfx_gppi_channels_disable(BIT(ch_start) | BIT(ch_count) | BIT(ch_cut));
+	nrfx_gppi_group_disable(chain);
+	irq_disable(SCAN_IRQN);
+	nrf_timer_task_trigger(COUNT_TIMER, NRF_TIMER_TASK_STOP);
+
+	nrf_twim_task_trigger(SCAN_TWIM, NRF_TWIM_TASK_STOP);
+	/* A column transfer takes ~125 us at 400 kHz */
+	k_busy_wait(200);
+	nrf_twim_shorts_set(SCAN_TWIM, 0);
+	nrf_twim_tx_list_disable(SCAN_TWIM);
+	nrf_twim_rx_list_disable(SCAN_TWIM);
+	nrf_twim_disable(SCAN_TWIM);
+}
+
+static int hw_scan_start_locked(void)
+{
+	const struct device *scan_dev = vinkey_banks[0].dev;
+	int err;
+
+	if (atomic_get(&active)) {
+		return 0;
+	}
+	err = lists_init();
+	if (err) {
+		return err;
+	}
+
+	err = pm_device_action_run(scan_dev, PM_DEVICE_ACTION_SUSPEND);
+	if (err && err != -EALREADY) {
+		return err;
+	}
+	err = pm_device_action_run(bus_dev, PM_DEVICE_ACTION_SUSPEND);
+	if (err) {
+		pm_device_action_run(scan_dev, PM_DEVICE_ACTION_RESUME);
+		return err;
+	}
+
+	atomic_set(&active, true);
+	if (!atomic_get(&paused)) {
+		twim_start();
+	}
+	return 0;
+}
+
+static int hw_scan_start(void)
+{
+	k_mutex_lock(&mode_lock, K_FOREVER);
+	int err = hw_scan_start_locked();
+
+	k_mutex_unlock(&mode_lock);
+	return err;
+}
+
+static void hw_scan_stop(void)
+{
+	k_mutex_lock(&mode_lock, K_FOREVER);
+	if (!atomic_get(&active)) {
+		goto out;
+	}
+	if (!atomic_get(&paused)) {
+		twim_stop();
+	}
+	atomic_set(&active, false);
+
+	pm_device_action_run(bus_dev, PM_DEVICE_ACTION_RESUME);
+	/* Give the driver back its column directions */
+	(void)i2c_reg_write_byte_dt(&expander, SX1509B_REG_DIR_A, dir_a);
+	if (!atomic_get(&paused)) {
+		pm_device_action_run(vinkey_banks[0].dev, PM_DEVICE_ACTION_RESUME);
+	}
+out:
+	k_mutex_unlock(&mode_lock);
+}
+
+void vinkey_scan_dma_pause(bool pause)
+{
+	k_mutex_lock(&mode_lock, K_FOREVER);
+	if (atomic_set(&paused, pause) == pause || !atomic_get(&active)) {
+		goto out;
+	}
+	if (pause) {
+		twim_stop();
+	} else {
+		twim_start();
+	}
+out:
+	k_mutex_unlock(&mode_lock);
+}
+
+static void report_changes(const uint8_t *snapshot)
+{
+	const struct device *dev = vinkey_banks[0].dev;
+
+	for (int col = 0; col < COLS; col++) {
+		uint8_t diff = snapshot[col] ^ reported[col];
+
+		for (int row = 0; diff != 0 && row < ROWS; row++) {
+			uint8_t bit = BIT(row_pins[row] - 8);
+
+			if ((diff & bit) == 0) {
+				continue;
+			}
+			/* Same event sequence as the gpio-kbd-matrix driver */
+			input_report_abs(dev, INPUT_ABS_X, col, false, K_FOREVER);
+			input_report_abs(dev, INPUT_ABS_Y, row, false, K_FOREVER);
+			input_report_key(dev, INPUT_BTN_TOUCH, !(snapshot[col] & bit), true,
+					 K_FOREVER);
+		}
+		reported[col] = snapshot[col];
+	}
+}
+
+static void scan_dma_task(void *p1, void *p2, void *p3)
+{
+	uint32_t seen_scans = 0;
+
+	if (routing_init()) {
+		LOG_ERR("No (D)PPI channels left, keeping the kscan driver");
+		return;
+	}
+	timers_init();
+
+	/* Let the kscan driver configure the expander pins first */
+	k_sleep(K_MSEC(100));
+	if (!device_is_ready(vinkey_banks[0].dev)) {
+		return;
+	}
+
+	int err = hw_scan_start();
+
+	if (err) {
+		LOG_ERR("Hardware scanning did not start (err %d)", err);
+		return;
+	}
+	LOG_INF("Matrix bank 0 scanned by TWIM lists every %d us",
+		CONFIG_VINKEY_SCAN_DMA_PERIOD_US);
+
+	while (true) {
+		if (k_sem_take(&changed, K_MSEC(100)) == 0) {
+			uint8_t snapshot[COLS];
+			unsigned int key = irq_lock();
+
+			memcpy(snapshot, published, sizeof(snapshot));
+			irq_unlock(key);
+			stats.changes++;
+			report_changes(snapshot);
+			continue;
+		}
+
+		if (!atomic_get(&active) || atomic_get(&paused)) {
+			continue;
+		}
+		if (stats.scans == seen_scans) {
+			/* Bus hung mid transfer, the I2C driver knows how to recover it */
+			stats.stalls++;
+			LOG_ERR("Hardware scan stalled, back to the kscan driver");
+			hw_scan_stop();
+			(void)i2c_recover_bus(bus_dev);
+		}
+		seen_scans = stats.scans;
+	}
+}
+
+K_THREAD_DEFINE(scan_dma_tid, 1024, scan_dma_task, NULL, NULL, NULL, 4, 0, 0);
+
+#ifdef CONFIG_SHELL
+static int cmd_scan_status(const struct shell *sh, size_t argc, char **argv)
+{
+	uint32_t scans = MAX(stats.scans, 1);
+
+	shell_print(sh, "mode: %s%s", atomic_get(&active) ? "TWIM lists" : "kscan driver",
+		    atomic_get(&paused) ? ", paused" : "");
+	shell_print(sh, "scans: %u, changes: %u, errors: %u, stalls: %u", stats.scans,
+		    stats.changes, stats.errors, stats.stalls);
+	shell_print(sh, "interrupt: %u CPU cycles per scan (max %u), %u ns at %u MHz",
+		    (uint32_t)(stats.isr_cycles / scans), stats.isr_cycles_max,
+		    (uint32_t)(stats.isr_cycles * 1000 / scans / (SystemCoreClock / 1000000)),
+		    SystemCoreClock / 1000000);
+	return 0;
+}
+
+static int cmd_scan_mode(const struct shell *sh, size_t argc, char **argv)
+{
+	if (strcmp(argv[1], "kscan") == 0) {
+		hw_scan_stop();
+		return 0;
+	}
+	if (strcmp(argv[1], "dma") == 0) {
+		return hw_scan_start();
+	}
+	shell_error(sh, "Unknown mode %s", argv[1]);
+	return -EINVAL;
+}
+
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+static void find_kscan_thread(const struct k_thread *thread, void *user_data)
+{
+	k_tid_t *tid = user_data;
+	const char *name = k_thread_name_get((k_tid_t)thread);
+
+	if (name != NULL && strcmp(name, vinkey_banks[0].dev->name) == 0) {
+		*tid = (k_tid_t)thread;
+	}
+}
+
+static uint64_t isr_ns(void)
+{
+	return stats.isr_cycles * 1000 / (SystemCoreClock / 1000000);
+}
+
+/* CPU spent on scanning during one second, whichever path is running */
+static int cmd_scan_cpu(const struct shell *sh, size_t argc, char **argv)
+{
+	bool hw = atomic_get(&active);
+	k_tid_t tid = scan_dma_tid;
+
+	if (!hw) {
+		tid = NULL;
+		k_thread_foreach(find_kscan_thread, &tid);
+	}
+
+	uint64_t ns = vinkey_thread_cpu_ns(tid) + isr_ns();
+	uint32_t scans = stats.scans;
+
+	k_sleep(K_SECONDS(1));
+	ns = vinkey_thread_cpu_ns(tid) + isr_ns() - ns;
+	scans = stats.scans - scans;
+
+	shell_print(sh, "%s: %u us/s (%u.%02u%% CPU)", hw ? "TWIM lists" : "kscan driver",
+		    (uint32_t)(ns / 1000), (uint32_t)(ns / 10000000),
+		    (uint32_t)(ns / 100000 % 100));
+	if (hw && scans > 0) {
+		shell_print(sh, "%u scans, %u ns per scan", scans, (uint32_t)(ns / scans));
+	}
+	return 0;
+}
+#endif
+
+SHELL_STATIC_SUBCMD_SET_CREATE(scan_cmds,
+	SHELL_CMD(status, NULL, "Hardware scan statistics", cmd_scan_status),
+	SHELL_CMD_ARG(mode, NULL, "<dma|kscan>", cmd_scan_mode, 2, 0),
+#ifdef CONFIG_THREAD_RUNTIME_STATS
+	SHELL_CMD(cpu, NULL, "Measure scanning CPU time for a second", cmd_scan_cpu),
+#endif
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(scan, &scan_cmds, "Matrix scanning", NULL);
+#endif
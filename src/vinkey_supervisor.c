@@ -0,0 +1,441 @@
+/*
+ * Matrix supervisor. Every SX1509B expander is probed between scans: a failed
+ * read, a register that lost its configuration or a storm of events from
+ * garbage reads, counted per bank, stops the scan of that bank, recovers its I2C bus, writes the
+ * expander configuration back and resumes scanning with every key released.
+ * The other banks keep scanning meanwhile.
+ *
+ * A probe that does not come back at all means a slave holds the bus or a
+ * scan thread hangs with the bus lock held. A timer around every probe names
+ * the stalled bank, the supervisor is stuck behind it from then on.
+ *
+ * A hardware watchdog backs this up. It is fed only while the matrix is
+ * healthy and nothing called failure(), so a recovery that keeps failing, a
+ * stall or a fatal error anywhere else ends in a reset instead of a keyboard
+ * that has to be replugged. A bank that is not ready at boot is retried over
+ * a few resets with a growing delay, then the keyboard runs without it, so
+ * the shell and firmware updates stay reachable.
+ *
+ * On native_sim the expander is emulated (vinkey_sx1509b_emul.c) and the
+ * injected faults go onto the emulated bus.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/watchdog.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_supervisor, CONFIG_VINKEY_LOG_LEVEL);
+
+#define WDT_NODE DT_ALIAS(watchdog0)
+
+/* Bank B holds the matrix rows, their pull-ups are the configuration signature */
+#define SX1509B_REG_PULL_UP_B (0x06)
+#define SX1509B_REG_RESET     (0x7D)
+
+struct expander {
+	/* The expander driving the row lines of the bank */
+	struct i2c_dt_spec i2c;
+	const struct gpio_dt_spec *rows;
+	uint8_t row_count;
+	bool have_signature;
+	uint8_t signature;
+#ifdef CONFIG_VINKEY_SX1509B_EMUL
+	const struct emul *emul;
+#endif
+};
+
+#define BANK_ROWS(bank, node)							\
+	static const struct gpio_dt_spec rows_##bank[] = {			\
+		DT_FOREACH_PROP_ELEM_SEP(node, row_gpios, GPIO_DT_SPEC_GET_BY_IDX, (,)) \
+	};
+
+VINKEY_BANK_FOREACH(BANK_ROWS)
+
+#define BANK_EXPANDER(bank, node)						\
+	[bank] = {								\
+		.i2c = I2C_DT_SPEC_GET(DT_GPIO_CTLR_BY_IDX(node, row_gpios, 0)), \
+		.rows = rows_##bank,						\
+		.row_count = ARRAY_SIZE(rows_##bank),				\
+		IF_ENABLED(CONFIG_VINKEY_SX1509B_EMUL,				\
+			   (.emul = EMUL_DT_GET(DT_GPIO_CTLR_BY_IDX(node, row_gpios, 0)),)) \
+	},
+
+static struct expander expanders[VINKEY_BANK_COUNT] = {
+	VINKEY_BANK_FOREACH(BANK_EXPANDER)
+};
+
+static const struct device *const wdt_dev = DEVICE_DT_GET_OR_NULL(WDT_NODE);
+
+static int wdt_channel = -EINVAL;
+static atomic_t fatal;
+/* Per bank, a storm is recovered on the expander that produced it */
+static atomic_t key_events[VINKEY_BANK_COUNT];
+static atomic_t injected_naks;
+
+/* Banks left out after they were not ready over several boots */
+static uint32_t degraded;
+
+static struct {
+	uint32_t recoveries;
+	uint32_t failed;
+	uint32_t stalls;
+	uint32_t last_us;
+	uint32_t max_us;
+} stats;
+
+/* Kept over the resets, a power cycle starts the count over */
+#define BOOT_RETRIES_MAGIC (0x56534252U)
+
+static __noinit struct {
+	uint32_t magic;
+	uint32_t count;
+} boot_retries;
+
+static void stall_handler(struct k_timer *timer);
+static void stall_work_handler(struct k_work *work);
+
+static K_TIMER_DEFINE(stall_timer, stall_handler, NULL);
+static K_WORK_DEFINE(stall_work, stall_work_handler);
+static int stall_bank;
+static uint32_t stall_periods;
+
+static void watchdog_start(void)
+{
+	struct wdt_timeout_cfg cfg = {
+		.window.max = CONFIG_VINKEY_SUPERVISOR_WDT_TIMEOUT_MS,
+		.flags = WDT_FLAG_RESET_SOC,
+	};
+
+	if (wdt_dev == NULL || !device_is_ready(wdt_dev)) {
+		LOG_WRN("No watchdog, running unguarded");
+		return;
+	}
+
+	wdt_channel = wdt_install_timeout(wdt_dev, &cfg);
+	if (wdt_channel < 0) {
+		LOG_ERR("Watchdog timeout install failed (err %d)", wdt_channel);
+		return;
+	}
+
+	int err = wdt_setup(wdt_dev, WDT_OPT_PAUSE_HALTED_BY_DBG);
+
+	if (err) {
+		LOG_ERR("Watchdog setup failed (err %d)", err);
+		wdt_channel = err;
+	}
+}
+
+static void watchdog_feed(void)
+{
+	if (wdt_channel >= 0 && !atomic_get(&fatal)) {
+		wdt_feed(wdt_dev, wdt_channel);
+	}
+}
+
+static void stall_work_handler(struct k_work *work)
+{
+	key_scan_failure();
+}
+
+static void stall_handler(struct k_timer *timer)
+{
+	if (stall_periods++ == 0) {
+		stats.stalls++;
+		LOG_ERR("Matrix bank %d stalled, I2C busy for %d ms", stall_bank,
+			CONFIG_VINKEY_SUPERVISOR_STALL_MS);
+		vinkey_led_indicate(VINKEY_IND_SCAN_FAULT, true);
+	}
+	/* The watchdog resets a stuck supervisor, without one nothing else would */
+	if (wdt_channel < 0 &&
+	    stall_periods * CONFIG_VINKEY_SUPERVISOR_STALL_MS >= CONFIG_VINKEY_SUPERVISOR_WDT_TIMEOUT_MS) {
+		k_timer_stop(timer);
+		k_work_submit(&stall_work);
+	}
+}
+
+static void stall_arm(int bank)
+{
+	stall_bank = bank;
+	stall_periods = 0;
+	k_timer_start(&stall_timer, K_MSEC(CONFIG_VINKEY_SUPERVISOR_STALL_MS),
+		      K_MSEC(CONFIG_VINKEY_SUPERVISOR_STALL_MS));
+}
+
+/* True when the bus was held past the stall time, even if it came back */
+static bool stall_disarm(void)
+{
+	k_timer_stop(&stall_timer);
+	return stall_periods > 0;
+}
+
+static int probe_expander(struct expander *exp)
+{
+	uint8_t pull_up;
+
+	if (atomic_get(&injected_naks) > 0) {
+		atomic_dec(&injected_naks);
+		return -EIO;
+	}
+
+	int err = i2c_reg_read_byte_dt(&exp->i2c, SX1509B_REG_PULL_UP_B, &pull_up);
+
+	if (err) {
+		return err;
+	}
+	if (!exp->have_signature) {
+		exp->signature = pull_up;
+		exp->have_signature = true;
+	} else if (pull_up != exp->signature) {
+		/* Brown-out or reset of the expander alone */
+		return -ESTALE;
+	}
+	return 0;
+}
+
+/* Software reset, every register back to its power-on default */
+static int reset_expander(struct expander *exp)
+{
+	int err = i2c_reg_write_byte_dt(&exp->i2c, SX1509B_REG_RESET, 0x12);
+
+	if (err == 0) {
+		err = i2c_reg_write_byte_dt(&exp->i2c, SX1509B_REG_RESET, 0x34);
+	}
+	return err;
+}
+
+static int reinit_expander(struct expander *exp)
+{
+	int err = i2c_recover_bus(exp->i2c.bus);
+
+	if (err && err != -ENOSYS) {
+		LOG_WRN("I2C bus recovery failed (err %d)", err);
+	}
+
+	/* Known register state first, whatever the glitch left behind */
+	err = reset_expander(exp);
+	if (err) {
+		return err;
+	}
+
+	/* The SX1509B driver writes its whole cached pin state on every configure */
+	for (int i = 0; i < exp->row_count; i++) {
+		err = gpio_pin_configure_dt(&exp->rows[i], GPIO_INPUT);
+		if (err) {
+			return err;
+		}
+	}
+	return probe_expander(exp);
+}
+
+static int recover(int bank, int cause)
+{
+	const struct device *scan_dev = vinkey_banks[bank].dev;
+	vinkey_stamp_t start = vinkey_stamp();
+
+	LOG_WRN("Matrix bank %d fault (err %d), recovering", bank, cause);
+	vinkey_led_indicate(VINKEY_IND_SCAN_FAULT, true);
+
+	int err = pm_device_action_run(scan_dev, PM_DEVICE_ACTION_SUSPEND);
+	/* Low duty scanning may have it suspended already, leave it that way */
+	bool resume = err == 0;
+
+	kb_input_hold(true);
+	err = reinit_expander(&expanders[bank]);
+	if (resume) {
+		pm_device_action_run(scan_dev, PM_DEVICE_ACTION_RESUME);
+	}
+	kb_input_hold(false);
+
+	uint32_t took_us = vinkey_stamp_us(start);
+
+	if (err) {
+		stats.failed++;
+		LOG_ERR("Matrix bank %d recovery failed (err %d)", bank, err);
+		return err;
+	}
+
+	stats.recoveries++;
+	stats.last_us = took_us;
+	stats.max_us = MAX(stats.max_us, took_us);
+	vinkey_led_indicate(VINKEY_IND_SCAN_FAULT, false);
+	LOG_INF("Matrix bank %d recovered in %u us", bank, took_us);
+	return 0;
+}
+
+/*
+ * A bank whose driver failed to initialize is retried over a few resets, with
+ * a delay that doubles every time, so an expander that needs a while to come
+ * back is not reset in a tight loop. After that it is left out.
+ */
+static void check_banks_ready(void)
+{
+	uint32_t missing = 0;
+
+	for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+		if (!device_is_ready(vinkey_banks[bank].dev)) {
+			/* A stuck slave survives our reset, free the bus before it */
+			LOG_ERR("Kscan Device %d is not ready", bank);
+			(void)i2c_recover_bus(expanders[bank].i2c.bus);
+			missing |= BIT(bank);
+		}
+	}
+
+	if (boot_retries.magic != BOOT_RETRIES_MAGIC) {
+		boot_retries.magic = BOOT_RETRIES_MAGIC;
+		boot_retries.count = 0;
+	}
+	if (missing == 0) {
+		boot_retries.count = 0;
+		return;
+	}
+	if (boot_retries.count < CONFIG_VINKEY_SUPERVISOR_BOOT_RETRIES) {
+		uint32_t delay_s = BIT(boot_retries.count);
+
+		boot_retries.count++;
+		LOG_WRN("Reset %u of %d in %u s", boot_retries.count,
+			CONFIG_VINKEY_SUPERVISOR_BOOT_RETRIES, delay_s);
+		for (uint32_t s = 0; s < delay_s; s++) {
+			watchdog_feed();
+			k_sleep(K_SECONDS(1));
+		}
+		key_scan_failure();
+	}
+
+	degraded = missing;
+	vinkey_led_indicate(VINKEY_IND_SCAN_FAULT, true);
+	LOG_ERR("Matrix banks 0x%x not ready after %u resets, running without them", missing,
+		boot_retries.count);
+}
+
+static void supervisor_task(void *p1, void *p2, void *p3)
+{
+	int failures = 0;
+
+	watchdog_start();
+	check_banks_ready();
+
+	while (true) {
+		k_sleep(K_MSEC(CONFIG_VINKEY_SUPERVISOR_PERIOD_MS));
+
+		bool failed = false;
+
+		for (int bank = 0; bank < VINKEY_BANK_COUNT; bank++) {
+			atomic_val_t events = atomic_clear(&key_events[bank]);
+
+			if (degraded & BIT(bank)) {
+				continue;
+			}
+
+			int err = -EBADMSG;
+
+			if (events > CONFIG_VINKEY_SUPERVISOR_STORM_EVENTS) {
+				LOG_WRN("Matrix bank %d: %ld events in %d ms", bank, (long)events,
+					CONFIG_VINKEY_SUPERVISOR_PERIOD_MS);
+			} else {
+				stall_arm(bank);
+				err = probe_expander(&expanders[bank]);
+				if (stall_disarm() && err == 0) {
+					err = -ETIMEDOUT;
+				}
+			}
+			if (err) {
+				failed |= recover(bank, err) != 0;
+			}
+		}
+		failures = failed ? failures + 1 : 0;
+		if (failures >= CONFIG_VINKEY_SUPERVISOR_MAX_ATTEMPTS) {
+			LOG_ERR("Matrix did not recover after %d attempts", failures);
+			key_scan_failure();
+		}
+		watchdog_feed();
+	}
+}
+
+K_THREAD_DEFINE(supervisor_tid, 1024, supervisor_task, NULL, NULL, NULL, 10, 0, 0);
+
+void vinkey_supervisor_key_event(int bank)
+{
+	if (bank >= 0 && bank < VINKEY_BANK_COUNT) {
+		atomic_inc(&key_events[bank]);
+	}
+}
+
+void vinkey_supervisor_fatal(void)
+{
+	atomic_set(&fatal, 1);
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_supervisor_status(const struct shell *sh, size_t argc, char **argv)
+{
+	shell_print(sh, "recoveries: %u, failed: %u, stalls: %u, last: %u us, max: %u us",
+		    stats.recoveries, stats.failed, stats.stalls, stats.last_us, stats.max_us);
+	if (degraded) {
+		shell_print(sh, "banks left out: 0x%x", degraded);
+	}
+	shell_print(sh, "watchdog: %s", wdt_channel >= 0 ? "armed" : "off");
+	return 0;
+}
+
+static int cmd_supervisor_inject(const struct shell *sh, size_t argc, char **argv)
+{
+	int count = argc > 2 ? strtol(argv[2], NULL, 10) : 1;
+
+	if (strcmp(argv[1], "nak") == 0) {
+#ifdef CONFIG_VINKEY_SX1509B_EMUL
+		/* The scan thread sees them too, as on a real bus */
+		vinkey_sx1509b_emul_inject(expanders[0].emul, VINKEY_BUS_NAK, count);
+#else
+		/* The next probes fail as if the expander stopped answering */
+		atomic_set(&injected_naks, count);
+#endif
+	} else if (strcmp(argv[1], "reset") == 0) {
+		/* Expander loses its configuration behind the driver's back */
+		int bank = argc > 2 ? strtol(argv[2], NULL, 10) : 0;
+
+		if (bank < 0 || bank >= VINKEY_BANK_COUNT) {
+			shell_error(sh, "No matrix bank %d", bank);
+			return -EINVAL;
+		}
+
+		int err = reset_expander(&expanders[bank]);
+
+		if (err) {
+			shell_error(sh, "Expander reset failed (err %d)", err);
+			return err;
+		}
+	} else if (strcmp(argv[1], "storm") == 0) {
+#ifdef CONFIG_VINKEY_SX1509B_EMUL
+		/* Noise on the row reads, the matrix turns it into key events */
+		vinkey_sx1509b_emul_inject(expanders[0].emul, VINKEY_BUS_GARBAGE,
+					   argc > 2 ? count : 200);
+#else
+		atomic_add(&key_events[0], CONFIG_VINKEY_SUPERVISOR_STORM_EVENTS + 1);
+#endif
+#ifdef CONFIG_VINKEY_SX1509B_EMUL
+	} else if (strcmp(argv[1], "stall") == 0) {
+		vinkey_sx1509b_emul_inject(expanders[0].emul, VINKEY_BUS_STALL,
+					   argc > 2 ? count : 2 * CONFIG_VINKEY_SUPERVISOR_STALL_MS);
+#endif
+	} else {
+		shell_error(sh, "Unknown fault %s", argv[1]);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(supervisor_cmds,
+	SHELL_CMD(status, NULL, "Recovery statistics", cmd_supervisor_status),
+	SHELL_CMD_ARG(inject, NULL, "<nak [count]|reset [bank]|storm [reads]|stall [ms]>", cmd_supervisor_inject, 2, 1),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(supervisor, &supervisor_cmds, "Matrix supervisor", NULL);
+#endif
@@ -0,0 +1,164 @@
+/*
+ * SX1509B emulator for native_sim. A register file behind the I2C emulation
+ * controller, enough for the Zephyr driver and the supervisor probes: auto
+ * incrementing reads and writes, the software reset sequence, and inputs that
+ * read high as the row pull-ups would. Faults are injected on the bus, so the
+ * driver, the scan thread and the supervisor see them the way they would on
+ * hardware: NACKs, garbage reads from a noisy bus and a transfer that hangs.
+ */
+
+#define DT_DRV_COMPAT semtech_sx1509b
+
+#include <string.h>
+
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_sx1509b_emul, CONFIG_VINKEY_LOG_LEVEL);
+
+#define REG_COUNT            (0x80)
+#define REG_DIR_B            (0x0E)
+#define REG_DATA_B           (0x10)
+#define REG_INTERRUPT_MASK_B (0x12)
+#define REG_RESET            (0x7D)
+
+struct sx1509b_emul_data {
+	/* Held for a whole transfer, a hanging one blocks the bus for everybody */
+	struct k_mutex lock;
+	uint8_t regs[REG_COUNT];
+	uint8_t pointer;
+	uint8_t reset_step;
+	uint32_t noise;
+	atomic_t naks;
+	atomic_t garbage;
+	atomic_t stall_ms;
+};
+
+static void power_on_reset(struct sx1509b_emul_data *data)
+{
+	memset(data->regs, 0, sizeof(data->regs));
+	/* Every pin an input, every interrupt masked */
+	memset(&data->regs[REG_DIR_B], 0xFF, 2);
+	memset(&data->regs[REG_DATA_B], 0xFF, 2);
+	memset(&data->regs[REG_INTERRUPT_MASK_B], 0xFF, 2);
+	data->reset_step = 0;
+}
+
+static uint8_t read_reg(struct sx1509b_emul_data *data, uint8_t reg, bool garbage)
+{
+	if (garbage) {
+		data->noise = data->noise * 1103515245U + 12345U;
+		return data->noise >> 16;
+	}
+	if (reg == REG_DATA_B || reg == REG_DATA_B + 1) {
+		/* Inputs float high on their pull-ups, no key is ever pressed */
+		return data->regs[reg] | data->regs[reg - REG_DATA_B + REG_DIR_B];
+	}
+	return data->regs[reg];
+}
+
+static void write_reg(struct sx1509b_emul_data *data, uint8_t reg, uint8_t value)
+{
+	if (reg != REG_RESET) {
+		data->regs[reg] = value;
+		return;
+	}
+	if (data->reset_step == 0 && value == 0x12) {
+		data->reset_step = 1;
+	} else if (data->reset_step == 1 && value == 0x34) {
+		power_on_reset(data);
+	} else {
+		data->reset_step = 0;
+	}
+}
+
+static int sx1509b_emul_transfer(const struct emul *target, struct i2c_msg *msgs, int num_msgs,
+				 int addr)
+{
+	struct sx1509b_emul_data *data = target->data;
+	int stall_ms = atomic_set(&data->stall_ms, 0);
+	int err = 0;
+
+	k_mutex_lock(&data->lock, K_FOREVER);
+	if (stall_ms > 0) {
+		/* A slave holding SCL low, the transfer does not come back in time */
+		k_msleep(stall_ms);
+	}
+	if (atomic_get(&data->naks) > 0) {
+		atomic_dec(&data->naks);
+		err = -EIO;
+		goto out;
+	}
+
+	bool garbage = atomic_get(&data->garbage) > 0;
+
+	for (int i = 0; i < num_msgs; i++) {
+		struct i2c_msg *msg = &msgs[i];
+		uint32_t j = 0;
+
+		if ((msg->flags & I2C_MSG_RW_MASK) == I2C_MSG_READ) {
+			for (; j < msg->len; j++) {
+				msg->buf[j] = read_reg(data, data->pointer, garbage);
+				data->pointer = (data->pointer + 1) % REG_COUNT;
+			}
+			continue;
+		}
+		if (msg->len > 0) {
+			data->pointer = msg->buf[j++] % REG_COUNT;
+		}
+		for (; j < msg->len; j++) {
+			write_reg(data, data->pointer, msg->buf[j]);
+			data->pointer = (data->pointer + 1) % REG_COUNT;
+		}
+	}
+	if (garbage) {
+		atomic_dec(&data->garbage);
+	}
+out:
+	k_mutex_unlock(&data->lock);
+	return err;
+}
+
+void vinkey_sx1509b_emul_inject(const struct emul *target, enum vinkey_bus_fault fault, int count)
+{
+	struct sx1509b_emul_data *data = target->data;
+
+	switch (fault) {
+	case VINKEY_BUS_NAK:
+		atomic_set(&data->naks, count);
+		break;
+	case VINKEY_BUS_GARBAGE:
+		atomic_set(&data->garbage, count);
+		break;
+	case VINKEY_BUS_STALL:
+		atomic_set(&data->stall_ms, count);
+		break;
+	}
+	LOG_INF("%s: %d %s injected", target->dev->name, count,
+		fault == VINKEY_BUS_NAK ? "NACKs" : fault == VINKEY_BUS_GARBAGE ? "garbage reads"
+										: "ms stall");
+}
+
+static int sx1509b_emul_init(const struct emul *target, const struct device *parent)
+{
+	struct sx1509b_emul_data *data = target->data;
+
+	k_mutex_init(&data->lock);
+	data->noise = 1;
+	power_on_reset(data);
+	return 0;
+}
+
+static const struct i2c_emul_api sx1509b_emul_api = {
+	.transfer = sx1509b_emul_transfer,
+};
+
+#define SX1509B_EMUL(n)								\
+	static struct sx1509b_emul_data sx1509b_emul_data_##n;			\
+	EMUL_DT_INST_DEFINE(n, sx1509b_emul_init, &sx1509b_emul_data_##n, NULL,	\
+			    &sx1509b_emul_api, NULL);
+
+DT_INST_FOREACH_STATUS_OKAY(SX1509B_EMUL)
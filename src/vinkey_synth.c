@@ -0,0 +1,219 @@
+/*
+ * Synthetic matrix input. Key events are reported on the bank 0 kscan device
+ * exactly like the matrix driver does, so everything from handle_key() to the
+ * transports runs as for real typing, passkey entry included. A run presses
+ * keys in chords at a fixed rate, releases them again and then logs, per
+ * transport, how many of the expected reports were sent and how long they
+ * took from submit to send.
+ *
+ * Press n of a run is made n periods after the start, on absolute deadlines,
+ * and presses digit n % 10, so a host that knows the scenario can tell from
+ * a report which event it shows and when that event happened. The BabbleSim
+ * central in tests/bsim measures the latency that way.
+ *
+ * With CONFIG_VINKEY_SYNTH_BOOT_DELAY_MS set a run starts by itself that long
+ * after boot, for simulated boards without a shell, and with
+ * CONFIG_VINKEY_SYNTH_PASSKEY set that passkey is typed whenever a host asks
+ * for one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_synth, CONFIG_VINKEY_LOG_LEVEL);
+
+/* Digits 1 to 0 on the AX-110 matrix, plain keys on every layer */
+static const uint16_t digit_keys[] = {
+	0x702, 0x602, 0x703, 0x603, 0x705, 0x605, 0x704, 0x604, 0x707, 0x607,
+};
+
+#define ENTER_KEY (0x101)
+
+struct synth_run {
+	/* Key presses per second, each one is released again */
+	uint16_t rate;
+	uint16_t keys;
+	uint8_t chord;
+	/* Digits to type followed by Enter instead of the chord pattern */
+	char text[8];
+};
+
+K_MSGQ_DEFINE(synth_runs, sizeof(struct synth_run), 2, 4);
+
+static void inject(uint16_t code, bool pressed)
+{
+	const struct device *dev = vinkey_banks[0].dev;
+
+	input_report_abs(dev, INPUT_ABS_X, VINKEY_KEY_COL(code), false, K_FOREVER);
+	input_report_abs(dev, INPUT_ABS_Y, VINKEY_KEY_ROW(code), false, K_FOREVER);
+	input_report_key(dev, INPUT_BTN_TOUCH, pressed, true, K_FOREVER);
+}
+
+static void type_text(const char *text, k_timeout_t gap)
+{
+	for (const char *c = text; *c != '\0'; c++) {
+		if (*c < '0' || *c > '9') {
+			continue;
+		}
+		/* '1' is the first key, '0' the last */
+		uint16_t code = digit_keys[(*c - '1' + 10) % 10];
+
+		inject(code, true);
+		k_sleep(gap);
+		inject(code, false);
+		k_sleep(gap);
+	}
+	inject(ENTER_KEY, true);
+	k_sleep(gap);
+	inject(ENTER_KEY, false);
+}
+
+static void type_chords(const struct synth_run *run, uint32_t gap_us)
+{
+	int64_t start = k_uptime_ticks();
+
+	for (int done = 0; done < run->keys; done += run->chord) {
+		int chord = MIN(run->chord, run->keys - done);
+
+		for (int n = done; n < done + chord; n++) {
+			uint64_t next_us = (n + 1) * (uint64_t)gap_us;
+
+			inject(digit_keys[n % ARRAY_SIZE(digit_keys)], true);
+			k_sleep(K_TIMEOUT_ABS_TICKS(start + k_us_to_ticks_ceil64(next_us)));
+		}
+		for (int n = done; n < done + chord; n++) {
+			inject(digit_keys[n % ARRAY_SIZE(digit_keys)], false);
+		}
+	}
+}
+
+static void run_synth(const struct synth_run *run)
+{
+	struct vinkey_transport_stats before[8];
+	uint32_t gap_us = USEC_PER_SEC / MAX(run->rate, 1);
+	int i = 0;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (i < ARRAY_SIZE(before)) {
+			t->stats->latency_max_us = 0;
+			before[i++] = *t->stats;
+		}
+	}
+
+	int64_t start = k_uptime_get();
+	uint32_t events;
+
+	if (run->text[0] != '\0') {
+		type_text(run->text, K_USEC(gap_us));
+		events = 0;
+	} else {
+		type_chords(run, gap_us);
+		/* One keyboard report per press and per release */
+		events = 2 * run->keys;
+	}
+
+	/* Let the queues drain before counting */
+	k_sleep(K_MSEC(500));
+
+	uint32_t ms = MAX(k_uptime_get() - start, 1);
+
+	LOG_INF("%u presses at %u/s in chords of %u, %u ms", run->keys, run->rate,
+		run->chord, ms);
+	i = 0;
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (i >= ARRAY_SIZE(before)) {
+			break;
+		}
+
+		const struct vinkey_transport_stats *b = &before[i++];
+		uint32_t sent = t->stats->sent - b->sent;
+		uint32_t avg = sent ? (t->stats->latency_total_us - b->latency_total_us) / sent : 0;
+
+		if (sent == 0 && t->stats->failed == b->failed) {
+			/* Not routed */
+			continue;
+		}
+		LOG_INF("%s: %u/%u reports, %u failed, %u dropped, %u per s, latency %u us (max %u)",
+			t->name, sent, events, t->stats->failed - b->failed,
+			t->stats->dropped - b->dropped, sent * 1000 / ms, avg,
+			t->stats->latency_max_us);
+	}
+}
+
+static void type_passkey(void)
+{
+	struct synth_run run = {.rate = 10, .chord = 1};
+
+	strncpy(run.text, CONFIG_VINKEY_SYNTH_PASSKEY, sizeof(run.text) - 1);
+	(void)k_msgq_put(&synth_runs, &run, K_NO_WAIT);
+}
+
+/* Called by the BLE code when a host asks for a passkey */
+void vinkey_synth_passkey(void)
+{
+	if (sizeof(CONFIG_VINKEY_SYNTH_PASSKEY) > 1) {
+		type_passkey();
+	}
+}
+
+static void synth_task(void *p1, void *p2, void *p3)
+{
+	/* Runs queued before the scenario, passkey entry, are typed in the meantime */
+	bool scenario = CONFIG_VINKEY_SYNTH_BOOT_DELAY_MS > 0;
+	struct synth_run run;
+
+	while (true) {
+		k_timeout_t wait = scenario ? K_TIMEOUT_ABS_MS(CONFIG_VINKEY_SYNTH_BOOT_DELAY_MS)
+					    : K_FOREVER;
+
+		if (k_msgq_get(&synth_runs, &run, wait) == 0) {
+			run_synth(&run);
+			continue;
+		}
+		scenario = false;
+		run = (struct synth_run){
+			.rate = CONFIG_VINKEY_SYNTH_RATE,
+			.keys = CONFIG_VINKEY_SYNTH_KEYS,
+			.chord = CONFIG_VINKEY_SYNTH_CHORD,
+		};
+		run_synth(&run);
+	}
+}
+
+K_THREAD_DEFINE(synth_tid, 1024, synth_task, NULL, NULL, NULL, 11, 0, 0);
+
+#ifdef CONFIG_SHELL
+static int cmd_synth_run(const struct shell *sh, size_t argc, char **argv)
+{
+	struct synth_run run = {
+		.rate = argc > 1 ? strtoul(argv[1], NULL, 10) : CONFIG_VINKEY_SYNTH_RATE,
+		.keys = argc > 2 ? strtoul(argv[2], NULL, 10) : CONFIG_VINKEY_SYNTH_KEYS,
+		.chord = argc > 3 ? strtoul(argv[3], NULL, 10) : CONFIG_VINKEY_SYNTH_CHORD,
+	};
+
+	/* Every key of a chord has to fit in one boot protocol report */
+	run.chord = CLAMP(run.chord, 1, KEYS_PER_REPORT);
+	return k_msgq_put(&synth_runs, &run, K_NO_WAIT);
+}
+
+static int cmd_synth_type(const struct shell *sh, size_t argc, char **argv)
+{
+	struct synth_run run = {.rate = 10, .chord = 1};
+
+	strncpy(run.text, argv[1], sizeof(run.text) - 1);
+	return k_msgq_put(&synth_runs, &run, K_NO_WAIT);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(synth_cmds,
+	SHELL_CMD_ARG(run, NULL, "[presses/s] [presses] [chord]", cmd_synth_run, 1, 3),
+	SHELL_CMD_ARG(type, NULL, "<digits>, typed followed by Enter (passkey entry)",
+		      cmd_synth_type, 2, 0),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(synth, &synth_cmds, "Synthetic matrix input", NULL);
+#endif
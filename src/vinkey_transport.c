@@ -0,0 +1,430 @@
+#include <string.h>
+
+#include <zephyr/shell/shell.h>
+
+#include "main.h"
+
+LOG_MODULE_REGISTER(vinkey_transport, CONFIG_VINKEY_LOG_LEVEL);
+
+#if defined(CONFIG_VINKEY_ROUTE_MIRROR)
+#define DEFAULT_ROUTE VINKEY_ROUTE_MIRROR
+#else
+#define DEFAULT_ROUTE VINKEY_ROUTE_PREFER
+#endif
+
+static const char *const route_names[] = {
+	[VINKEY_ROUTE_PREFER] = "prefer",
+	[VINKEY_ROUTE_MIRROR] = "mirror",
+	[VINKEY_ROUTE_MANUAL] = "manual",
+};
+
+static K_MUTEX_DEFINE(route_lock);
+static enum vinkey_route route = DEFAULT_ROUTE;
+/* Looked up on first use, backends are plain iterable section entries */
+static const struct vinkey_transport *preferred;
+static bool preferred_resolved;
+static const struct vinkey_transport *manual;
+/* Single routed sink, NULL while mirroring or when nothing is attached */
+static const struct vinkey_transport *volatile active;
+
+/*
+ * Reports typed before any host is attached, handed to the first routed sink.
+ * The window closes on first delivery or after CONFIG_VINKEY_BOOT_BUFFER_MS.
+ */
+K_MSGQ_DEFINE(boot_msgq, sizeof(struct vinkey_queued_report), CONFIG_VINKEY_BOOT_BUFFER_DEPTH, 4);
+
+/* reroute() queues the backlog and then the state reports, all without waiting */
+BUILD_ASSERT(CONFIG_VINKEY_BOOT_BUFFER_DEPTH + VINKEY_STATE_REPORTS <=
+	     CONFIG_VINKEY_TRANSPORT_QUEUE_DEPTH,
+	     "CONFIG_VINKEY_BOOT_BUFFER_DEPTH must leave room for the state reports");
+/* Closed from the transport threads and from submitters, set once */
+static atomic_t boot_window_closed;
+static uint32_t boot_dropped;
+/* BIT(n) for the n-th backend while its host is suspended */
+static atomic_t suspended_sinks;
+
+const struct vinkey_transport *vinkey_transport_find(const char *name)
+{
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (strcmp(t->name, name) == 0) {
+			return t;
+		}
+	}
+	return NULL;
+}
+
+static const struct vinkey_transport *select_active(void)
+{
+	switch (route) {
+	case VINKEY_ROUTE_MIRROR:
+		return NULL;
+	case VINKEY_ROUTE_MANUAL:
+		return manual;
+	default:
+		if (!preferred_resolved) {
+			preferred = vinkey_transport_find(CONFIG_VINKEY_ROUTE_PREFERRED);
+			preferred_resolved = true;
+		}
+		if (preferred != NULL && preferred->api->ready()) {
+			return preferred;
+		}
+		STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+			if (t->api->ready()) {
+				return t;
+			}
+		}
+		return NULL;
+	}
+}
+
+static bool is_routed(const struct vinkey_transport *t)
+{
+	if (route == VINKEY_ROUTE_MIRROR) {
+		return t->api->ready();
+	}
+	return t == active;
+}
+
+static void apply_leds(const struct vinkey_transport *t)
+{
+	if (t->api->leds != NULL) {
+		vinkey_led_indicate(VINKEY_IND_CAPS_LOCK, t->api->leds() & BIT(1));
+	}
+}
+
+static bool is_suspended(const struct vinkey_transport *t)
+{
+	return t->api->suspended != NULL && t->api->suspended();
+}
+
+static int enqueue(const struct vinkey_transport *t, const struct vinkey_queued_report *item,
+		   k_timeout_t timeout)
+{
+	/* A sleeping host only gets presses, they wake it; the resume resends the rest */
+	if (vinkey_report_is_empty(&item->report) && is_suspended(t)) {
+		return -EAGAIN;
+	}
+	if (k_msgq_put(t->msgq, item, timeout) != 0) {
+		t->stats->dropped++;
+		return -ENOBUFS;
+	}
+	t->stats->queue_peak = MAX(t->stats->queue_peak, k_msgq_num_used_get(t->msgq));
+	return 0;
+}
+
+/* Leaves nothing pressed on a host that is no longer routed */
+static void release_all(const struct vinkey_transport *t)
+{
+	static const uint8_t ids[] = {
+		VINKEY_REPORT_ID_KEYBOARD,
+		VINKEY_REPORT_ID_CONSUMER,
+		VINKEY_REPORT_ID_SYSTEM,
+	};
+
+	k_msgq_purge(t->msgq);
+	for (int i = 0; i < ARRAY_SIZE(ids); i++) {
+		struct vinkey_queued_report released = {.report.id = ids[i]};
+
+		enqueue(t, &released, K_NO_WAIT);
+	}
+}
+
+static bool boot_window_open(void)
+{
+	if (atomic_get(&boot_window_closed)) {
+		return false;
+	}
+	if (k_uptime_get() >= CONFIG_VINKEY_BOOT_BUFFER_MS) {
+		if (atomic_cas(&boot_window_closed, 0, 1)) {
+			k_msgq_purge(&boot_msgq);
+		}
+		return false;
+	}
+	return true;
+}
+
+static void replay_boot_reports(void)
+{
+	struct vinkey_queued_report buffered;
+	int replayed = 0;
+
+	if (!boot_window_open()) {
+		return;
+	}
+
+	while (k_msgq_get(&boot_msgq, &buffered, K_NO_WAIT) == 0) {
+		STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+			if (is_routed(t)) {
+				/* Callers are stack threads, never block them */
+				enqueue(t, &buffered, K_NO_WAIT);
+			}
+		}
+		replayed++;
+	}
+	atomic_set(&boot_window_closed, 1);
+	if (replayed) {
+		LOG_INF("Replayed %d reports typed during boot", replayed);
+	}
+}
+
+static void reroute(void)
+{
+	const struct vinkey_transport *previous;
+	const struct vinkey_transport *next;
+	bool changed;
+
+	k_mutex_lock(&route_lock, K_FOREVER);
+	previous = active;
+	next = select_active();
+	active = next;
+	changed = previous != next;
+	k_mutex_unlock(&route_lock);
+
+	if (changed) {
+		LOG_INF("Routing reports to %s", next ? next->name : "none");
+		if (previous != NULL && !is_routed(previous)) {
+			release_all(previous);
+		}
+		if (next != NULL) {
+			apply_leds(next);
+			replay_boot_reports();
+		}
+		/* The new host gets whatever is held right now, media keys included */
+		kb_resend_reports();
+	}
+}
+
+_Noreturn void vinkey_transport_task(void *p1, void *p2, void *p3)
+{
+	const struct vinkey_transport *t = p1;
+	struct vinkey_queued_report queued;
+
+	while (true) {
+		k_msgq_get(t->msgq, &queued, K_FOREVER);
+		if (!t->api->ready() || t->api->send(&queued.report) != 0) {
+			t->stats->failed++;
+			continue;
+		}
+		t->stats->sent++;
+		vinkey_boot_mark(VINKEY_BOOT_FIRST_REPORT);
+		if (queued.stamp != 0) {
+			uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - queued.stamp);
+
+			t->stats->latency_total_us += us;
+			t->stats->latency_max_us = MAX(t->stats->latency_max_us, us);
+			if (IS_ENABLED(CONFIG_VINKEY_DIAG)) {
+				vinkey_diag_latency(us);
+			}
+			if (IS_ENABLED(CONFIG_VINKEY_CLOCK_SCALING)) {
+				vinkey_clock_latency(us);
+			}
+		}
+	}
+}
+
+int vinkey_transport_submit_to(const struct vinkey_transport *t,
+			       const struct vinkey_report *report, k_timeout_t timeout)
+{
+	struct vinkey_queued_report item = {.report = *report};
+
+	if (t == NULL || !t->api->ready()) {
+		return -ENOTCONN;
+	}
+	return enqueue(t, &item, timeout);
+}
+
+void vinkey_transport_submit(const struct vinkey_report *report, k_timeout_t timeout)
+{
+	struct vinkey_queued_report item = {
+		.report = *report,
+		.stamp = k_cycle_get_32() | 1,
+	};
+	bool routed = false;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (is_routed(t)) {
+			enqueue(t, &item, timeout);
+			routed = true;
+		}
+	}
+
+	if (!routed && boot_window_open()) {
+		/* Latency of buffered reports is the boot time, not worth a sample */
+		item.stamp = 0;
+		if (k_msgq_put(&boot_msgq, &item, K_NO_WAIT) != 0) {
+			boot_dropped++;
+			LOG_WRN("Boot buffer full, report dropped");
+		}
+	}
+}
+
+/*
+ * Reports queued before the host suspended are stale once it wakes up, and
+ * the send task would only fail on them. The resume resends what is held.
+ */
+static void track_suspend(void)
+{
+	bool resumed = false;
+	int i = 0;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		bool suspended = is_suspended(t);
+
+		if (suspended != atomic_test_bit(&suspended_sinks, i)) {
+			atomic_set_bit_to(&suspended_sinks, i, suspended);
+			if (suspended) {
+				k_msgq_purge(t->msgq);
+			} else {
+				resumed = true;
+			}
+		}
+		i++;
+	}
+	if (resumed) {
+		kb_resend_reports();
+		if (IS_ENABLED(CONFIG_VINKEY_BATTERY)) {
+			vinkey_battery_resend();
+		}
+	}
+}
+
+void vinkey_transport_state_changed(void)
+{
+	track_suspend();
+	reroute();
+	if (route == VINKEY_ROUTE_MIRROR) {
+		/* No single active sink, whoever is ready first gets the backlog */
+		replay_boot_reports();
+	}
+	vinkey_power_update();
+	update_connect_status();
+}
+
+void vinkey_transport_leds_changed(const struct vinkey_transport *transport)
+{
+	if (is_routed(transport)) {
+		apply_leds(transport);
+	}
+}
+
+void vinkey_transport_set_route(enum vinkey_route new_route)
+{
+	k_mutex_lock(&route_lock, K_FOREVER);
+	route = new_route;
+	if (route == VINKEY_ROUTE_MANUAL && manual == NULL) {
+		manual = active;
+	}
+	k_mutex_unlock(&route_lock);
+
+	reroute();
+}
+
+void vinkey_transport_prefer(const struct vinkey_transport *t)
+{
+	k_mutex_lock(&route_lock, K_FOREVER);
+	preferred = t;
+	preferred_resolved = true;
+	k_mutex_unlock(&route_lock);
+
+	vinkey_transport_set_route(VINKEY_ROUTE_PREFER);
+}
+
+enum vinkey_route vinkey_transport_get_route(void)
+{
+	return route;
+}
+
+void vinkey_transport_toggle(void)
+{
+	const struct vinkey_transport *current = active;
+	const struct vinkey_transport *first = NULL;
+	const struct vinkey_transport *next = NULL;
+	bool found = false;
+
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		if (first == NULL) {
+			first = t;
+		}
+		if (found && next == NULL) {
+			next = t;
+		}
+		if (t == current) {
+			found = true;
+		}
+	}
+
+	manual = next != NULL ? next : first;
+	vinkey_transport_set_route(VINKEY_ROUTE_MANUAL);
+}
+
+const struct vinkey_transport *vinkey_transport_active(void)
+{
+	return active;
+}
+
+uint32_t vinkey_transport_boot_dropped(void)
+{
+	return boot_dropped;
+}
+
+#ifdef CONFIG_SHELL
+static int cmd_transport_route(const struct shell *sh, size_t argc, char **argv)
+{
+	if (argc < 2) {
+		shell_print(sh, "route: %s%s%s, active: %s", route_names[route],
+			    route == VINKEY_ROUTE_PREFER ? " " : "",
+			    route == VINKEY_ROUTE_PREFER ? (preferred ? preferred->name : "none") : "",
+			    active ? active->name : "none");
+		return 0;
+	}
+	if (strcmp(argv[1], route_names[VINKEY_ROUTE_MIRROR]) == 0) {
+		vinkey_transport_set_route(VINKEY_ROUTE_MIRROR);
+		return 0;
+	}
+	if (strcmp(argv[1], route_names[VINKEY_ROUTE_MANUAL]) == 0) {
+		vinkey_transport_set_route(VINKEY_ROUTE_MANUAL);
+		return 0;
+	}
+
+	/* Any other word names the preferred backend */
+	const struct vinkey_transport *t = vinkey_transport_find(argv[1]);
+
+	if (t != NULL) {
+		vinkey_transport_prefer(t);
+		return 0;
+	}
+	shell_error(sh, "Unknown route %s", argv[1]);
+	return -EINVAL;
+}
+
+static int cmd_transport_use(const struct shell *sh, size_t argc, char **argv)
+{
+	const struct vinkey_transport *t = vinkey_transport_find(argv[1]);
+
+	if (t == NULL) {
+		shell_error(sh, "Unknown transport %s", argv[1]);
+		return -EINVAL;
+	}
+	manual = t;
+	vinkey_transport_set_route(VINKEY_ROUTE_MANUAL);
+	return 0;
+}
+
+static int cmd_transport_list(const struct shell *sh, size_t argc, char **argv)
+{
+	STRUCT_SECTION_FOREACH(vinkey_transport, t) {
+		shell_print(sh, "%s: %s%s", t->name, t->api->ready() ? "ready" : "not ready",
+			    is_routed(t) ? ", routed" : "");
+	}
+	return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(transport_cmds,
+	SHELL_CMD_ARG(route, NULL, "[<transport>|mirror|manual]", cmd_transport_route, 1, 1),
+	SHELL_CMD_ARG(use, NULL, "<name>", cmd_transport_use, 2, 0),
+	SHELL_CMD(list, NULL, "List transports", cmd_transport_list),
+	SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(transport, &transport_cmds, "Report transports", NULL);
+#endif
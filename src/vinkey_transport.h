@@ -0,0 +1,98 @@
+#pragma once
+
+/*
+ * Report transports. Every backend (USB HID, BLE HIDS, ...) lives in its own
+ * file under src/transport/ and registers itself under a name with
+ * VINKEY_TRANSPORT_DEFINE, which gives it a report queue and a send thread.
+ * Everything else finds backends by that name. Reports are routed only to
+ * the sinks selected by the routing policy, idle backends get nothing to do.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+
+#include "vinkey_hid.h"
+
+struct vinkey_transport_api {
+	/* True when a host is attached and able to receive reports */
+	bool (*ready)(void);
+	/* Delivers one report, may block until the transport accepts it */
+	int (*send)(const struct vinkey_report *report);
+	/* LED output report last written by this backend's host */
+	uint8_t (*leds)(void);
+	/* Optional, true while the host has put the link into suspend */
+	bool (*suspended)(void);
+};
+
+/* Queue element, stamped at submit time so the send task can measure latency */
+struct vinkey_queued_report {
+	struct vinkey_report report;
+	/* k_cycle_get_32() at submit, 0 for reports that were not typed just now */
+	uint32_t stamp;
+};
+
+struct vinkey_transport_stats {
+	uint32_t sent;
+	uint32_t failed;
+	/* Reports that did not fit into the queue */
+	uint32_t dropped;
+	uint8_t queue_peak;
+	/* Submit to send latency of the reports typed live */
+	uint64_t latency_total_us;
+	uint32_t latency_max_us;
+};
+
+struct vinkey_transport {
+	const char *name;
+	const struct vinkey_transport_api *api;
+	struct k_msgq *msgq;
+	struct vinkey_transport_stats *stats;
+};
+
+enum vinkey_route {
+	/* The preferred transport when ready, otherwise the first ready one */
+	VINKEY_ROUTE_PREFER,
+	VINKEY_ROUTE_MIRROR,
+	VINKEY_ROUTE_MANUAL,
+};
+
+_Noreturn void vinkey_transport_task(void *p1, void *p2, void *p3);
+
+#define VINKEY_TRANSPORT_DEFINE(_name, _label, _api, _prio)			\
+	K_MSGQ_DEFINE(_name##_msgq, sizeof(struct vinkey_queued_report),	\
+		      CONFIG_VINKEY_TRANSPORT_QUEUE_DEPTH, 4);			\
+	static struct vinkey_transport_stats _name##_stats;			\
+	const STRUCT_SECTION_ITERABLE(vinkey_transport, _name) = {		\
+		.name = _label,							\
+		.api = _api,							\
+		.msgq = &_name##_msgq,						\
+		.stats = &_name##_stats,					\
+	};									\
+	K_THREAD_DEFINE(_name##_tid, CONFIG_VINKEY_TRANSPORT_STACK_SIZE,	\
+			vinkey_transport_task, &_name, NULL, NULL, _prio, 0, 0)
+
+/* Backend registered under this name, NULL when it is not built in */
+const struct vinkey_transport *vinkey_transport_find(const char *name);
+/* Queues a report on every routed sink */
+void vinkey_transport_submit(const struct vinkey_report *report, k_timeout_t timeout);
+/*
+ * Queues a report on one backend regardless of routing, if it is ready.
+ * -ENOTCONN when it is not, -EAGAIN for an empty report to a suspended host
+ * and -ENOBUFS when the queue is full.
+ */
+int vinkey_transport_submit_to(const struct vinkey_transport *t,
+			       const struct vinkey_report *report, k_timeout_t timeout);
+/* Backends call this whenever their ready state changes */
+void vinkey_transport_state_changed(void);
+/* Backends call this when their host writes a new LED output report */
+void vinkey_transport_leds_changed(const struct vinkey_transport *transport);
+
+void vinkey_transport_set_route(enum vinkey_route route);
+/* Switches to the preferred policy with this backend first */
+void vinkey_transport_prefer(const struct vinkey_transport *t);
+enum vinkey_route vinkey_transport_get_route(void);
+/* Switches to manual routing and moves on to the next backend */
+void vinkey_transport_toggle(void);
+const struct vinkey_transport *vinkey_transport_active(void);
+/* Reports typed during boot that did not fit into the boot buffer */
+uint32_t vinkey_transport_boot_dropped(void);
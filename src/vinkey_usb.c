@@ -8,7 +8,7 @@
 #include <zephyr/usb/usbd.h>
 
 #include <zephyr/logging/log.h>
-LOG_MODULE_REGISTER(usbd_vinkey_config);
+LOG_MODULE_REGISTER(usbd_vinkey_config, CONFIG_VINKEY_LOG_LEVEL);
 
 /* By default, do not register the USB DFU class DFU mode instance. */
 static const char* const blocklist[] = {
@@ -16,8 +16,6 @@ static const char* const blocklist[] = {
     NULL,
 };
 
-#define CONFIG_VINKEY_USBD_VID (CONFIG_BT_DIS_PNP_VID)
-#define CONFIG_VINKEY_USBD_PID (CONFIG_BT_DIS_PNP_PID)
 #define CONFIG_SAMPLE_USBD_MAX_POWER (125)
 
 /*
@@ -26,17 +24,21 @@ static const char* const blocklist[] = {
  */
 USBD_DEVICE_DEFINE(vinkey_usbd,
                    DEVICE_DT_GET(DT_NODELABEL(zephyr_udc0)),
-                   CONFIG_VINKEY_USBD_VID, CONFIG_VINKEY_USBD_PID);
+                   CONFIG_VINKEY_USB_VID, CONFIG_VINKEY_USB_PID);
 
 USBD_DESC_LANG_DEFINE(vinkey_lang);
-USBD_DESC_MANUFACTURER_DEFINE(vinkey_mfr, CONFIG_BT_DIS_MANUF_NAME_STR);
-USBD_DESC_PRODUCT_DEFINE(vinkey_product, CONFIG_BT_DEVICE_NAME "[USB]");
+USBD_DESC_MANUFACTURER_DEFINE(vinkey_mfr, CONFIG_VINKEY_USB_MANUFACTURER);
+USBD_DESC_PRODUCT_DEFINE(vinkey_product, CONFIG_VINKEY_USB_PRODUCT);
 IF_ENABLED(CONFIG_HWINFO, (USBD_DESC_SERIAL_NUMBER_DEFINE(vinkey_sn)));
 
 USBD_DESC_CONFIG_DEFINE(fs_cfg_desc, "FS Configuration");
 USBD_DESC_CONFIG_DEFINE(hs_cfg_desc, "HS Configuration");
 
-static const uint8_t attributes = (0);
+/* Keypresses wake a suspended host */
+static const uint8_t attributes = USB_SCD_REMOTE_WAKEUP;
+
+/* Host resumes within a few frames after the resume signalling */
+#define USB_WAKEUP_TIMEOUT_MS (100)
 
 /* Full speed configuration */
 USBD_CONFIGURATION_DEFINE(vinkey_fs_config,
@@ -55,15 +57,31 @@ static void vinkey_fix_code_triple(struct usbd_context* uds_ctx,
 }
 
 volatile bool usb_kb_ready = false;
+static volatile bool usb_suspended = false;
+static K_SEM_DEFINE(usb_resumed, 0, 1);
 
 static void msg_cb(struct usbd_context* const usbd_ctx,
                    const struct usbd_msg* const msg)
 {
-    LOG_INF("USBD message: %s", usbd_msg_type_string(msg->type));
+    LOG_DBG("USBD message: %s", usbd_msg_type_string(msg->type));
 
     if (msg->type == USBD_MSG_CONFIGURATION)
     {
         LOG_INF("\tConfiguration value %d", msg->status);
+        vinkey_boot_mark(VINKEY_BOOT_USB_CONFIGURED);
+    }
+
+    if (msg->type == USBD_MSG_SUSPEND)
+    {
+        usb_suspended = true;
+        vinkey_transport_state_changed();
+    }
+
+    if ((msg->type == USBD_MSG_RESUME || msg->type == USBD_MSG_RESET) && usb_suspended)
+    {
+        usb_suspended = false;
+        k_sem_give(&usb_resumed);
+        vinkey_transport_state_changed();
     }
 
     if (usbd_can_detect_vbus(usbd_ctx))
@@ -210,4 +228,27 @@ void vinkey_usb_init()
             failure();
         }
     }
+    vinkey_boot_mark(VINKEY_BOOT_USB_ENABLED);
+}
+
+bool vinkey_usb_suspended(void)
+{
+    return usb_suspended;
+}
+
+int vinkey_usb_wakeup(void)
+{
+    k_sem_reset(&usb_resumed);
+    if (!usb_suspended)
+    {
+        return 0;
+    }
+
+    // -EACCES unless the host armed remote wakeup before suspending
+    int err = usbd_wakeup_request(&vinkey_usbd);
+    if (err)
+    {
+        return err;
+    }
+    return k_sem_take(&usb_resumed, K_MSEC(USB_WAKEUP_TIMEOUT_MS));
 }
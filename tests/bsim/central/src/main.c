@@ -0,0 +1,770 @@
+/*
+ * BabbleSim central for the keyboard's BLE regression test. It connects at
+ * the connection interval given on the command line and keeps it, parameter
+ * update requests are rejected. It pairs with a fixed passkey, which the
+ * keyboard's synthetic input types back through vinkey_ble_handle_key(),
+ * subscribes to the input report CCCs and then follows the synthetic
+ * scenario of the keyboard.
+ *
+ * Press n of the scenario is made n periods after its start and presses
+ * digit n % 10, its release comes with the end of the chord. Both devices run
+ * on the simulation clock, so the arrival of the report that shows an event
+ * gives the latency from the matrix to the host. The scenario arguments must
+ * match the keyboard build, the defaults are its Kconfig defaults.
+ *
+ * The test passes when no more than max_drops reports were lost and no event
+ * took longer than max_latency_ms to arrive.
+ *
+ * The "dfu" test uploads a generated image of size bytes over SMP instead,
+ * one request per write without response at the negotiated MTU, and fails
+ * when the upload runs below min_kbps or does not end by deadline_s. The
+ * keyboard must be built with dfu.conf for it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/bluetooth/gatt.h>
+#include <zephyr/bluetooth/uuid.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "bs_types.h"
+#include "bs_tracing.h"
+#include "bstests.h"
+
+LOG_MODULE_REGISTER(vinkey_central, LOG_LEVEL_INF);
+
+extern enum bst_result_t bst_result;
+
+#define FAIL(...)                                                                                  \
+	do {                                                                                       \
+		bst_result = Failed;                                                               \
+		bs_trace_error_time_line(__VA_ARGS__);                                             \
+	} while (0)
+
+#define PASS(...)                                                                                  \
+	do {                                                                                       \
+		bst_result = Passed;                                                               \
+		bs_trace_info_time(1, __VA_ARGS__);                                                \
+	} while (0)
+
+#define PASSKEY   (123456)
+#define HID_KEY_1 (0x1E)
+#define DIGITS    (10)
+/* Time for the keyboard to send what is still queued after the last event */
+#define DRAIN_US  (2 * USEC_PER_SEC)
+
+static struct {
+	/* Connection interval in 1.25 ms units */
+	uint32_t interval;
+	/* The keyboard's CONFIG_VINKEY_SYNTH_* settings */
+	uint32_t start_ms;
+	uint32_t rate;
+	uint32_t keys;
+	uint32_t chord;
+	uint32_t max_drops;
+	/* 0 for two connection intervals plus 10 ms */
+	uint32_t max_latency_ms;
+	/* Image upload */
+	uint32_t size;
+	uint32_t min_kbps;
+	uint32_t deadline_s;
+} args = {
+	.interval = 24,
+	.start_ms = 5000,
+	.rate = 20,
+	.keys = 200,
+	.chord = 6,
+	.size = 64 * 1024,
+	/* Well below a working setup, well above 20 byte chunks on 27 byte packets */
+	.min_kbps = 5,
+	.deadline_s = 40,
+};
+
+static struct bt_conn *conn;
+
+/* Keyboard, consumer and system input reports, in the order the keyboard defines them */
+static struct bt_gatt_subscribe_params subs[3];
+static int sub_count;
+static int64_t subscribed_at;
+
+static struct {
+	uint32_t reports;
+	uint32_t events;
+	uint64_t latency_total_us;
+	uint32_t latency_max_us;
+	int64_t first_us;
+	int64_t last_us;
+} results;
+
+/* Digits held in the last report, the press each of them belongs to */
+static uint16_t held;
+static uint32_t pressed_as[DIGITS];
+static uint32_t next_press;
+
+static uint64_t gap_us(void)
+{
+	return USEC_PER_SEC / args.rate;
+}
+
+static int64_t press_time_us(uint32_t n)
+{
+	return args.start_ms * 1000LL + n * gap_us();
+}
+
+/* Every key of a chord is released right after its last press period */
+static int64_t release_time_us(uint32_t n)
+{
+	uint32_t end = MIN((n / args.chord + 1) * args.chord, args.keys);
+
+	return args.start_ms * 1000LL + end * gap_us();
+}
+
+static void account(int64_t now_us, int64_t made_us)
+{
+	uint32_t us = MAX(now_us - made_us, 0);
+
+	results.events++;
+	results.latency_total_us += us;
+	results.latency_max_us = MAX(results.latency_max_us, us);
+}
+
+static void keyboard_report(const uint8_t *report, uint16_t len)
+{
+	int64_t now_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	uint16_t digits = 0;
+
+	if (now_us < args.start_ms * 1000LL || len < 8) {
+		/* Passkey entry, not part of the scenario */
+		return;
+	}
+	for (int i = 2; i < 8; i++) {
+		if (report[i] >= HID_KEY_1 && report[i] < HID_KEY_1 + DIGITS) {
+			digits |= BIT(report[i] - HID_KEY_1);
+		}
+	}
+
+	results.reports++;
+	if (results.first_us == 0) {
+		results.first_us = now_us;
+	}
+	results.last_us = now_us;
+
+	/* More than one change when a report in between was lost */
+	for (int d = 0; d < DIGITS; d++) {
+		if ((digits & ~held) & BIT(d)) {
+			uint32_t n = next_press + (d - next_press % DIGITS + DIGITS) % DIGITS;
+
+			pressed_as[d] = n;
+			next_press = n + 1;
+			account(now_us, press_time_us(n));
+		} else if ((held & ~digits) & BIT(d)) {
+			account(now_us, release_time_us(pressed_as[d]));
+		}
+	}
+	held = digits;
+}
+
+static uint8_t notified(struct bt_conn *c, struct bt_gatt_subscribe_params *params,
+			const void *data, uint16_t length)
+{
+	if (data == NULL) {
+		params->value_handle = 0;
+		return BT_GATT_ITER_STOP;
+	}
+	if (params == &subs[0]) {
+		keyboard_report(data, length);
+	}
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static void subscribe_next(struct bt_conn *c, uint8_t err, struct bt_gatt_subscribe_params *params);
+
+static int subscribe(int i)
+{
+	subs[i].notify = notified;
+	subs[i].subscribe = subscribe_next;
+	subs[i].value = BT_GATT_CCC_NOTIFY;
+	/* The keyboard puts every CCC right behind its value */
+	subs[i].ccc_handle = subs[i].value_handle + 1;
+	return bt_gatt_subscribe(conn, &subs[i]);
+}
+
+static void subscribe_next(struct bt_conn *c, uint8_t err, struct bt_gatt_subscribe_params *params)
+{
+	int i = params - subs;
+
+	if (err) {
+		FAIL("Subscribing to report %d failed (err %u)\n", i, err);
+	}
+	if (i + 1 < sub_count) {
+		int ret = subscribe(i + 1);
+
+		if (ret) {
+			FAIL("Subscribe %d failed (err %d)\n", i + 1, ret);
+		}
+		return;
+	}
+	subscribed_at = k_uptime_get();
+	LOG_INF("Subscribed to %d input reports after %lld ms", sub_count, subscribed_at);
+}
+
+static struct bt_gatt_discover_params discover_params;
+static struct bt_uuid_16 discover_uuid;
+
+static uint8_t report_found(struct bt_conn *c, const struct bt_gatt_attr *attr,
+			    struct bt_gatt_discover_params *params)
+{
+	if (attr == NULL) {
+		if (sub_count == 0) {
+			FAIL("No input reports found\n");
+		}
+		int err = subscribe(0);
+
+		if (err) {
+			FAIL("Subscribe failed (err %d)\n", err);
+		}
+		return BT_GATT_ITER_STOP;
+	}
+
+	const struct bt_gatt_chrc *chrc = attr->user_data;
+
+	if ((chrc->properties & BT_GATT_CHRC_NOTIFY) && sub_count < ARRAY_SIZE(subs)) {
+		subs[sub_count++].value_handle = chrc->value_handle;
+	}
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static uint8_t service_found(struct bt_conn *c, const struct bt_gatt_attr *attr,
+			     struct bt_gatt_discover_params *params)
+{
+	if (attr == NULL) {
+		FAIL("No HID service found\n");
+		return BT_GATT_ITER_STOP;
+	}
+
+	const struct bt_gatt_service_val *svc = attr->user_data;
+
+	discover_uuid = (struct bt_uuid_16)BT_UUID_INIT_16(BT_UUID_HIDS_REPORT_VAL);
+	discover_params.uuid = &discover_uuid.uuid;
+	discover_params.func = report_found;
+	discover_params.start_handle = attr->handle + 1;
+	discover_params.end_handle = svc->end_handle;
+	discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+	int err = bt_gatt_discover(c, &discover_params);
+
+	if (err) {
+		FAIL("Report discovery failed (err %d)\n", err);
+	}
+	return BT_GATT_ITER_STOP;
+}
+
+static void discover(void)
+{
+	discover_uuid = (struct bt_uuid_16)BT_UUID_INIT_16(BT_UUID_HIDS_VAL);
+	discover_params.uuid = &discover_uuid.uuid;
+	discover_params.func = service_found;
+	discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	discover_params.type = BT_GATT_DISCOVER_PRIMARY;
+
+	int err = bt_gatt_discover(conn, &discover_params);
+
+	if (err) {
+		FAIL("Service discovery failed (err %d)\n", err);
+	}
+}
+
+/* MCUmgr SMP over BLE, an image upload at the negotiated MTU */
+#define SMP_OP_WRITE     (2)
+#define SMP_GROUP_IMAGE  (1)
+#define SMP_ID_UPLOAD    (1)
+#define SMP_HDR_SIZE     (8)
+/* CBOR map and keys around the data of an upload request, rounded up */
+#define SMP_REQ_OVERHEAD (40)
+#define IMAGE_MAGIC      (0x96f3b83d)
+#define IMAGE_HDR_SIZE   (32)
+
+static bool dfu_test;
+static uint16_t smp_handle;
+static struct bt_gatt_subscribe_params smp_sub;
+static struct bt_gatt_exchange_params mtu_params;
+static K_SEM_DEFINE(smp_ready, 0, 1);
+static K_SEM_DEFINE(smp_response, 0, 1);
+/* Offset the keyboard asked for next, negative for an error */
+static int64_t smp_off;
+
+static uint8_t *cbor_head(uint8_t *p, uint8_t major, uint32_t value)
+{
+	if (value < 24) {
+		*p++ = major << 5 | value;
+	} else if (value <= UINT8_MAX) {
+		*p++ = major << 5 | 24;
+		*p++ = value;
+	} else if (value <= UINT16_MAX) {
+		*p++ = major << 5 | 25;
+		sys_put_be16(value, p);
+		p += 2;
+	} else {
+		*p++ = major << 5 | 26;
+		sys_put_be32(value, p);
+		p += 4;
+	}
+	return p;
+}
+
+static uint8_t *cbor_key(uint8_t *p, const char *key)
+{
+	size_t len = strlen(key);
+
+	p = cbor_head(p, 3, len);
+	memcpy(p, key, len);
+	return p + len;
+}
+
+/* Unsigned value of a text key in a flat response map, -1 if it is not there */
+static int64_t cbor_find_uint(const uint8_t *p, uint16_t len, const char *key)
+{
+	size_t key_len = strlen(key);
+
+	for (uint16_t i = 0; i + key_len + 2 <= len; i++) {
+		if (p[i] != (0x60 | key_len) || memcmp(&p[i + 1], key, key_len) != 0) {
+			continue;
+		}
+
+		const uint8_t *v = &p[i + 1 + key_len];
+		const uint8_t *end = p + len;
+		uint8_t info = *v & 0x1f;
+
+		if ((*v >> 5) != 0) {
+			return -1;
+		}
+		if (info < 24) {
+			return info;
+		}
+		if (info == 24 && v + 1 < end) {
+			return v[1];
+		}
+		if (info == 25 && v + 2 < end) {
+			return sys_get_be16(&v[1]);
+		}
+		if (info == 26 && v + 4 < end) {
+			return sys_get_be32(&v[1]);
+		}
+		return -1;
+	}
+	return -1;
+}
+
+static uint8_t smp_notified(struct bt_conn *c, struct bt_gatt_subscribe_params *params,
+			    const void *data, uint16_t length)
+{
+	if (data == NULL) {
+		params->value_handle = 0;
+		return BT_GATT_ITER_STOP;
+	}
+	if (length <= SMP_HDR_SIZE) {
+		return BT_GATT_ITER_CONTINUE;
+	}
+
+	const uint8_t *payload = (const uint8_t *)data + SMP_HDR_SIZE;
+	uint16_t len = length - SMP_HDR_SIZE;
+	int64_t rc = cbor_find_uint(payload, len, "rc");
+
+	smp_off = rc > 0 ? -rc : cbor_find_uint(payload, len, "off");
+	k_sem_give(&smp_response);
+	return BT_GATT_ITER_CONTINUE;
+}
+
+static void smp_subscribed(struct bt_conn *c, uint8_t err, struct bt_gatt_subscribe_params *params)
+{
+	if (err) {
+		FAIL("Subscribing to SMP failed (err %u)\n", err);
+	}
+	k_sem_give(&smp_ready);
+}
+
+static uint8_t smp_found(struct bt_conn *c, const struct bt_gatt_attr *attr,
+			 struct bt_gatt_discover_params *params)
+{
+	if (attr == NULL) {
+		FAIL("No SMP characteristic found\n");
+		return BT_GATT_ITER_STOP;
+	}
+
+	const struct bt_gatt_chrc *chrc = attr->user_data;
+
+	smp_handle = chrc->value_handle;
+	smp_sub.notify = smp_notified;
+	smp_sub.subscribe = smp_subscribed;
+	smp_sub.value = BT_GATT_CCC_NOTIFY;
+	smp_sub.value_handle = smp_handle;
+	smp_sub.ccc_handle = smp_handle + 1;
+
+	int err = bt_gatt_subscribe(c, &smp_sub);
+
+	if (err) {
+		FAIL("SMP subscribe failed (err %d)\n", err);
+	}
+	return BT_GATT_ITER_STOP;
+}
+
+static void mtu_exchanged(struct bt_conn *c, uint8_t err, struct bt_gatt_exchange_params *params)
+{
+	static struct bt_uuid_128 smp_uuid = BT_UUID_INIT_128(
+		BT_UUID_128_ENCODE(0xda2e7828, 0xfbce, 0x4e01, 0xae9e, 0x261174997c48));
+
+	LOG_INF("ATT MTU %u%s", bt_gatt_get_mtu(c), err ? ", exchange failed" : "");
+
+	discover_params.uuid = &smp_uuid.uuid;
+	discover_params.func = smp_found;
+	discover_params.start_handle = BT_ATT_FIRST_ATTRIBUTE_HANDLE;
+	discover_params.end_handle = BT_ATT_LAST_ATTRIBUTE_HANDLE;
+	discover_params.type = BT_GATT_DISCOVER_CHARACTERISTIC;
+
+	int ret = bt_gatt_discover(c, &discover_params);
+
+	if (ret) {
+		FAIL("SMP discovery failed (err %d)\n", ret);
+	}
+}
+
+/* MCUboot header in front of pseudo random contents, all the upload checks */
+static void image_chunk(uint8_t *buf, uint32_t off, uint32_t len)
+{
+	for (uint32_t i = 0; i < len; i++) {
+		uint32_t pos = off + i;
+
+		buf[i] = pos < IMAGE_HDR_SIZE ? 0 : (pos * 2654435761U) >> 24;
+	}
+	if (off == 0) {
+		sys_put_le32(IMAGE_MAGIC, &buf[0]);
+		sys_put_le16(IMAGE_HDR_SIZE, &buf[8]);
+		sys_put_le32(args.size - IMAGE_HDR_SIZE, &buf[12]);
+	}
+}
+
+static void upload(void)
+{
+	static uint8_t frame[CONFIG_BT_L2CAP_TX_MTU];
+	uint32_t chunk = bt_gatt_get_mtu(conn) - 3 - SMP_REQ_OVERHEAD;
+	int64_t start_us = k_ticks_to_us_floor64(k_uptime_ticks());
+	uint32_t off = 0;
+	uint8_t seq = 0;
+
+	chunk = MIN(chunk, sizeof(frame) - SMP_REQ_OVERHEAD);
+	while (off < args.size) {
+		uint32_t n = MIN(chunk, args.size - off);
+		uint8_t *p = frame + SMP_HDR_SIZE;
+
+		p = cbor_head(p, 5, off == 0 ? 3 : 2);
+		p = cbor_key(p, "off");
+		p = cbor_head(p, 0, off);
+		if (off == 0) {
+			p = cbor_key(p, "len");
+			p = cbor_head(p, 0, args.size);
+		}
+		p = cbor_key(p, "data");
+		p = cbor_head(p, 2, n);
+		image_chunk(p, off, n);
+		p += n;
+
+		frame[0] = SMP_OP_WRITE;
+		frame[1] = 0;
+		sys_put_be16(p - frame - SMP_HDR_SIZE, &frame[2]);
+		sys_put_be16(SMP_GROUP_IMAGE, &frame[4]);
+		frame[6] = seq++;
+		frame[7] = SMP_ID_UPLOAD;
+
+		int err = bt_gatt_write_without_response(conn, smp_handle, frame, p - frame, false);
+
+		if (err) {
+			FAIL("SMP write failed (err %d)\n", err);
+		}
+		if (k_sem_take(&smp_response, K_SECONDS(5)) != 0) {
+			FAIL("No SMP response at offset %u\n", off);
+		}
+		if (smp_off < 0) {
+			FAIL("Upload refused at offset %u (rc %d)\n", off, (int)-smp_off);
+		}
+		off = smp_off;
+	}
+
+	uint32_t ms = MAX((k_ticks_to_us_floor64(k_uptime_ticks()) - start_us) / 1000, 1);
+	uint32_t kbps = (uint64_t)args.size * 1000 / 1024 / ms;
+
+	bs_trace_raw_time(0, "interval %u.%02u ms: %u bytes in %u ms, %u byte chunks, %u KB/s\n",
+			  args.interval * 125 / 100, args.interval * 125 % 100, args.size, ms,
+			  chunk, kbps);
+	if (kbps < args.min_kbps) {
+		FAIL("Upload at %u KB/s, %u KB/s required\n", kbps, args.min_kbps);
+	}
+	PASS("Central passed\n");
+}
+
+static bool find_hids(struct bt_data *data, void *user_data)
+{
+	bool *found = user_data;
+
+	if (data->type != BT_DATA_UUID16_ALL && data->type != BT_DATA_UUID16_SOME) {
+		return true;
+	}
+	for (int i = 0; i + 1 < data->data_len; i += 2) {
+		if (sys_get_le16(&data->data[i]) == BT_UUID_HIDS_VAL) {
+			*found = true;
+		}
+	}
+	return true;
+}
+
+static void device_found(const bt_addr_le_t *addr, int8_t rssi, uint8_t type,
+			 struct net_buf_simple *ad)
+{
+	bool hids = false;
+
+	if (conn != NULL || (type != BT_GAP_ADV_TYPE_ADV_IND &&
+			     type != BT_GAP_ADV_TYPE_ADV_DIRECT_IND)) {
+		return;
+	}
+	bt_data_parse(ad, find_hids, &hids);
+	if (!hids) {
+		return;
+	}
+
+	struct bt_le_conn_param param = {
+		.interval_min = args.interval,
+		.interval_max = args.interval,
+		.latency = 0,
+		.timeout = 400,
+	};
+	int err = bt_le_scan_stop();
+
+	if (err) {
+		FAIL("Scan stop failed (err %d)\n", err);
+	}
+	err = bt_conn_le_create(addr, BT_CONN_LE_CREATE_CONN, &param, &conn);
+	if (err) {
+		FAIL("Connecting failed (err %d)\n", err);
+	}
+}
+
+static void connected(struct bt_conn *c, uint8_t err)
+{
+	if (err) {
+		FAIL("Connection failed (err 0x%02x)\n", err);
+	}
+	LOG_INF("Connected at %u.%02u ms", args.interval * 125 / 100, args.interval * 125 % 100);
+
+	int ret = bt_conn_set_security(c, BT_SECURITY_L4);
+
+	if (ret) {
+		FAIL("Security request failed (err %d)\n", ret);
+	}
+}
+
+static void disconnected(struct bt_conn *c, uint8_t reason)
+{
+	FAIL("Disconnected (reason 0x%02x)\n", reason);
+}
+
+static void security_changed(struct bt_conn *c, bt_security_t level, enum bt_security_err err)
+{
+	if (err) {
+		FAIL("Security failed (err %d)\n", err);
+	}
+	LOG_INF("Security level %d", level);
+	if (!dfu_test) {
+		discover();
+		return;
+	}
+	mtu_params.func = mtu_exchanged;
+
+	int ret = bt_gatt_exchange_mtu(c, &mtu_params);
+
+	if (ret) {
+		FAIL("MTU exchange failed (err %d)\n", ret);
+	}
+}
+
+/* The interval under test is kept, whatever the keyboard would prefer */
+static bool le_param_req(struct bt_conn *c, struct bt_le_conn_param *param)
+{
+	return false;
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+	.connected = connected,
+	.disconnected = disconnected,
+	.security_changed = security_changed,
+	.le_param_req = le_param_req,
+};
+
+static void passkey_display(struct bt_conn *c, unsigned int passkey)
+{
+	LOG_INF("Passkey %06u, typed by the keyboard's synthetic input", passkey);
+}
+
+static void auth_cancel(struct bt_conn *c)
+{
+	FAIL("Pairing cancelled\n");
+}
+
+static struct bt_conn_auth_cb auth_cb = {
+	.passkey_display = passkey_display,
+	.cancel = auth_cancel,
+};
+
+static void pairing_failed(struct bt_conn *c, enum bt_security_err reason)
+{
+	FAIL("Pairing failed (reason %d)\n", reason);
+}
+
+static struct bt_conn_auth_info_cb auth_info_cb = {
+	.pairing_failed = pairing_failed,
+};
+
+static void test_args(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		uint32_t *value;
+	} options[] = {
+		{"interval", &args.interval},
+		{"start_ms", &args.start_ms},
+		{"rate", &args.rate},
+		{"keys", &args.keys},
+		{"chord", &args.chord},
+		{"max_drops", &args.max_drops},
+		{"max_latency_ms", &args.max_latency_ms},
+		{"size", &args.size},
+		{"min_kbps", &args.min_kbps},
+		{"deadline_s", &args.deadline_s},
+	};
+
+	for (int i = 0; i + 1 < argc; i += 2) {
+		int j = 0;
+
+		while (j < ARRAY_SIZE(options) && strcmp(argv[i], options[j].name) != 0) {
+			j++;
+		}
+		if (j == ARRAY_SIZE(options)) {
+			bs_trace_error_line("Unknown argument %s\n", argv[i]);
+		}
+		*options[j].value = strtoul(argv[i + 1], NULL, 10);
+	}
+	if (args.max_latency_ms == 0) {
+		args.max_latency_ms = args.interval * 125 * 2 / 100 + 10;
+	}
+	args.rate = MAX(args.rate, 1);
+	args.chord = CLAMP(args.chord, 1, 6);
+	args.size = MAX(args.size, IMAGE_HDR_SIZE);
+}
+
+static void test_init(void)
+{
+	bst_ticker_set_next_tick_absolute(args.start_ms * 1000ULL + args.keys * gap_us() + DRAIN_US);
+	bst_result = In_progress;
+}
+
+/* After the scenario and the drain time, the verdict */
+static void test_tick(bs_time_t HW_device_time)
+{
+	uint32_t expected = 2 * args.keys;
+	uint32_t drops = expected - MIN(results.reports, expected);
+	uint32_t avg_us = results.events ? results.latency_total_us / results.events : 0;
+	uint32_t span_ms = MAX((results.last_us - results.first_us) / 1000, 1);
+
+	bs_trace_raw_time(0, "interval %u.%02u ms: %u/%u reports, %u dropped, %u per s, "
+			  "latency %u us (max %u us)\n",
+			  args.interval * 125 / 100, args.interval * 125 % 100, results.reports,
+			  expected, drops, results.reports * 1000 / span_ms, avg_us,
+			  results.latency_max_us);
+
+	if (subscribed_at == 0 || subscribed_at > args.start_ms) {
+		FAIL("Not subscribed before the scenario started\n");
+	} else if (drops > args.max_drops) {
+		FAIL("%u reports dropped, %u allowed\n", drops, args.max_drops);
+	} else if (results.latency_max_us > args.max_latency_ms * 1000) {
+		FAIL("Latency %u us, %u ms allowed\n", results.latency_max_us, args.max_latency_ms);
+	} else {
+		PASS("Central passed\n");
+	}
+}
+
+static void test_main(void)
+{
+	int err = bt_enable(NULL);
+
+	if (err) {
+		FAIL("Bluetooth init failed (err %d)\n", err);
+	}
+	bt_passkey_set(PASSKEY);
+	bt_conn_auth_cb_register(&auth_cb);
+	bt_conn_auth_info_cb_register(&auth_info_cb);
+
+	err = bt_le_scan_start(BT_LE_SCAN_PASSIVE, device_found);
+	if (err) {
+		FAIL("Scanning failed (err %d)\n", err);
+	}
+}
+
+static void test_dfu_init(void)
+{
+	dfu_test = true;
+	bst_ticker_set_next_tick_absolute(args.deadline_s * USEC_PER_SEC);
+	bst_result = In_progress;
+}
+
+static void test_dfu_tick(bs_time_t HW_device_time)
+{
+	if (bst_result != Passed) {
+		FAIL("Upload not done after %u s\n", args.deadline_s);
+	}
+}
+
+static void test_dfu_main(void)
+{
+	test_main();
+	k_sem_take(&smp_ready, K_FOREVER);
+	upload();
+}
+
+static const struct bst_test_instance test_central[] = {
+	{
+		.test_id = "central",
+		.test_descr = "Pairs with the keyboard, subscribes to its input reports and "
+			      "measures report latency and loss at one connection interval",
+		.test_args_f = test_args,
+		.test_post_init_f = test_init,
+		.test_tick_f = test_tick,
+		.test_main_f = test_main,
+	},
+	{
+		.test_id = "dfu",
+		.test_descr = "Pairs with the keyboard and measures the throughput of an SMP "
+			      "image upload at one connection interval",
+		.test_args_f = test_args,
+		.test_post_init_f = test_dfu_init,
+		.test_tick_f = test_dfu_tick,
+		.test_main_f = test_dfu_main,
+	},
+	BSTEST_END_MARKER
+};
+
+static struct bst_test_list *test_central_install(struct bst_test_list *tests)
+{
+	return bst_add_tests(tests, test_central);
+}
+
+bst_test_install_t test_installers[] = {test_central_install, NULL};
+
+int main(void)
+{
+	bst_main();
+	return 0;
+}
@@ -0,0 +1,22 @@
+#!/usr/bin/env bash
+# Builds the keyboard and the test central for nrf52_bsim and installs both in
+# ${BSIM_OUT_PATH}/bin, where run.sh expects them. Scenario settings of the
+# keyboard can be passed through, e.g. -DCONFIG_VINKEY_SYNTH_KEYS=100, run.sh
+# must then be given the matching central arguments. A third keyboard image
+# with dfu.conf is built for the upload test of run.sh.
+set -eu
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set to the BabbleSim install}"
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+
+repo=$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)
+build=${BUILD_DIR:-${repo}/build-bsim}
+
+west build -p -b nrf52_bsim --no-sysbuild -d "${build}/keyboard" "${repo}" -- "$@"
+west build -p -b nrf52_bsim --no-sysbuild -d "${build}/dfu" "${repo}" -- \
+	-DEXTRA_CONF_FILE=dfu.conf -DCONFIG_BOOTLOADER_MCUBOOT=y
+west build -p -b nrf52_bsim --no-sysbuild -d "${build}/central" "${repo}/tests/bsim/central"
+
+cp "${build}/keyboard/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_bsim_vinkey"
+cp "${build}/dfu/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_bsim_vinkey_dfu"
+cp "${build}/central/zephyr/zephyr.exe" "${BSIM_OUT_PATH}/bin/bs_nrf52_bsim_vinkey_central"
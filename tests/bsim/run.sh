@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+# BLE regression test: the keyboard with synthetic input and the test central
+# in one simulation, once per connection interval. The central pairs through
+# passkey entry, subscribes and checks report loss and latency against the
+# thresholds below; the script exits non-zero on the first interval that
+# fails. Build the images with compile.sh first.
+#
+# Intervals are in 1.25 ms units. The default latency limit of the central is
+# two intervals plus 10 ms: one interval waiting for the next connection
+# event, one for a retransmission and the key path on top.
+#
+# A last run uploads an image to the dfu.conf keyboard over SMP at
+# DFU_INTERVAL and fails below DFU_MIN_KBPS, see the central for the test.
+set -u
+
+: "${BSIM_OUT_PATH:?BSIM_OUT_PATH must be set to the BabbleSim install}"
+: "${ZEPHYR_BASE:?ZEPHYR_BASE must be set}"
+
+source "${ZEPHYR_BASE}/tests/bsim/sh_common.source"
+
+intervals=${INTERVALS:-"6 12 24 40"}
+max_drops=${MAX_DROPS:-0}
+# Must match the keyboard build, CONFIG_VINKEY_SYNTH_BOOT_DELAY_MS, _RATE and _KEYS
+start_ms=5000
+rate=20
+keys=200
+# Scenario, drain time of the central, and a second to spare
+sim_length=$(( (start_ms + keys * 1000 / rate + 3000) * 1000 ))
+
+dfu_interval=${DFU_INTERVAL:-12}
+dfu_min_kbps=${DFU_MIN_KBPS:-5}
+dfu_size=$(( 64 * 1024 ))
+dfu_deadline_s=40
+
+verbosity_level=2
+EXECUTE_TIMEOUT=${EXECUTE_TIMEOUT:-300}
+
+cd "${BSIM_OUT_PATH}/bin"
+
+for interval in ${intervals}; do
+	simulation_id="vinkey_hid_${interval}"
+
+	Execute ./bs_nrf52_bsim_vinkey -v=${verbosity_level} -s=${simulation_id} -d=0 \
+		-RealEncryption=1
+	Execute ./bs_nrf52_bsim_vinkey_central -v=${verbosity_level} -s=${simulation_id} -d=1 \
+		-RealEncryption=1 -testid=central -argstest interval ${interval} \
+		start_ms ${start_ms} rate ${rate} keys ${keys} max_drops ${max_drops}
+	Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} -D=2 \
+		-sim_length=${sim_length}
+
+	wait_for_background_jobs
+done
+
+simulation_id="vinkey_dfu_${dfu_interval}"
+
+Execute ./bs_nrf52_bsim_vinkey_dfu -v=${verbosity_level} -s=${simulation_id} -d=0 \
+	-RealEncryption=1
+Execute ./bs_nrf52_bsim_vinkey_central -v=${verbosity_level} -s=${simulation_id} -d=1 \
+	-RealEncryption=1 -testid=dfu -argstest interval ${dfu_interval} size ${dfu_size} \
+	min_kbps ${dfu_min_kbps} deadline_s ${dfu_deadline_s}
+Execute ./bs_2G4_phy_v1 -v=${verbosity_level} -s=${simulation_id} -D=2 \
+	-sim_length=$(( (dfu_deadline_s + 5) * 1000000 ))
+
+wait_for_background_jobs
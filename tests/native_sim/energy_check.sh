@@ -0,0 +1,101 @@
+#!/usr/bin/env bash
+# Energy regression check: builds the keyboard for native_sim, runs its
+# synthetic scenario on the simulated clock, without pacing it to real time,
+# and compares the charge per part logged after the run with
+# energy_baseline.txt. A part that drew more than TOLERANCE percent (default
+# 5) above its baseline fails the check; one that drew less is reported, so
+# the baseline can be lowered with the change that saved it.
+#
+#   tests/native_sim/energy_check.sh [-u] [build dir]
+#
+# -u records this run as the new baseline, to be committed with the change
+# that moved it. The run lasts ENERGY_S simulated seconds, 60 by default or
+# what the baseline was recorded with, a multiple of CONFIG_VINKEY_ENERGY_LOG_S.
+#
+# The CPU part is its idle current and little else on native_sim: the
+# firmware runs in zero simulated time there, so the kernel counts almost no
+# busy cycles. It catches idle time changes only, not CPU load.
+set -eu
+
+update=0
+if [ "${1:-}" = "-u" ]; then
+	update=1
+	shift
+fi
+
+repo=$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)
+build=${1:-${repo}/build-native-sim}
+baseline=${repo}/tests/native_sim/energy_baseline.txt
+tolerance=${TOLERANCE:-5}
+log=${build}/energy.log
+
+if [ "${update}" -eq 0 ] && [ ! -f "${baseline}" ]; then
+	echo "no ${baseline}, record one with -u on a known good build" >&2
+	exit 1
+fi
+if [ "${update}" -eq 0 ]; then
+	energy_s=$(sed -n 's/^seconds=//p' "${baseline}")
+fi
+energy_s=${ENERGY_S:-${energy_s:-60}}
+
+west build -b native_sim --no-sysbuild -d "${build}" "${repo}"
+
+# A second more for the deferred log to drain
+"${build}/zephyr/zephyr.exe" -no-rt -stop_at=$(( energy_s + 1 )) > "${log}" 2>&1
+
+# "<part>=<uAh>" per part and for the total, part names with _ for spaces
+result=$(awk -v mark="Energy after ${energy_s} s" '
+	index($0, mark) { n = 8; next }
+	n > 0 && / mAh, [0-9]+ uA/ {
+		n--
+		line = $0
+		sub(/.*vinkey_energy: /, "", line)
+		match(line, /[0-9]+\.[0-9]+ mAh/)
+		name = substr(line, 1, RSTART - 1)
+		sub(/ +$/, "", name)
+		gsub(/ /, "_", name)
+		split(substr(line, RSTART, RLENGTH - 4), mah, ".")
+		print name "=" mah[1] * 1000 + mah[2]
+	}' "${log}")
+
+if [ -z "${result}" ]; then
+	echo "no energy estimate after ${energy_s} s in ${log}" >&2
+	exit 1
+fi
+
+if [ "${update}" -eq 1 ]; then
+	{
+		echo "seconds=${energy_s}"
+		echo "${result}"
+	} > "${baseline}"
+	echo "baseline of ${energy_s} s written to ${baseline}:"
+	echo "${result}"
+	exit 0
+fi
+
+status=0
+while IFS== read -r part uah; do
+	base=$(sed -n "s/^${part}=//p" "${baseline}")
+	if [ -z "${base}" ]; then
+		echo "${part}: ${uah} uAh, not in the baseline" >&2
+		status=1
+		continue
+	fi
+
+	# One uAh of slack for the rounding of the log
+	slack=$(( base * tolerance / 100 + 1 ))
+
+	if [ "${uah}" -gt $(( base + slack )) ]; then
+		echo "${part}: ${uah} uAh, baseline ${base} uAh, more than ${tolerance}% above" >&2
+		status=1
+	elif [ "${uah}" -lt $(( base - slack )) ]; then
+		echo "${part}: ${uah} uAh, baseline ${base} uAh, below it, update the baseline"
+	else
+		echo "${part}: ${uah} uAh, baseline ${base} uAh"
+	fi
+done <<< "${result}"
+
+if [ "${status}" -ne 0 ]; then
+	echo "energy check failed, firmware log in ${log}" >&2
+fi
+exit "${status}"
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Captures the dictionary encoded RTT log and formats it on the host.
+#
+#   tools/rtt-log.sh [build dir] [J-Link device]
+#
+# Needs the J-Link software (JLinkRTTLogger) and ZEPHYR_BASE for the parser.
+# Press Ctrl+C to stop capturing, the messages are decoded afterwards.
+
+BUILD_DIR=${1:-build}
+DEVICE=${2:-NRF52840_XXAA}
+DICT="$BUILD_DIR/zephyr/log_dictionary.json"
+CAPTURE=$(mktemp /tmp/vinkey-rtt.XXXXXX)
+
+if [ ! -f "$DICT" ]; then
+	echo "$DICT not found, build with dictionary logging first" >&2
+	exit 1
+fi
+: "${ZEPHYR_BASE:?ZEPHYR_BASE is not set}"
+
+trap 'true' INT
+JLinkRTTLogger -Device "$DEVICE" -If SWD -Speed 4000 -RTTChannel 0 "$CAPTURE"
+trap - INT
+
+python3 "$ZEPHYR_BASE/scripts/logging/dictionary/log_parser.py" --raw-input "$DICT" "$CAPTURE"
+rm -f "$CAPTURE"
@@ -0,0 +1,64 @@
+#!/usr/bin/env bash
+# Builds the keyboard for native_sim, attaches it over USB/IP, runs the
+# cadence check against its synthetic input run and exits with the check's
+# status. VID, PID and the number of presses come from the build's .config.
+# usbip and the hidraw node need root, those steps run under sudo.
+#
+#   tools/vinkey-cadence/native_sim_check.sh [build dir]
+set -eu
+
+repo=$(cd "$(dirname "${BASH_SOURCE[0]}")/../.." && pwd)
+build=${1:-${repo}/build-native-sim}
+cadence=${repo}/tools/vinkey-cadence/vinkey-cadence
+
+west build -p -b native_sim --no-sysbuild -d "${build}" "${repo}"
+make -C "${repo}/tools/vinkey-cadence"
+
+config() {
+	sed -n "s/^$1=\"\{0,1\}\([^\"]*\)\"\{0,1\}$/\1/p" "${build}/zephyr/.config"
+}
+
+vid=$(config CONFIG_VINKEY_USB_VID)
+pid=$(config CONFIG_VINKEY_USB_PID)
+keys=$(config CONFIG_VINKEY_SYNTH_KEYS)
+boot_delay_s=$(( $(config CONFIG_VINKEY_SYNTH_BOOT_DELAY_MS) / 1000 ))
+usb_id=$(printf "%04x:%04x" "${vid}" "${pid}")
+
+# USB/IP port the keyboard is attached to, empty while it is not
+attached_port() {
+	sudo usbip port 2>/dev/null |
+		awk -v id="(${usb_id})" '/^Port/ { port = $2 + 0 } index($0, id) { print port; exit }'
+}
+
+cleanup() {
+	local port
+
+	port=$(attached_port)
+	if [ -n "${port}" ]; then
+		sudo usbip detach -p "${port}" || true
+	fi
+	kill "${sim}" 2>/dev/null || true
+	wait "${sim}" 2>/dev/null || true
+}
+
+sudo modprobe vhci-hcd
+
+"${build}/zephyr/zephyr.exe" > "${build}/native_sim.log" 2>&1 &
+sim=$!
+trap cleanup EXIT
+
+# The USB/IP server exports the device once USB is enabled
+for _ in $(seq 50); do
+	if sudo usbip list -r 127.0.0.1 2>/dev/null | grep -q "1-1"; then
+		break
+	fi
+	sleep 0.2
+done
+sudo usbip attach -r 127.0.0.1 -b 1-1
+
+status=0
+sudo "${cadence}" -v "${vid}" -p "${pid}" -n "${keys}" -w $(( boot_delay_s + 30 )) || status=$?
+if [ "${status}" -ne 0 ]; then
+	echo "cadence check failed, firmware log in ${build}/native_sim.log" >&2
+fi
+exit "${status}"
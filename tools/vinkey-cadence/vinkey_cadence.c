@@ -0,0 +1,309 @@
+/*
+ * Measures the keyboard report cadence on the host and checks that no key
+ * press or release got lost, for the synthetic input runs of the native_sim
+ * build attached over USB/IP (or a real keyboard with CONFIG_VINKEY_SYNTH_INPUT).
+ *
+ *   vinkey-cadence [-v vid] [-p pid] [-n presses] [-t idle seconds]
+ *                  [-w start seconds] [/dev/hidrawN]
+ *
+ * Without a device path the first hidraw node with the given VID/PID (the
+ * CONFIG_VINKEY_USB_VID/PID defaults if not given) and a keyboard report
+ * descriptor is used. The presses expected are the build's
+ * CONFIG_VINKEY_SYNTH_KEYS, native_sim_check.sh passes all three from the
+ * build's .config. With -w the device may show up and the run start that
+ * many seconds later, without it the tool waits as long as it takes.
+ *
+ * Reads until the expected number of presses and releases has been seen or
+ * the reports stop for the idle time, then prints the gaps between reports
+ * against the 1 ms polling period. Reports queued back to back (chord
+ * releases) should come one per frame, never two in one. Exits with 1 when a
+ * press or release is missing.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+
+/* Kconfig defaults of CONFIG_VINKEY_USB_VID and CONFIG_VINKEY_USB_PID */
+#define DEFAULT_VID (0x16C0)
+#define DEFAULT_PID (0x27DB)
+
+#define REPORT_ID_KEYBOARD (1)
+#define POLL_US            (1000)
+/* Gaps up to this long are reports that were queued behind each other */
+#define BURST_US           (5000)
+
+static const struct {
+	uint32_t below_us;
+	const char *label;
+} buckets[] = {
+	{750, "< 0.75 ms (two in a frame)"},
+	{1250, "  1 ms"},
+	{2250, "  2 ms"},
+	{BURST_US, "< 5 ms"},
+	{50000, "< 50 ms"},
+	{UINT32_MAX, "longer"},
+};
+
+#define BUCKET_COUNT (sizeof(buckets) / sizeof(buckets[0]))
+
+struct cadence {
+	uint32_t reports;
+	uint32_t presses;
+	uint32_t releases;
+	uint32_t histogram[BUCKET_COUNT];
+	uint64_t burst_total_us;
+	uint32_t bursts;
+	uint32_t min_us;
+	uint32_t max_burst_us;
+	uint8_t down[256];
+};
+
+static uint16_t vid = DEFAULT_VID;
+static uint16_t pid = DEFAULT_PID;
+
+static int is_keyboard_interface(int fd)
+{
+	struct hidraw_devinfo info;
+	struct hidraw_report_descriptor desc = {0};
+	int size;
+
+	if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+	    (uint16_t)info.vendor != vid || (uint16_t)info.product != pid) {
+		return 0;
+	}
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0 || size < 4) {
+		return 0;
+	}
+	desc.size = size;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0) {
+		return 0;
+	}
+	/* Usage Page (Generic Desktop), Usage (Keyboard) */
+	return desc.value[0] == 0x05 && desc.value[1] == 0x01 &&
+	       desc.value[2] == 0x09 && desc.value[3] == 0x06;
+}
+
+static int open_keyboard_device(void)
+{
+	DIR *dir = opendir("/dev");
+	struct dirent *entry;
+	int fd = -1;
+
+	if (dir == NULL) {
+		return -1;
+	}
+	while (fd < 0 && (entry = readdir(dir)) != NULL) {
+		char path[300];
+
+		if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+		fd = open(path, O_RDONLY);
+		if (fd >= 0 && !is_keyboard_interface(fd)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	closedir(dir);
+	return fd;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void account_gap(struct cadence *c, uint32_t us)
+{
+	size_t i = 0;
+
+	while (us >= buckets[i].below_us) {
+		i++;
+	}
+	c->histogram[i]++;
+	if (c->min_us == 0 || us < c->min_us) {
+		c->min_us = us;
+	}
+	if (us < BURST_US) {
+		c->burst_total_us += us;
+		c->bursts++;
+		if (us > c->max_burst_us) {
+			c->max_burst_us = us;
+		}
+	}
+}
+
+/* Keyboard report in report or boot protocol, NULL for the other reports */
+static const uint8_t *report_keys(const uint8_t *buf, ssize_t len)
+{
+	if (len == 9 && buf[0] == REPORT_ID_KEYBOARD) {
+		return buf + 3;
+	}
+	if (len == 8) {
+		return buf + 2;
+	}
+	return NULL;
+}
+
+static void account_keys(struct cadence *c, const uint8_t *keys)
+{
+	uint8_t now[256] = {0};
+
+	for (int i = 0; i < 6; i++) {
+		now[keys[i]] = 1;
+	}
+	/* Usage 0 is an empty slot, 1 a rollover error */
+	now[0] = now[1] = 0;
+	for (int usage = 2; usage < 256; usage++) {
+		if (now[usage] && !c->down[usage]) {
+			c->presses++;
+		} else if (!now[usage] && c->down[usage]) {
+			c->releases++;
+		}
+		c->down[usage] = now[usage];
+	}
+}
+
+static int any_down(const struct cadence *c)
+{
+	for (int usage = 0; usage < 256; usage++) {
+		if (c->down[usage]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void print_summary(const struct cadence *c, uint32_t expected)
+{
+	printf("%u keyboard reports, %u/%u presses, %u/%u releases%s\n", c->reports,
+	       c->presses, expected, c->releases, expected,
+	       any_down(c) ? ", keys still held" : "");
+	printf("gap between reports (polling period %u us):\n", POLL_US);
+	for (size_t i = 0; i < BUCKET_COUNT; i++) {
+		printf("  %-28s %u\n", buckets[i].label, c->histogram[i]);
+	}
+	if (c->bursts > 0) {
+		printf("back to back: %u gaps, average %llu us, max %u us, min gap %u us\n",
+		       c->bursts, (unsigned long long)(c->burst_total_us / c->bursts),
+		       c->max_burst_us, c->min_us);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-v vid] [-p pid] [-n presses] [-t idle seconds] "
+		"[-w start seconds] [/dev/hidrawN]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct cadence c = {0};
+	uint32_t expected = 300;
+	int idle_ms = 5000;
+	/* Until the device shows up and the first report comes, -1 forever */
+	int start_ms = -1;
+	uint64_t start;
+	uint64_t last = 0;
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "v:p:n:t:w:h")) != -1) {
+		switch (opt) {
+		case 'v':
+			vid = strtoul(optarg, NULL, 16);
+			break;
+		case 'p':
+			pid = strtoul(optarg, NULL, 16);
+			break;
+		case 'w':
+			start_ms = atoi(optarg) * 1000;
+			break;
+		case 'n':
+			expected = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			idle_ms = atoi(optarg) * 1000;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	start = now_us();
+	fd = optind < argc ? open(argv[optind], O_RDONLY) : open_keyboard_device();
+	/* An attached USB/IP device takes a moment to get its hidraw node */
+	while (fd < 0 && optind >= argc && start_ms > 0 &&
+	       now_us() - start < (uint64_t)start_ms * 1000) {
+		usleep(100000);
+		fd = open_keyboard_device();
+	}
+	if (fd < 0) {
+		fprintf(stderr, "no keyboard interface found: %s\n",
+			errno ? strerror(errno) : "not connected");
+		return 1;
+	}
+
+	while (c.presses < expected || c.releases < expected || any_down(&c)) {
+		struct pollfd pfd = {.fd = fd, .events = POLLIN};
+		int wait_ms = idle_ms;
+		uint8_t buf[64];
+
+		/* Wait for the run to start, as long as -w allows */
+		if (c.reports == 0 && start_ms < 0) {
+			wait_ms = -1;
+		} else if (c.reports == 0) {
+			uint64_t waited_ms = (now_us() - start) / 1000;
+
+			wait_ms = waited_ms < (uint64_t)start_ms ? (int)(start_ms - waited_ms) : 0;
+		}
+
+		int ret = poll(&pfd, 1, wait_ms);
+
+		if (ret == 0) {
+			fprintf(stderr, "no report for %d s, stopping\n",
+				c.reports > 0 ? idle_ms / 1000 : start_ms / 1000);
+			break;
+		}
+
+		ssize_t len = ret > 0 ? read(fd, buf, sizeof(buf)) : -1;
+		uint64_t t = now_us();
+
+		if (len <= 0) {
+			perror("read");
+			break;
+		}
+
+		const uint8_t *keys = report_keys(buf, len);
+
+		if (keys == NULL) {
+			continue;
+		}
+		if (c.reports > 0) {
+			account_gap(&c, t - last > UINT32_MAX ? UINT32_MAX : t - last);
+		}
+		last = t;
+		c.reports++;
+		account_keys(&c, keys);
+	}
+
+	print_summary(&c, expected);
+	close(fd);
+	return c.presses == expected && c.releases == expected && !any_down(&c) ? 0 : 1;
+}
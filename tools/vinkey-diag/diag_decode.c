@@ -0,0 +1,300 @@
+#include <string.h>
+
+#include "diag_decode.h"
+
+static uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+	return get_le16(p) | ((uint32_t)get_le16(p + 2) << 16);
+}
+
+static int decode_status(const uint8_t *p, uint8_t len, struct diag_status *s)
+{
+	if (len != 20) {
+		return DIAG_ERR_LENGTH;
+	}
+	s->uptime_ms = get_le32(&p[0]);
+	s->key_events = get_le32(&p[4]);
+	s->boot_dropped = get_le32(&p[8]);
+	s->key_ns_avg = get_le32(&p[12]);
+	s->key_ns_max = get_le32(&p[16]);
+	return DIAG_OK;
+}
+
+static int decode_matrix(const uint8_t *p, uint8_t len, struct diag_matrix *m)
+{
+	int keys = 0;
+
+	if (len < 1 || p[0] > VINKEY_DIAG_MATRIX_BANKS_MAX || len < 1 + 2 * p[0]) {
+		return DIAG_ERR_LENGTH;
+	}
+	m->banks = p[0];
+	for (int bank = 0; bank < m->banks; bank++) {
+		m->rows[bank] = p[1 + 2 * bank];
+		m->cols[bank] = p[2 + 2 * bank];
+		keys += m->rows[bank] * m->cols[bank];
+	}
+
+	int header = 1 + 2 * m->banks;
+
+	if (len != header + (keys + 7) / 8) {
+		return DIAG_ERR_LENGTH;
+	}
+	memcpy(m->bits, &p[header], len - header);
+	return DIAG_OK;
+}
+
+static int decode_transport(const uint8_t *p, uint8_t len, struct diag_transport *t)
+{
+	if (len != 1 + VINKEY_DIAG_TRANSPORT_NAME_LEN + 2 + 12) {
+		return DIAG_ERR_LENGTH;
+	}
+	t->index = p[0];
+	memcpy(t->name, &p[1], VINKEY_DIAG_TRANSPORT_NAME_LEN);
+	t->name[VINKEY_DIAG_TRANSPORT_NAME_LEN] = '\0';
+	t->queue_used = p[9];
+	t->queue_peak = p[10];
+	t->sent = get_le32(&p[11]);
+	t->failed = get_le32(&p[15]);
+	t->dropped = get_le32(&p[19]);
+	return DIAG_OK;
+}
+
+static int decode_chatter(const uint8_t *p, uint8_t len, struct diag_chatter *c)
+{
+	if (len < 1) {
+		return DIAG_ERR_LENGTH;
+	}
+	c->first = p[0];
+	c->count = len - 1;
+	memcpy(c->counts, &p[1], c->count);
+	return DIAG_OK;
+}
+
+static int decode_latency(const uint8_t *p, uint8_t len, struct diag_latency *l)
+{
+	if (len < 2) {
+		return DIAG_ERR_LENGTH;
+	}
+	l->shift = p[0];
+	l->count = p[1];
+	if (l->count > VINKEY_DIAG_LATENCY_BUCKETS || len != 2 + 2 * l->count) {
+		return DIAG_ERR_LENGTH;
+	}
+	for (int i = 0; i < l->count; i++) {
+		l->buckets[i] = get_le16(&p[2 + 2 * i]);
+	}
+	return DIAG_OK;
+}
+
+static int decode_i2c(const uint8_t *p, uint8_t len, struct diag_i2c *i)
+{
+	if (len < 24) {
+		return DIAG_ERR_LENGTH;
+	}
+	i->transfers = get_le32(&p[0]);
+	i->bytes = get_le32(&p[4]);
+	i->failures = get_le32(&p[8]);
+	i->recoveries = get_le32(&p[12]);
+	i->max_us = get_le32(&p[16]);
+	i->busy_permille = get_le16(&p[20]);
+	i->wire_permille = get_le16(&p[22]);
+	return decode_latency(&p[24], len - 24, &i->durations);
+}
+
+static int decode_key_stats(const uint8_t *p, uint8_t len, struct diag_key_stats *k)
+{
+	if (len < 1 || (len - 1) % VINKEY_DIAG_KEY_STATS_SIZE != 0) {
+		return DIAG_ERR_LENGTH;
+	}
+	k->first = p[0];
+	k->count = (len - 1) / VINKEY_DIAG_KEY_STATS_SIZE;
+	for (int i = 0; i < k->count; i++) {
+		const uint8_t *key = &p[1 + i * VINKEY_DIAG_KEY_STATS_SIZE];
+
+		k->keys[i].presses = get_le32(&key[0]);
+		k->keys[i].chatter = get_le16(&key[4]);
+		k->keys[i].gap_us = get_le16(&key[6]);
+	}
+	return DIAG_OK;
+}
+
+static int decode_energy(const uint8_t *p, uint8_t len, struct diag_energy *e)
+{
+	if (len < 1 || p[0] > VINKEY_DIAG_ENERGY_MAX ||
+	    len != 1 + p[0] * VINKEY_DIAG_ENERGY_SIZE) {
+		return DIAG_ERR_LENGTH;
+	}
+	e->count = p[0];
+	for (int i = 0; i < e->count; i++) {
+		const uint8_t *part = &p[1 + i * VINKEY_DIAG_ENERGY_SIZE];
+
+		e->parts[i].charge_uc = get_le32(&part[0]);
+		e->parts[i].ua = get_le32(&part[4]);
+	}
+	return DIAG_OK;
+}
+
+int diag_decode(const uint8_t *buf, size_t len, struct diag_frame *out)
+{
+	if (len < VINKEY_DIAG_HEADER_SIZE) {
+		return DIAG_ERR_SHORT;
+	}
+
+	uint8_t payload_len = buf[2];
+	const uint8_t *payload = &buf[VINKEY_DIAG_HEADER_SIZE];
+
+	if (payload_len > VINKEY_DIAG_PAYLOAD_MAX ||
+	    len < VINKEY_DIAG_HEADER_SIZE + (size_t)payload_len) {
+		return DIAG_ERR_SHORT;
+	}
+
+	memset(out, 0, sizeof(*out));
+	out->type = buf[0];
+	out->seq = buf[1];
+
+	switch (out->type) {
+	case VINKEY_DIAG_STATUS:
+		return decode_status(payload, payload_len, &out->status);
+	case VINKEY_DIAG_MATRIX:
+		return decode_matrix(payload, payload_len, &out->matrix);
+	case VINKEY_DIAG_TRANSPORT:
+		return decode_transport(payload, payload_len, &out->transport);
+	case VINKEY_DIAG_CHATTER:
+		return decode_chatter(payload, payload_len, &out->chatter);
+	case VINKEY_DIAG_LATENCY:
+		return decode_latency(payload, payload_len, &out->latency);
+	case VINKEY_DIAG_I2C:
+		return decode_i2c(payload, payload_len, &out->i2c);
+	case VINKEY_DIAG_KEY_STATS:
+		return decode_key_stats(payload, payload_len, &out->key_stats);
+	case VINKEY_DIAG_ENERGY:
+		return decode_energy(payload, payload_len, &out->energy);
+	default:
+		return DIAG_ERR_TYPE;
+	}
+}
+
+int diag_matrix_pressed(const struct diag_matrix *m, int bank, int row, int col)
+{
+	int key = row * m->cols[bank] + col;
+
+	for (int i = 0; i < bank; i++) {
+		key += m->rows[i] * m->cols[i];
+	}
+
+	return (m->bits[key / 8] >> (key % 8)) & 1;
+}
+
+const char *diag_strerror(int err)
+{
+	switch (err) {
+	case DIAG_OK:
+		return "ok";
+	case DIAG_ERR_SHORT:
+		return "truncated frame";
+	case DIAG_ERR_LENGTH:
+		return "bad payload length";
+	case DIAG_ERR_TYPE:
+		return "unknown frame type";
+	default:
+		return "unknown error";
+	}
+}
+
+static const char *const energy_parts[] = {
+	"scan", "cpu", "radio", "led pwr", "led usb", "led ble", "led caps",
+};
+
+void diag_print(FILE *out, const struct diag_frame *f)
+{
+	switch (f->type) {
+	case VINKEY_DIAG_STATUS:
+		fprintf(out, "[%3u] status: uptime %u ms, %u key events, %u dropped at boot, "
+			"%u ns per key event (max %u ns)\n",
+			f->seq, f->status.uptime_ms, f->status.key_events, f->status.boot_dropped,
+			f->status.key_ns_avg, f->status.key_ns_max);
+		break;
+	case VINKEY_DIAG_MATRIX:
+		fprintf(out, "[%3u] matrix", f->seq);
+		for (int bank = 0; bank < f->matrix.banks; bank++) {
+			fprintf(out, " %ux%u:", f->matrix.rows[bank], f->matrix.cols[bank]);
+			for (int row = 0; row < f->matrix.rows[bank]; row++) {
+				fputc(' ', out);
+				for (int col = 0; col < f->matrix.cols[bank]; col++) {
+					fputc(diag_matrix_pressed(&f->matrix, bank, row, col)
+					      ? '#' : '.', out);
+				}
+			}
+		}
+		fputc('\n', out);
+		break;
+	case VINKEY_DIAG_TRANSPORT:
+		fprintf(out, "[%3u] %-8s queue %u (peak %u), sent %u, failed %u, dropped %u\n",
+			f->seq, f->transport.name, f->transport.queue_used, f->transport.queue_peak,
+			f->transport.sent, f->transport.failed, f->transport.dropped);
+		break;
+	case VINKEY_DIAG_CHATTER:
+		fprintf(out, "[%3u] chatter:", f->seq);
+		for (int i = 0; i < f->chatter.count; i++) {
+			if (f->chatter.counts[i] != 0) {
+				fprintf(out, " key %d: %u", f->chatter.first + i, f->chatter.counts[i]);
+			}
+		}
+		fputc('\n', out);
+		break;
+	case VINKEY_DIAG_LATENCY:
+		fprintf(out, "[%3u] latency:", f->seq);
+		for (int i = 0; i < f->latency.count; i++) {
+			if (f->latency.buckets[i] != 0) {
+				fprintf(out, " <%luus: %u", 1UL << (f->latency.shift + i),
+					f->latency.buckets[i]);
+			}
+		}
+		fputc('\n', out);
+		break;
+	case VINKEY_DIAG_I2C:
+		fprintf(out, "[%3u] i2c: %u transfers, %u bytes, %u failed, %u recoveries, "
+			"%u.%u%% busy, %u.%u%% on the wire, max %u us:", f->seq,
+			f->i2c.transfers, f->i2c.bytes, f->i2c.failures, f->i2c.recoveries,
+			f->i2c.busy_permille / 10, f->i2c.busy_permille % 10,
+			f->i2c.wire_permille / 10, f->i2c.wire_permille % 10, f->i2c.max_us);
+		for (int i = 0; i < f->i2c.durations.count; i++) {
+			if (f->i2c.durations.buckets[i] != 0) {
+				fprintf(out, " <%luus: %u", 1UL << (f->i2c.durations.shift + i),
+					f->i2c.durations.buckets[i]);
+			}
+		}
+		fputc('\n', out);
+		break;
+	case VINKEY_DIAG_KEY_STATS:
+		fprintf(out, "[%3u] key stats:", f->seq);
+		for (int i = 0; i < f->key_stats.count; i++) {
+			fprintf(out, " key %d: %u/%u/%uus gap", f->key_stats.first + i,
+				f->key_stats.keys[i].presses, f->key_stats.keys[i].chatter,
+				f->key_stats.keys[i].gap_us);
+		}
+		fputc('\n', out);
+		break;
+	case VINKEY_DIAG_ENERGY:
+		fprintf(out, "[%3u] energy:", f->seq);
+		for (int i = 0; i < f->energy.count; i++) {
+			/* 1 uAh is 3.6 mC */
+			uint32_t uah = f->energy.parts[i].charge_uc / 3600;
+
+			fprintf(out, " %s %u.%03u mAh/%u uA",
+				i < (int)(sizeof(energy_parts) / sizeof(energy_parts[0]))
+				? energy_parts[i] : "?", uah / 1000, uah % 1000,
+				f->energy.parts[i].ua);
+		}
+		fputc('\n', out);
+		break;
+	default:
+		fprintf(out, "[%3u] type %u\n", f->seq, f->type);
+		break;
+	}
+}
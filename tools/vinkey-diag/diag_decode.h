@@ -0,0 +1,109 @@
+#pragma once
+
+/*
+ * Decoder for the keyboard diagnostics frames. Pure functions on byte
+ * buffers, no I/O, so captured frames can be fed to it anywhere.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vinkey_diag_proto.h"
+
+#define DIAG_MAX_KEYS (VINKEY_DIAG_PAYLOAD_MAX * 8)
+
+enum diag_error {
+	DIAG_OK = 0,
+	/* Buffer shorter than the header or the declared payload */
+	DIAG_ERR_SHORT = -1,
+	/* Payload length does not match the frame type */
+	DIAG_ERR_LENGTH = -2,
+	DIAG_ERR_TYPE = -3,
+};
+
+struct diag_status {
+	uint32_t uptime_ms;
+	uint32_t key_events;
+	uint32_t boot_dropped;
+	uint32_t key_ns_avg;
+	uint32_t key_ns_max;
+};
+
+struct diag_matrix {
+	uint8_t banks;
+	uint8_t rows[VINKEY_DIAG_MATRIX_BANKS_MAX];
+	uint8_t cols[VINKEY_DIAG_MATRIX_BANKS_MAX];
+	uint8_t bits[VINKEY_DIAG_PAYLOAD_MAX - 1];
+};
+
+struct diag_transport {
+	uint8_t index;
+	char name[VINKEY_DIAG_TRANSPORT_NAME_LEN + 1];
+	uint8_t queue_used;
+	uint8_t queue_peak;
+	uint32_t sent;
+	uint32_t failed;
+	uint32_t dropped;
+};
+
+struct diag_chatter {
+	uint8_t first;
+	uint8_t count;
+	uint8_t counts[VINKEY_DIAG_PAYLOAD_MAX - 1];
+};
+
+struct diag_latency {
+	uint8_t shift;
+	uint8_t count;
+	uint16_t buckets[VINKEY_DIAG_LATENCY_BUCKETS];
+};
+
+struct diag_i2c {
+	uint32_t transfers;
+	uint32_t bytes;
+	uint32_t failures;
+	uint32_t recoveries;
+	uint32_t max_us;
+	uint16_t busy_permille;
+	uint16_t wire_permille;
+	struct diag_latency durations;
+};
+
+struct diag_key_stats {
+	uint8_t first;
+	uint8_t count;
+	struct {
+		uint32_t presses;
+		uint16_t chatter;
+		uint16_t gap_us;
+	} keys[VINKEY_DIAG_KEY_STATS_MAX];
+};
+
+struct diag_energy {
+	uint8_t count;
+	struct {
+		uint32_t charge_uc;
+		uint32_t ua;
+	} parts[VINKEY_DIAG_ENERGY_MAX];
+};
+
+struct diag_frame {
+	uint8_t type;
+	uint8_t seq;
+	union {
+		struct diag_status status;
+		struct diag_matrix matrix;
+		struct diag_transport transport;
+		struct diag_chatter chatter;
+		struct diag_latency latency;
+		struct diag_i2c i2c;
+		struct diag_key_stats key_stats;
+		struct diag_energy energy;
+	};
+};
+
+int diag_decode(const uint8_t *buf, size_t len, struct diag_frame *out);
+int diag_matrix_pressed(const struct diag_matrix *m, int bank, int row, int col);
+const char *diag_strerror(int err);
+void diag_print(FILE *out, const struct diag_frame *frame);
@@ -0,0 +1,65 @@
+/*
+ * Decodes one captured frame and compares the printed result with the
+ * expected text next to it, "error: <reason>" for frames that must be
+ * rejected.
+ *
+ *   diag_test frames/status.bin frames/status.txt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag_decode.h"
+
+static char *read_file(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	char *buf;
+
+	if (f == NULL) {
+		perror(path);
+		exit(2);
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	rewind(f);
+	buf = calloc(1, *len + 1);
+	if (buf == NULL || fread(buf, 1, *len, f) != *len) {
+		perror(path);
+		exit(2);
+	}
+	fclose(f);
+	return buf;
+}
+
+int main(int argc, char **argv)
+{
+	struct diag_frame frame;
+	size_t frame_len;
+	size_t expected_len;
+	char *decoded = NULL;
+	size_t decoded_len = 0;
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <frame.bin> <expected.txt>\n", argv[0]);
+		return 2;
+	}
+
+	uint8_t *buf = (uint8_t *)read_file(argv[1], &frame_len);
+	char *expected = read_file(argv[2], &expected_len);
+	FILE *out = open_memstream(&decoded, &decoded_len);
+	int err = diag_decode(buf, frame_len, &frame);
+
+	if (err) {
+		fprintf(out, "error: %s\n", diag_strerror(err));
+	} else {
+		diag_print(out, &frame);
+	}
+	fclose(out);
+
+	if (strcmp(decoded, expected) != 0) {
+		fprintf(stderr, "%s\nexpected: %sdecoded:  %s", argv[1], expected, decoded);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * Reads the keyboard diagnostics stream from hidraw and prints it.
+ *
+ *   vinkey-diag [-w capture.bin] [/dev/hidrawN]   live, optionally recording
+ *   vinkey-diag -r capture.bin                    decode a recording
+ *
+ * Without a device path the first hidraw node with the keyboard's VID/PID
+ * and a vendor defined report descriptor is used. A recording is the raw
+ * 64 byte frames back to back.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/hidraw.h>
+#include <sys/ioctl.h>
+
+#include "diag_decode.h"
+
+#define VINKEY_VID (0x16C0)
+#define VINKEY_PID (0x27DB)
+
+static int is_diag_interface(int fd)
+{
+	struct hidraw_devinfo info;
+	struct hidraw_report_descriptor desc = {0};
+	int size;
+
+	if (ioctl(fd, HIDIOCGRAWINFO, &info) < 0 ||
+	    (uint16_t)info.vendor != VINKEY_VID || (uint16_t)info.product != VINKEY_PID) {
+		return 0;
+	}
+	if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0 || size < 3) {
+		return 0;
+	}
+	desc.size = size;
+	if (ioctl(fd, HIDIOCGRDESC, &desc) < 0) {
+		return 0;
+	}
+	/* Usage Page (0xFF00), vendor defined */
+	return desc.value[0] == 0x06 && desc.value[1] == 0x00 && desc.value[2] == 0xFF;
+}
+
+static int open_diag_device(void)
+{
+	DIR *dir = opendir("/dev");
+	struct dirent *entry;
+	int fd = -1;
+
+	if (dir == NULL) {
+		return -1;
+	}
+	while (fd < 0 && (entry = readdir(dir)) != NULL) {
+		char path[300];
+
+		if (strncmp(entry->d_name, "hidraw", 6) != 0) {
+			continue;
+		}
+		snprintf(path, sizeof(path), "/dev/%s", entry->d_name);
+		fd = open(path, O_RDONLY);
+		if (fd >= 0 && !is_diag_interface(fd)) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	closedir(dir);
+	return fd;
+}
+
+static void decode_one(const uint8_t *frame, size_t len)
+{
+	struct diag_frame decoded;
+	int err = diag_decode(frame, len, &decoded);
+
+	if (err) {
+		fprintf(stderr, "bad frame: %s\n", diag_strerror(err));
+		return;
+	}
+	diag_print(stdout, &decoded);
+}
+
+static int replay(const char *path)
+{
+	uint8_t frame[VINKEY_DIAG_FRAME_SIZE];
+	FILE *in = fopen(path, "rb");
+
+	if (in == NULL) {
+		perror(path);
+		return 1;
+	}
+	while (fread(frame, 1, sizeof(frame), in) == sizeof(frame)) {
+		decode_one(frame, sizeof(frame));
+	}
+	fclose(in);
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-w capture.bin] [/dev/hidrawN]\n"
+			"       %s -r capture.bin\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *record = NULL;
+	FILE *capture = NULL;
+	uint8_t frame[VINKEY_DIAG_FRAME_SIZE];
+	int opt;
+	int fd;
+
+	while ((opt = getopt(argc, argv, "r:w:h")) != -1) {
+		switch (opt) {
+		case 'r':
+			return replay(optarg);
+		case 'w':
+			record = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	fd = optind < argc ? open(argv[optind], O_RDONLY) : open_diag_device();
+	if (fd < 0) {
+		fprintf(stderr, "no diagnostics interface found: %s\n",
+			errno ? strerror(errno) : "not connected");
+		return 1;
+	}
+	if (record != NULL && (capture = fopen(record, "wb")) == NULL) {
+		perror(record);
+		return 1;
+	}
+
+	while (1) {
+		ssize_t len = read(fd, frame, sizeof(frame));
+
+		if (len <= 0) {
+			perror("read");
+			break;
+		}
+		if (capture != NULL && len == sizeof(frame)) {
+			fwrite(frame, 1, sizeof(frame), capture);
+			fflush(capture);
+		}
+		decode_one(frame, len);
+	}
+
+	if (capture != NULL) {
+		fclose(capture);
+	}
+	close(fd);
+	return 0;
+}